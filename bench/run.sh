@@ -0,0 +1,81 @@
+#!/bin/sh
+# Builds clox twice at -O2, once with every optimization in
+# include/common.h turned off and once as configured there (debug
+# output always off). Then it runs each bench/*.lox on both, checks
+# they print the same thing and reports the best of RUNS times in ms.
+#
+#   sh bench/run.sh [workload.lox ...]
+#
+# CC, CFLAGS and RUNS can be set in the environment, EXTRA only goes
+# to the optimized build (EXTRA=-DREGISTER_VM times the register
+# loop). Timing uses date +%s%N, so it needs GNU date.
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${TMPDIR:-/tmp}/clox-bench.$$
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+RUNS=${RUNS:-5}
+EXTRA=${EXTRA:-}
+OPTIMIZATIONS="PEEPHOLE_OPTIMIZE OPTIMIZING_TIER INLINE_CALLS SPECIALIZE_NUMBERS
+    REGISTER_VM FUSE_COUNTING_LOOPS INLINE_CACHES JUMP_TABLES SIMD_KERNELS"
+
+trap 'rm -rf "$WORK"' EXIT
+
+# build <name> <toggles to comment out> <extra flags>
+build(){
+    mkdir -p "$WORK/$1/include" "$WORK/$1/obj" "$WORK/$1/cache"
+    cp "$ROOT"/include/*.h "$WORK/$1/include/"
+    for toggle in DEBUG_PRINT_CODE DEBUG_TRACE_EXECUTION $2; do
+        sed -i "s|^#define $toggle\$|// #define $toggle|" "$WORK/$1/include/common.h"
+    done
+    for source in "$ROOT"/lib/*.c "$ROOT"/main.c; do
+        $CC -std=c99 $CFLAGS $3 -I"$WORK/$1/include" -c "$source" \
+            -o "$WORK/$1/obj/$(basename "$source" .c).o"
+    done
+    $CC $CFLAGS -o "$WORK/$1/clox" "$WORK/$1"/obj/*.o -lm
+}
+
+# each build keeps its own .loxc files, they hold its compiled code
+run(){
+    CLOX_CACHE_DIR="$WORK/$1/cache" "$WORK/$1/clox" "$2"
+}
+
+# best <build> <script>, the fastest of RUNS runs in ms
+best(){
+    fastest=
+    run=0
+    while [ $run -lt "$RUNS" ]; do
+        start=$(date +%s%N)
+        run "$1" "$2" > /dev/null 2>&1
+        elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+        if [ -z "$fastest" ] || [ $elapsed -lt $fastest ]; then fastest=$elapsed; fi
+        run=$((run + 1))
+    done
+    echo $fastest
+}
+
+build baseline "$OPTIMIZATIONS" ""
+build optimized "" "$EXTRA"
+
+if [ $# -eq 0 ]; then set -- "$ROOT"/bench/*.lox; fi
+
+status=0
+printf "%-16s %10s %10s\n" workload "baseline" "optimized"
+for script in "$@"; do
+    if ! run baseline "$script" > "$WORK/baseline.out" 2>&1; then
+        echo "$(basename "$script"): failed"
+        cat "$WORK/baseline.out"
+        status=1
+        continue
+    fi
+    run optimized "$script" > "$WORK/optimized.out" 2>&1 || true
+    if ! cmp -s "$WORK/baseline.out" "$WORK/optimized.out"; then
+        echo "$(basename "$script"): output differs between the builds"
+        status=1
+        continue
+    fi
+    printf "%-16s %8sms %8sms\n" "$(basename "$script" .lox)" \
+        "$(best baseline "$script")" "$(best optimized "$script")"
+done
+exit $status
@@ -0,0 +1,20 @@
+#ifndef clox_arena_h
+#define clox_arena_h
+
+#include "common.h"
+#include "object.h"
+
+/*
+    one block of read-only memory holding the frozen chunks of
+    a compilation unit
+*/
+typedef struct CodeArena{
+    struct CodeArena* next;
+    void* memory;
+    size_t size;
+} CodeArena;
+
+void freeze_function(ObjFunction* function);
+void free_arenas();
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef clox_array_h
+#define clox_array_h
+
+#include "common.h"
+#include "object.h"
+
+Value array_get(ObjArray* array, int index);
+void array_set(ObjArray* array, int index, Value value);
+void array_append(ObjArray* array, Value value);
+
+bool array_native(int arg_count, Value* args, Value* result);
+bool len_native(int arg_count, Value* args, Value* result);
+bool push_native(int arg_count, Value* args, Value* result);
+bool sum_native(int arg_count, Value* args, Value* result);
+bool dot_native(int arg_count, Value* args, Value* result);
+bool scale_native(int arg_count, Value* args, Value* result);
+bool add_native(int arg_count, Value* args, Value* result);
+bool min_native(int arg_count, Value* args, Value* result);
+bool max_native(int arg_count, Value* args, Value* result);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef clox_cache_h
+#define clox_cache_h
+
+#include "common.h"
+#include "object.h"
+
+/*
+    the cache format is tied to the bytecode the compiler emits,
+    bump this whenever an opcode or the chunk layout changes so
+    stale .loxc files get ignored and rewritten, the header also
+    records which bytecode toggles in common.h were on so a build
+    with other ones rejects the file instead of running it
+*/
+#define LOXC_VERSION 17
+
+char* cache_path(const char* script_path);
+ObjFunction* load_cache(const char* path, const char* source);
+bool write_cache(const char* path, const char* source, ObjFunction* function);
+
+#endif
@@ -34,19 +34,230 @@ typedef enum{
     OP_JUMP_IF_FALSE,
     OP_JUMP,
     OP_LOOP,
-    OP_CALL
+    OP_CALL,
+    OP_NOT_EQUAL,
+    OP_GREATER_EQUAL,
+    OP_LESS_EQUAL,
+    /*
+        unchecked forms for operands proven to be numbers, see
+        specialize_chunk()
+    */
+    OP_ADD_NUMBER,
+    OP_SUBTRACT_NUMBER,
+    OP_MULTIPLY_NUMBER,
+    OP_DIVIDE_NUMBER,
+    OP_GREATER_NUMBER,
+    OP_GREATER_EQUAL_NUMBER,
+    OP_LESS_NUMBER,
+    OP_LESS_EQUAL_NUMBER,
+    /*
+        LESS_NUMBER JUMP_IF_FALSE POP in one, pops both numbers and
+        falls through when a < b, otherwise leaves false and jumps
+    */
+    OP_JUMP_IF_NOT_LESS,
+    /*
+        OP_CALL on a callee just read from a global, the second
+        operand is that global's name constant, see call_cached()
+    */
+    OP_CALL_GLOBAL,
+    /*
+        offset, counter slot, bound, step constant. adds the step to
+        the counter and falls through while it's below the bound,
+        otherwise leaves false and jumps. the bound is a slot for
+        FOR_LOOP and a constant for FOR_LOOP_K, the offset counts from
+        right after itself like every other jump
+    */
+    OP_FOR_LOOP,
+    OP_FOR_LOOP_K,
+    /*
+        `x op= value` in place, the operand is the local's slot or the
+        global's name constant. pops the value and pushes what the
+        variable holds afterwards
+    */
+    OP_ADD_LOCAL,
+    OP_SUBTRACT_LOCAL,
+    OP_MULTIPLY_LOCAL,
+    OP_DIVIDE_LOCAL,
+    OP_ADD_GLOBAL,
+    OP_SUBTRACT_GLOBAL,
+    OP_MULTIPLY_GLOBAL,
+    OP_DIVIDE_GLOBAL,
+    /*
+        jump tables, K count. pops a value and goes to one of the
+        count + 1 JUMPs right after it, the last one when no case
+        matches. SWITCH's cases are the integers from the number
+        constant K up, SWITCH_HASH's are the constants K onwards
+    */
+    OP_SWITCH,
+    OP_SWITCH_HASH,
+    /*
+        function constant, then a CaptureKind and an index for each
+        of the function's upvalues. pushes the new closure
+    */
+    OP_CLOSURE,
+    OP_GET_UPVALUE,
+    OP_SET_UPVALUE,
+    /*pops a local some closure points at, the closure keeps the value*/
+    OP_CLOSE_UPVALUE,
+    /*the in-place updates again, on one of the closure's upvalues*/
+    OP_ADD_UPVALUE,
+    OP_SUBTRACT_UPVALUE,
+    OP_MULTIPLY_UPVALUE,
+    OP_DIVIDE_UPVALUE,
+    /*
+        the class's name constant, METHOD adds the method on top of
+        the stack to the class below it. INHERIT copies the methods of
+        the superclass below the class on top into it and pops it
+    */
+    OP_CLASS,
+    OP_INHERIT,
+    OP_METHOD,
+    /*
+        property name constant, looked up through the chunk's property
+        cache for that name, see property_cache(). the invokes call the
+        method straight away with the argument count after the name,
+        the super forms find it in the class on top of the stack
+    */
+    OP_GET_PROPERTY,
+    OP_SET_PROPERTY,
+    OP_INVOKE,
+    OP_GET_SUPER,
+    OP_SUPER_INVOKE,
+    /*the in-place updates again, on a field of the instance below the operand*/
+    OP_ADD_PROPERTY,
+    OP_SUBTRACT_PROPERTY,
+    OP_MULTIPLY_PROPERTY,
+    OP_DIVIDE_PROPERTY,
+    /*
+        ARRAY pops its count of elements into a new array and MAP its
+        count of key value pairs into a new map, the index ones take
+        the array or map and the index below the value if they have one
+    */
+    OP_ARRAY,
+    OP_MAP,
+    OP_GET_INDEX,
+    OP_SET_INDEX,
+    OP_ADD_INDEX,
+    OP_SUBTRACT_INDEX,
+    OP_MULTIPLY_INDEX,
+    OP_DIVIDE_INDEX,
+    /*
+        intrinsics, what a call to the native of the same name compiles
+        to. the callee stays under the arguments and gets a real call
+        if it isn't that native anymore. MIN and MAX are the two
+        argument ones
+    */
+    OP_SQRT,
+    OP_FLOOR,
+    OP_ABS,
+    OP_MIN,
+    OP_MAX,
+    OP_LEN,
+    /*joins its count of strings into one, see emit_add() in lib/compiler.c*/
+    OP_CONCAT_N
 } OpCode;
 
+/*
+    how OP_CLOSURE gets each upvalue. a local that's never assigned
+    after it's declared can't change under the closure, so the closure
+    keeps a copy of it. the others are shared with the enclosing
+    function until the local goes out of scope
+*/
+typedef enum{
+    CAPTURE_UPVALUE,    // the enclosing closure's upvalue at the index
+    CAPTURE_LOCAL,      // the enclosing function's local in the slot
+    CAPTURE_COPY        // a copy of the value in that slot
+} CaptureKind;
+
+/*
+    lines are run-length encoded, every run starts at the first byte
+    of code that came from a new line and lasts until the next run
+*/
+typedef struct{
+    int offset;
+    int line;
+} LineStart;
+
+/*
+    a line in code INLINE_CALLS copied in from another function keeps
+    the number of the inlined call it came from above the line itself,
+    0 is the function's own code, see InlineFrame in object.h
+*/
+#define LINE_FRAME_SHIFT 22
+#define LINE_NUMBER(line) ((line) & ((1 << LINE_FRAME_SHIFT) - 1))
+#define LINE_FRAME(line) ((line) >> LINE_FRAME_SHIFT)
+#define MAX_INLINE_FRAMES 255
+
+/*
+    what the VM found the last time it went through one of a chunk's
+    name constants, there's one for every constant
+*/
 typedef struct{
+    int index;      // the name's entry in vm.globals, -1 when unknown
+    Obj* callee;    // the last callee OP_CALL_GLOBAL checked
+    int arity;      // and the argument count it was checked with
+} GlobalCache;
+
+/*
+    one shape a property name was found on. reads only take entries
+    where `next` is `shape`, writes only the ones with a field slot
+*/
+typedef struct{
+    struct ObjShape* shape;     // NULL while the entry is unused
+    struct ObjShape* next;      // the shape a write leaves the instance with
+    int slot;                   // the field's slot, -1 for a method
+    Obj* method;
+} ShapeCase;
+
+/*
+    the shapes a chunk's property name constant was last used with,
+    up to PROPERTY_CACHE_SIZE of them before they start getting replaced
+*/
+typedef struct{
+    ShapeCase cases[PROPERTY_CACHE_SIZE];
+    int replace;    // the case the next miss goes in
+} PropertyCache;
+
+/*
+    the hash index an OP_SWITCH_HASH looks its cases up in, every
+    slot holds a case number or -1, the capacity is a power of two
+*/
+typedef struct{
+    int capacity;
+    int* slots;
+} CaseTable;
+
+typedef struct Chunk{
     int count;
     int capacity;
     uint8_t* code;
-    int* lines;
+    int line_count;
+    int line_capacity;
+    LineStart* lines;
     ValueArray constants;
+    /*the buffers live in a read-only CodeArena, see freeze_function()*/
+    bool frozen;
+    /*the register translation, built on first use, see register_code()*/
+    struct Chunk* registers;
+    bool untranslatable;
+    /*built the first time the chunk runs into a global, see global_cache()*/
+    GlobalCache* caches;
+    int cache_count;
+    /*one for every constant an OP_SWITCH_HASH starts at, see case_table()*/
+    CaseTable* case_tables;
+    int case_table_count;
+    /*one for every constant, made the first time a property is looked up*/
+    PropertyCache* property_caches;
+    int property_cache_count;
 } Chunk;
 
 void init_chunk(Chunk* chunk);
 void write_chunk(Chunk* chunk, uint8_t byte, int line);
+void truncate_chunk(Chunk* chunk, int count);
 void free_chunk(Chunk* chunk);
 int add_constant(Chunk* chunk, Value value);
+int instruction_length(Chunk* chunk, int offset);
+bool stack_effect(uint8_t* code, int* pops, int* pushes);
+int jump_table_size(uint8_t* code);
+int get_line(Chunk* chunk, int offset);
 #endif
\ No newline at end of file
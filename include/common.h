@@ -7,5 +7,72 @@
 
 #define DEBUG_PRINT_CODE
 #define DEBUG_TRACE_EXECUTION
+/*
+    run the peephole optimizer over every finished chunk,
+    comment out to get chunks exactly as the compiler emits them
+*/
+#define PEEPHOLE_OPTIMIZE
+/*
+    defer compiling global function bodies until they're first called,
+    syntax errors in those bodies then only show up at runtime
+*/
+//#define LAZY_COMPILE
+/*
+    functions called or looping HOT_THRESHOLD times get run through
+    the SSA optimizer in lib/ssa.c, comment out to stay on the
+    bytecode the compiler produced
+*/
+#define OPTIMIZING_TIER
+#define HOT_THRESHOLD 1000
+/*
+    calls to small global functions that are never reassigned get
+    the function's body copied in place of the call, INLINE_BUDGET
+    is the most bytes of code a body can have
+*/
+#define INLINE_CALLS
+#define INLINE_BUDGET 48
+/*
+    swap arithmetic and comparisons on values proven to be numbers
+    for opcodes that skip the type checks, see lib/specialize.c
+*/
+#define SPECIALIZE_NUMBERS
+/*
+    run functions on the register instruction set in lib/registers.c
+    instead of the stack one, code the translator can't handle still
+    runs on the stack loop
+*/
+//#define REGISTER_VM
+/*
+    compile `for (...; i < n; i = i + 1)` and the like into a single
+    instruction that steps the counter, compares and branches
+*/
+#define FUSE_COUNTING_LOOPS
+/*
+    global reads go through a per-chunk cache of where the name sits in
+    vm.globals, and calls to globals remember the callee they last
+    checked so the next call with it goes straight to the frame.
+    property reads, writes and method calls remember the field slot or
+    method they found for up to PROPERTY_CACHE_SIZE instance shapes
+*/
+#define INLINE_CACHES
+#define PROPERTY_CACHE_SIZE 4
+/*
+    a switch with at least JUMP_TABLE_MIN cases dispatches through a
+    jump table instead of comparing against every case in turn, dense
+    integer cases index straight into it and the rest are hashed
+*/
+#define JUMP_TABLES
+#define JUMP_TABLE_MIN 4
+/*
+    the array natives in lib/array.c work several numbers at a time
+    with SSE2 or AVX when the compiler targets them, comment out for
+    plain loops. sums can round differently from adding in order
+*/
+#define SIMD_KERNELS
+/*
+    print collects its output in a buffer of this many bytes that's
+    written out on its own schedule, see lib/output.c
+*/
+#define OUTPUT_BUFFER_SIZE 65536
 #define UINT8_COUNT (UINT8_MAX + 1)
 #endif
\ No newline at end of file
@@ -3,6 +3,11 @@
 
 #include "vm.h"
 
-ObjFunction* compile(const char* source);
+ObjFunction* compile(const char* source, bool whole_program);
+bool compile_function_body(ObjFunction* function);
+/*the global consts in the order they're declared, the cache keeps them for lazy bodies*/
+void define_global_constant(ObjString* name, Value value);
+int global_constant_count();
+ObjString* global_constant(int index, Value* value);
 
 #endif
\ No newline at end of file
@@ -5,4 +5,6 @@
 
 void disassemble_chunk(Chunk* chunk, const char* name);
 int disassemble_instruction(Chunk* chunk, int offset);
+void disassemble_registers(Chunk* chunk, const char* name);
+int disassemble_register_instruction(Chunk* chunk, int offset);
 #endif
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef clox_inline_h
+#define clox_inline_h
+
+#include "common.h"
+#include "chunk.h"
+#include "object.h"
+
+/*
+    a call the compiler found safe to inline, `callee` is the
+    GET_GLOBAL that loads the function and `call` the OP_CALL, both
+    byte offsets, `constants` maps the callee's constant slots to
+    slots in the caller's table
+*/
+typedef struct{
+    int callee;
+    int call;
+    ObjFunction* function;
+    uint8_t* constants;
+} CallSite;
+
+bool can_inline(ObjFunction* function);
+int inline_calls(ObjFunction* function, int entry, CallSite* sites, int count);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef clox_listing_h
+#define clox_listing_h
+
+#include "common.h"
+#include "chunk.h"
+
+/*
+    a decoded copy of a chunk the optimizers work on, every
+    instruction keeps its original offset and jumps point at the
+    instruction they land on rather than at a byte offset, that way
+    instructions can be dropped, changed or have code spliced around
+    them freely and the offsets are only worked out again when the
+    chunk is rebuilt
+*/
+typedef struct{
+    int offset;         // where it sits in the original chunk
+    int length;
+    int line;
+    int target;         // index of the instruction a jump lands on, -1 otherwise
+    uint8_t opcode;
+    bool removed;
+    bool is_target;
+    bool reachable;
+    /*one of the JUMPs of a jump table, it has to stay a jump*/
+    bool in_table;
+    /*
+        spliced in code, `before` runs ahead of the instruction and
+        jumps to the instruction land on it, `after` follows it,
+        both index into Listing.bytes
+    */
+    int before;
+    int before_count;
+    int after;
+    int after_count;
+    /*where the operands come from in Listing.bytes once replaced, -1 before*/
+    int operands;
+} Instruction;
+
+typedef struct{
+    Chunk* chunk;
+    Instruction* code;
+    int count;
+    int capacity;
+    uint8_t* bytes;
+    int byte_count;
+    int byte_capacity;
+} Listing;
+
+void init_listing(Listing* listing, Chunk* chunk);
+bool is_conditional(uint8_t opcode);
+bool updates_local(uint8_t opcode);
+void free_listing(Listing* listing);
+int next_live(Listing* listing, int index);
+int resolve(Listing* listing, int index);
+void splice_before(Listing* listing, int index, uint8_t* bytes, int count);
+void splice_after(Listing* listing, int index, uint8_t* bytes, int count);
+void replace_operands(Listing* listing, int index, uint8_t* bytes, int count);
+void rebuild_listing(Listing* listing);
+int stack_depths(Listing* listing, int entry, int* depth);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef clox_map_h
+#define clox_map_h
+
+#include "common.h"
+#include "object.h"
+
+bool is_map_key(Value key);
+bool map_get(ObjMap* map, Value key, Value* value);
+void map_set(ObjMap* map, Value key, Value value);
+
+bool has_native(int arg_count, Value* args, Value* result);
+bool remove_native(int arg_count, Value* args, Value* result);
+bool keys_native(int arg_count, Value* args, Value* result);
+bool values_native(int arg_count, Value* args, Value* result);
+
+#endif
@@ -4,6 +4,7 @@
 #include "common.h"
 #include "value.h"
 #include "chunk.h"
+#include "table.h"
 
 #define OBJ_TYPE(value)     (AS_OBJ(value)->type)
 #define OBJ_TYPE(value)     (AS_OBJ(value)->type)
@@ -17,12 +18,34 @@
 
 
 #define IS_NATIVE(value) is_obj_type(value, OBJ_NATIVE)
-#define AS_NATIVE(value) (((ObjNative*)AS_OBJ(value))->function)
+#define AS_NATIVE(value) ((ObjNative*)AS_OBJ(value))
+
+#define IS_CLOSURE(value)   is_obj_type(value, OBJ_CLOSURE)
+#define AS_CLOSURE(value)   ((ObjClosure*)AS_OBJ(value))
+
+#define IS_CLASS(value)         is_obj_type(value, OBJ_CLASS)
+#define AS_CLASS(value)         ((ObjClass*)AS_OBJ(value))
+#define IS_INSTANCE(value)      is_obj_type(value, OBJ_INSTANCE)
+#define AS_INSTANCE(value)      ((ObjInstance*)AS_OBJ(value))
+#define IS_BOUND_METHOD(value)  is_obj_type(value, OBJ_BOUND_METHOD)
+#define AS_BOUND_METHOD(value)  ((ObjBoundMethod*)AS_OBJ(value))
+#define IS_ARRAY(value)         is_obj_type(value, OBJ_ARRAY)
+#define AS_ARRAY(value)         ((ObjArray*)AS_OBJ(value))
+#define IS_MAP(value)           is_obj_type(value, OBJ_MAP)
+#define AS_MAP(value)           ((ObjMap*)AS_OBJ(value))
 
 typedef enum{
     OBJ_FUNCTION,
     OBJ_STRING,
-    OBJ_NATIVE
+    OBJ_NATIVE,
+    OBJ_CLOSURE,
+    OBJ_UPVALUE,
+    OBJ_SHAPE,
+    OBJ_CLASS,
+    OBJ_INSTANCE,
+    OBJ_BOUND_METHOD,
+    OBJ_ARRAY,
+    OBJ_MAP
 } ObjType;
 
 struct Obj{
@@ -30,21 +53,159 @@ struct Obj{
     struct Obj* next;
 };
 
+/*
+    a call whose body got inlined, `line` is the call's own line and
+    may belong to another inlined call in turn. errors in the body
+    still report the callee's frame with it
+*/
+typedef struct{
+    ObjString* name;
+    int line;
+} InlineFrame;
+
 typedef struct{
     Obj obj;
     int arity;
+    /*a function with upvalues is only ever called through an ObjClosure*/
+    int upvalue_count;
     Chunk chunk;
     ObjString* name;
+    /*
+        the uncompiled body of a lazily compiled function,
+        NULL once the chunk has been filled in
+    */
+    ObjString* source;
+    int source_line;
+    /*how many global consts had been declared before it, see compile_function_body()*/
+    int visible_constants;
+    /*
+        calls and loop iterations so far, once it reaches
+        HOT_THRESHOLD the function gets an optimized chunk
+    */
+    int hotness;
+    Chunk* optimized;
+    /*the calls inlined into it, LINE_FRAME() of a line counts from 1*/
+    InlineFrame* inline_frames;
+    int inline_frame_count;
+    int inline_frame_capacity;
 } ObjFunction;
 
-typedef Value (*NativeFn)(int arg_count, Value* args);
-
+/*
+    a native stores what it returns in `result`, that's the slot the
+    native itself sat in. it returns false once native_error() has
+    reported why it couldn't
+*/
+typedef bool (*NativeFn)(int arg_count, Value* args, Value* result);
+
+/*
+    `params` has a letter for each parameter, the VM checks the
+    arguments against them before the call: n is a number, s a string,
+    a an array, m a map and . anything. the last `optional` of them can
+    be left out
+*/
 typedef struct {
     Obj obj;
     NativeFn function;
+    const char* name;
+    const char* params;
+    int arity;
+    int optional;
+    /*some parameter isn't a `.`*/
+    bool typed;
+    /*
+        the opcode a call with every argument compiles to, -1 if it's
+        an ordinary native
+    */
+    int intrinsic;
 }ObjNative;
 
 
+/*
+    a variable a closure can see, `location` points at the stack slot
+    while it's still open and at `closed` once it's moved off the
+    stack. open ones are kept in vm.open_upvalues by slot, highest
+    first
+*/
+typedef struct ObjUpvalue{
+    Obj obj;
+    Value* location;
+    Value closed;
+    struct ObjUpvalue* next;
+} ObjUpvalue;
+
+/*
+    functions without upvalues are called as they are, only the
+    ones that capture something get one of these. copied upvalues
+    live in `copies`, which are never on the open list
+*/
+typedef struct{
+    Obj obj;
+    ObjFunction* function;
+    ObjUpvalue** upvalues;
+    ObjUpvalue* copies;
+    int upvalue_count;
+} ObjClosure;
+
+/*
+    the layout of an instance's fields, `slots` maps every field name
+    to where it sits in the instance. instances that got the same
+    fields in the same order share a shape, adding a field moves an
+    instance along `transitions` to the shape with that field too
+*/
+typedef struct ObjShape{
+    Obj obj;
+    Table slots;
+    Table transitions;
+    int slot_count;
+} ObjShape;
+
+/*
+    every class has its own empty shape that its instances start
+    from, so a shape also says which class the instance belongs to
+*/
+typedef struct{
+    Obj obj;
+    ObjString* name;
+    Table methods;
+    ObjShape* shape;
+} ObjClass;
+
+typedef struct{
+    Obj obj;
+    ObjClass* klass;
+    ObjShape* shape;
+    Value* fields;
+    int capacity;
+} ObjInstance;
+
+/*`method` is the ObjFunction or ObjClosure it was declared as*/
+typedef struct{
+    Obj obj;
+    Value receiver;
+    Obj* method;
+} ObjBoundMethod;
+
+/*
+    while every element is a number they're kept unboxed in `numbers`,
+    the first one that isn't moves them all into `values`. only one of
+    the two is ever allocated, see lib/array.c
+*/
+typedef struct{
+    Obj obj;
+    bool unboxed;
+    int count;
+    int capacity;
+    double* numbers;
+    Value* values;
+} ObjArray;
+
+/*`count` is how many keys it holds, the table's own count has the deleted ones too*/
+typedef struct{
+    Obj obj;
+    Table table;
+    int count;
+} ObjMap;
+
 struct ObjString{
    Obj obj;
    int length;
@@ -57,7 +218,17 @@ ObjString* take_string(char* chars, int length);
 void print_object(Value value);
 
 ObjFunction* new_function();
-ObjNative* new_native(NativeFn function);
+ObjNative* new_native(NativeFn function, const char* name, const char* params, int optional);
+ObjClosure* new_closure(ObjFunction* function);
+ObjUpvalue* new_upvalue(Value* slot);
+ObjShape* new_shape();
+ObjShape* shape_with(ObjShape* shape, ObjString* name);
+int shape_slot(ObjShape* shape, ObjString* name);
+ObjClass* new_class(ObjString* name);
+ObjInstance* new_instance(ObjClass* klass);
+ObjBoundMethod* new_bound_method(Value receiver, Obj* method);
+ObjArray* new_array();
+ObjMap* new_map();
 
 static inline bool is_obj_type(Value value, ObjType type){
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
@@ -0,0 +1,28 @@
+#ifndef clox_output_h
+#define clox_output_h
+
+#include "common.h"
+
+/*when what's been written actually goes out to stdout*/
+typedef enum{
+    FLUSH_LINE,         // at the end of every line
+    FLUSH_BLOCK,        // once OUTPUT_BUFFER_SIZE bytes are waiting
+    FLUSH_EXPLICIT      // only on flush() and at exit, the buffer grows
+} FlushPolicy;
+
+typedef struct{
+    char* chars;
+    int count;
+    int capacity;
+    FlushPolicy policy;
+} Output;
+
+void init_output(Output* output);
+void free_output(Output* output);
+void flush_output(Output* output);
+void output_chars(Output* output, const char* chars, int length);
+void output_string(Output* output, const char* string);
+void output_number(Output* output, double number);
+void output_format(Output* output, const char* format, ...);
+
+#endif
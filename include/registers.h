@@ -0,0 +1,65 @@
+#ifndef clox_registers_h
+#define clox_registers_h
+
+#include "common.h"
+#include "chunk.h"
+#include "object.h"
+
+/*
+    the register instruction set, operands name frame slots directly
+    instead of going through the top of the stack
+
+        A   the slot the result goes to
+        B C slots that are read
+        K   an index into the constant table
+
+    slots are the same slots the stack code uses, so a frame looks
+    the same to both interpreters and they can call each other
+*/
+typedef enum{
+    REG_MOVE,               // A B      A = B
+    REG_CONSTANT,           // A K
+    REG_NIL,                // A
+    REG_TRUE,               // A
+    REG_FALSE,              // A
+    REG_EQUAL,              // A B C    A = B == C
+    REG_NOT_EQUAL,
+    REG_GREATER,
+    REG_GREATER_EQUAL,
+    REG_LESS,
+    REG_LESS_EQUAL,
+    REG_ADD,
+    REG_SUBTRACT,
+    REG_MULTIPLY,
+    REG_DIVIDE,
+    REG_EQUAL_K,            // A B K    A = B == K
+    REG_NOT_EQUAL_K,
+    REG_GREATER_K,
+    REG_GREATER_EQUAL_K,
+    REG_LESS_K,
+    REG_LESS_EQUAL_K,
+    REG_ADD_K,
+    REG_SUBTRACT_K,
+    REG_MULTIPLY_K,
+    REG_DIVIDE_K,
+    REG_NOT,                // A B
+    REG_NEGATE,             // A B
+    REG_PRINT,              // A
+    REG_GET_GLOBAL,         // A K
+    REG_SET_GLOBAL,         // A K
+    REG_DEFINE_GLOBAL,      // A K
+    REG_ADD_GLOBAL,         // A K      K = K + A, A = K
+    REG_SUBTRACT_GLOBAL,
+    REG_MULTIPLY_GLOBAL,
+    REG_DIVIDE_GLOBAL,
+    REG_JUMP,               // offset
+    REG_JUMP_IF_FALSE,      // A offset
+    REG_LOOP,               // offset
+    REG_CALL,               // A count, the callee sits in A and its arguments follow
+    REG_CALL_GLOBAL,        // A count K, REG_CALL on a callee read from the global K
+    REG_RETURN              // A
+} RegisterOpCode;
+
+Chunk* register_code(ObjFunction* function, Chunk* chunk);
+
+#endif
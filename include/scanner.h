@@ -5,14 +5,18 @@ typedef enum {
     /*single character tokens */
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN, TOKEN,
     TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
     TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
-    TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
+    TOKEN_SEMICOLON, TOKEN_COLON, TOKEN_SLASH, TOKEN_STAR,
 
     /* one or more character tokens */
     TOKEN_BANG, TOKEN_BANG_EQUAL,
     TOKEN_EQUAL, TOKEN_EQUAL_EQUAL,
     TOKEN_GREATER, TOKEN_GREATER_EQUAL,
     TOKEN_LESS, TOKEN_LESS_EQUAL,
+    TOKEN_PLUS_EQUAL, TOKEN_MINUS_EQUAL,
+    TOKEN_STAR_EQUAL, TOKEN_SLASH_EQUAL,
+    TOKEN_PLUS_PLUS, TOKEN_MINUS_MINUS,
 
     /* literals */
     TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
@@ -22,6 +26,7 @@ typedef enum {
     TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
     TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS,
     TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE,
+    TOKEN_SWITCH, TOKEN_CASE, TOKEN_DEFAULT, TOKEN_CONST,
 
     TOKEN_ERROR, TOKEN_EOF
 } TokenType;
@@ -31,9 +36,12 @@ typedef struct {
     const char* start;
     int length;
     int line;
+    /*the value of a TOKEN_NUMBER*/
+    double number;
 }Token;
 
 void init_scanner(const char* source);
+void init_scanner_at(const char* source, int line);
 Token scan_token();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,18 @@
+#ifndef clox_simd_h
+#define clox_simd_h
+
+#include "common.h"
+
+/*
+    loops over unboxed numbers for the array natives, `out` can be
+    one of the inputs. min and max need at least one number
+*/
+double vector_sum(const double* a, int count);
+double vector_dot(const double* a, const double* b, int count);
+double vector_min(const double* a, int count);
+double vector_max(const double* a, int count);
+void vector_scale(double* out, const double* a, double k, int count);
+void vector_add(double* out, const double* a, const double* b, int count);
+void vector_add_scalar(double* out, const double* a, double k, int count);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef clox_specialize_h
+#define clox_specialize_h
+
+#include "chunk.h"
+
+int specialize_chunk(Chunk* chunk, int entry);
+void generalize_chunk(Chunk* chunk);
+int fuse_loops(Chunk* chunk);
+
+#endif
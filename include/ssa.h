@@ -0,0 +1,8 @@
+#ifndef clox_ssa_h
+#define clox_ssa_h
+
+#include "object.h"
+
+bool tier_up(ObjFunction* function);
+
+#endif
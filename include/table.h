@@ -4,8 +4,12 @@
 #include "common.h"
 #include "value.h"
 
+/*
+    keys are interned strings, numbers or bools. an empty entry has a
+    nil key and value, a deleted one a nil key and a true value
+*/
 typedef struct {
-    ObjString* key;
+    Value key;
     Value value;
 } Entry;
 
@@ -17,9 +21,14 @@ typedef struct {
 
 void init_table(Table* table);
 void free_table(Table* table);
+uint32_t hash_value(Value value);
 bool table_get(Table* table, ObjString* key, Value* value);
+int table_index(Table* table, ObjString* key);
 bool table_set(Table* table, ObjString* key, Value value);
 bool table_delete(Table* table, ObjString* key);
+bool table_get_value(Table* table, Value key, Value* value);
+bool table_set_value(Table* table, Value key, Value value);
+bool table_delete_value(Table* table, Value key);
 void table_add_all(Table* from, Table* to);
 ObjString* table_find_string(Table* table, const char* chars, int length, uint32_t hash);
 #endif
\ No newline at end of file
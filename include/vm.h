@@ -4,6 +4,7 @@
 #include "chunk.h"
 #include "table.h"
 #include "object.h"
+#include "output.h"
 
 
 #define FRAMES_MAX 64
@@ -11,6 +12,12 @@
 
 typedef struct {
     ObjFunction* function;
+    /*NULL unless the function was called through a closure*/
+    ObjClosure* closure;
+    /*the function's own chunk, its optimized one or a register translation*/
+    Chunk* chunk;
+    /*which of the two loops in run() this frame executes on*/
+    bool registers;
     uint8_t* ip;
     Value* slots;
 }CallFrame;
@@ -23,7 +30,14 @@ typedef struct{
     Value* stack_top;
     Table strings;
     Table globals;
+    /*the upvalues still pointing into the stack, highest slot first*/
+    ObjUpvalue* open_upvalues;
+    /*the name calling a class looks its initializer up by*/
+    ObjString* init_string;
     Obj* objects;
+    struct CodeArena* arenas;
+    /*everything meant for stdout goes through here*/
+    Output output;
 } VM;
 
 typedef enum{
@@ -39,4 +53,6 @@ void free_vm();
 void push(Value value);
 Value pop();
 InterpretResult interpret(const char* source);
+InterpretResult interpret_function(ObjFunction* function);
+void native_error(const char* format, ...);
 #endif
@@ -0,0 +1,166 @@
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "arena.h"
+#include "memory.h"
+#include "vm.h"
+
+/*
+    freezing packs every chunk of a compilation unit into one block
+
+        | constants | code | constants | code | ... | lines | lines | ...
+
+    each function's constants sit right in front of its bytecode,
+    the line tables are only needed for errors so they go at the end,
+    once everything is copied in the block is made read-only
+*/
+
+typedef struct{
+    int count;
+    int capacity;
+    ObjFunction** functions;
+} FunctionList;
+
+static size_t align(size_t size){
+    return (size + sizeof(Value) - 1) & ~(sizeof(Value) - 1);
+}
+
+/*inlined bodies bring their nested functions along, so one can show up twice*/
+static bool collected(FunctionList* list, ObjFunction* function){
+    for (int i = 0; i < list->count; i++){
+        if(list->functions[i] == function) return true;
+    }
+    return false;
+}
+
+static void collect(FunctionList* list, ObjFunction* function){
+    Chunk* chunk = &function->chunk;
+    if(chunk->frozen || collected(list, function)) return;
+
+    /*lazy bodies aren't compiled yet, they stay on the heap once they are*/
+    if(chunk->count > 0){
+        if(list->capacity < list->count + 1){
+            int old_capacity = list->capacity;
+            list->capacity = GROW_CAPACITY(old_capacity);
+            list->functions = GROW_ARRAY(ObjFunction*, list->functions,
+                                        old_capacity, list->capacity);
+        }
+        list->functions[list->count++] = function;
+    }
+
+    for (int i = 0; i < chunk->constants.count; i++){
+        Value constant = chunk->constants.values[i];
+        if(IS_FUNCTION(constant)) collect(list, AS_FUNCTION(constant));
+    }
+}
+
+static void* allocate_pages(size_t size){
+#ifdef _WIN32
+    return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+#endif
+}
+
+static void protect_pages(void* memory, size_t size){
+#ifdef _WIN32
+    DWORD old_protection;
+    VirtualProtect(memory, size, PAGE_READONLY, &old_protection);
+#else
+    mprotect(memory, size, PROT_READ);
+#endif
+}
+
+static void free_pages(void* memory, size_t size){
+#ifdef _WIN32
+    (void)size;
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    munmap(memory, size);
+#endif
+}
+
+/*
+    moves the chunks of `function` and everything nested in it into a
+    fresh arena, the chunks stay usable but can't be written to again
+*/
+void freeze_function(ObjFunction* function){
+    FunctionList list = {0, 0, NULL};
+    collect(&list, function);
+
+    size_t hot_size = 0;
+    size_t cold_size = 0;
+    for (int i = 0; i < list.count; i++){
+        Chunk* chunk = &list.functions[i]->chunk;
+        hot_size += align(sizeof(Value) * chunk->constants.count + chunk->count);
+        cold_size += sizeof(LineStart) * chunk->line_count;
+    }
+
+    uint8_t* memory = list.count > 0 ? allocate_pages(hot_size + cold_size) : NULL;
+    if(memory == NULL){
+        FREE_ARRAY(ObjFunction*, list.functions, list.capacity);
+        return;
+    }
+
+    uint8_t* hot = memory;
+    uint8_t* cold = memory + hot_size;
+    for (int i = 0; i < list.count; i++){
+        Chunk* chunk = &list.functions[i]->chunk;
+
+        size_t constants_size = sizeof(Value) * chunk->constants.count;
+        /*a chunk without constants has no array to copy from*/
+        if(constants_size > 0) memcpy(hot, chunk->constants.values, constants_size);
+        memcpy(hot + constants_size, chunk->code, chunk->count);
+
+        size_t lines_size = sizeof(LineStart) * chunk->line_count;
+        memcpy(cold, chunk->lines, lines_size);
+
+        FREE_ARRAY(Value, chunk->constants.values, chunk->constants.capacity);
+        FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+        FREE_ARRAY(LineStart, chunk->lines, chunk->line_capacity);
+
+        chunk->constants.values = (Value*)hot;
+        chunk->constants.capacity = chunk->constants.count;
+        chunk->code = hot + constants_size;
+        chunk->capacity = chunk->count;
+        chunk->lines = (LineStart*)cold;
+        chunk->line_capacity = chunk->line_count;
+        chunk->frozen = true;
+
+        hot += align(constants_size + chunk->count);
+        cold += lines_size;
+    }
+
+    protect_pages(memory, hot_size + cold_size);
+
+    CodeArena* arena = ALLOCATE(CodeArena, 1);
+    arena->memory = memory;
+    arena->size = hot_size + cold_size;
+    arena->next = vm.arenas;
+    vm.arenas = arena;
+
+    FREE_ARRAY(ObjFunction*, list.functions, list.capacity);
+}
+
+void free_arenas(){
+    CodeArena* arena = vm.arenas;
+    while(arena != NULL){
+        CodeArena* next = arena->next;
+        free_pages(arena->memory, arena->size);
+        FREE(CodeArena, arena);
+        arena = next;
+    }
+    vm.arenas = NULL;
+}
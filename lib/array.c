@@ -0,0 +1,232 @@
+#include "common.h"
+#include "array.h"
+#include "memory.h"
+#include "simd.h"
+#include "vm.h"
+
+/*moves every element into `values`, for when one that isn't a number shows up*/
+static void box(ObjArray* array){
+    Value* values = array->capacity > 0 ? ALLOCATE(Value, array->capacity) : NULL;
+    for (int i = 0; i < array->count; i++) values[i] = NUMBER_VAL(array->numbers[i]);
+    FREE_ARRAY(double, array->numbers, array->capacity);
+    array->numbers = NULL;
+    array->values = values;
+    array->unboxed = false;
+}
+
+/*
+    the other way round, once every element is a number again. only
+    the natives that want numbers check for this, it takes a pass
+    over the whole array
+*/
+static bool unbox(ObjArray* array){
+    if(array->unboxed) return true;
+    for (int i = 0; i < array->count; i++){
+        if(!IS_NUMBER(array->values[i])) return false;
+    }
+
+    double* numbers = array->capacity > 0 ? ALLOCATE(double, array->capacity) : NULL;
+    for (int i = 0; i < array->count; i++) numbers[i] = AS_NUMBER(array->values[i]);
+    FREE_ARRAY(Value, array->values, array->capacity);
+    array->values = NULL;
+    array->numbers = numbers;
+    array->unboxed = true;
+    return true;
+}
+
+Value array_get(ObjArray* array, int index){
+    return array->unboxed ? NUMBER_VAL(array->numbers[index]) : array->values[index];
+}
+
+void array_set(ObjArray* array, int index, Value value){
+    if(array->unboxed && !IS_NUMBER(value)) box(array);
+
+    if(array->unboxed){
+        array->numbers[index] = AS_NUMBER(value);
+    }else{
+        array->values[index] = value;
+    }
+}
+
+void array_append(ObjArray* array, Value value){
+    if(array->capacity < array->count + 1){
+        int old_capacity = array->capacity;
+        array->capacity = GROW_CAPACITY(old_capacity);
+        if(array->unboxed){
+            array->numbers = GROW_ARRAY(double, array->numbers, old_capacity, array->capacity);
+        }else{
+            array->values = GROW_ARRAY(Value, array->values, old_capacity, array->capacity);
+        }
+    }
+    array->count++;
+    array_set(array, array->count - 1, value);
+}
+
+/*an unboxed array of `count` numbers for the natives to fill in*/
+static ObjArray* number_array(int count){
+    ObjArray* array = new_array();
+    array->capacity = count;
+    array->count = count;
+    array->numbers = count > 0 ? ALLOCATE(double, count) : NULL;
+    return array;
+}
+
+/*
+    `value` as an unboxed array, NULL once it's reported that some
+    element isn't a number
+*/
+static ObjArray* numbers_of(Value value){
+    if(unbox(AS_ARRAY(value))) return AS_ARRAY(value);
+    native_error("Expected an array of numbers.");
+    return NULL;
+}
+
+/*array(count, fill), fill is 0 if it's left out*/
+bool array_native(int arg_count, Value* args, Value* result){
+    double count = AS_NUMBER(args[0]);
+    if(!(count >= 0 && count <= INT32_MAX) || count != (int)count){
+        native_error("Array size must be a non-negative whole number.");
+        return false;
+    }
+
+    Value fill = arg_count == 2 ? args[1] : NUMBER_VAL(0);
+    ObjArray* array = new_array();
+    for (int i = 0; i < (int)count; i++) array_append(array, fill);
+    *result = OBJ_VAL(array);
+    return true;
+}
+
+bool len_native(int arg_count, Value* args, Value* result){
+    (void)arg_count;
+    if(IS_ARRAY(args[0])){
+        *result = NUMBER_VAL(AS_ARRAY(args[0])->count);
+    }else if(IS_MAP(args[0])){
+        *result = NUMBER_VAL(AS_MAP(args[0])->count);
+    }else if(IS_STRING(args[0])){
+        *result = NUMBER_VAL(AS_STRING(args[0])->length);
+    }else{
+        native_error("Only arrays, maps and strings have a length.");
+        return false;
+    }
+    return true;
+}
+
+/*push(array, value), gives back the new length*/
+bool push_native(int arg_count, Value* args, Value* result){
+    (void)arg_count;
+    ObjArray* array = AS_ARRAY(args[0]);
+    array_append(array, args[1]);
+    *result = NUMBER_VAL(array->count);
+    return true;
+}
+
+bool sum_native(int arg_count, Value* args, Value* result){
+    (void)arg_count;
+    ObjArray* array = numbers_of(args[0]);
+    if(array == NULL) return false;
+    *result = NUMBER_VAL(vector_sum(array->numbers, array->count));
+    return true;
+}
+
+static bool same_length(ObjArray* a, ObjArray* b){
+    if(a->count == b->count) return true;
+    native_error("Arrays must be the same length.");
+    return false;
+}
+
+bool dot_native(int arg_count, Value* args, Value* result){
+    (void)arg_count;
+    ObjArray* a = numbers_of(args[0]);
+    ObjArray* b = a == NULL ? NULL : numbers_of(args[1]);
+    if(b == NULL || !same_length(a, b)) return false;
+    *result = NUMBER_VAL(vector_dot(a->numbers, b->numbers, a->count));
+    return true;
+}
+
+/*scale(array, k), a new array with every element times k*/
+bool scale_native(int arg_count, Value* args, Value* result){
+    (void)arg_count;
+    ObjArray* array = numbers_of(args[0]);
+    if(array == NULL) return false;
+
+    ObjArray* scaled = number_array(array->count);
+    vector_scale(scaled->numbers, array->numbers, AS_NUMBER(args[1]), array->count);
+    *result = OBJ_VAL(scaled);
+    return true;
+}
+
+/*add(array, other), a new array, other is an array as long or a number to add to each*/
+bool add_native(int arg_count, Value* args, Value* result){
+    (void)arg_count;
+    ObjArray* array = numbers_of(args[0]);
+    if(array == NULL) return false;
+
+    if(IS_NUMBER(args[1])){
+        ObjArray* sum = number_array(array->count);
+        vector_add_scalar(sum->numbers, array->numbers, AS_NUMBER(args[1]), array->count);
+        *result = OBJ_VAL(sum);
+        return true;
+    }
+    if(!IS_ARRAY(args[1])){
+        native_error("Argument 2 of add() must be an array or a number.");
+        return false;
+    }
+
+    ObjArray* other = numbers_of(args[1]);
+    if(other == NULL || !same_length(array, other)) return false;
+    ObjArray* sum = number_array(array->count);
+    vector_add(sum->numbers, array->numbers, other->numbers, array->count);
+    *result = OBJ_VAL(sum);
+    return true;
+}
+
+/*min() and max() of an empty array are nil*/
+static bool both_numbers(Value* args, const char* name){
+    for (int i = 0; i < 2; i++){
+        if(IS_NUMBER(args[i])) continue;
+        native_error("Argument %d of %s() must be a number.", i + 1, name);
+        return false;
+    }
+    return true;
+}
+
+static ObjArray* numbers_in(Value value, const char* name){
+    if(IS_ARRAY(value)) return numbers_of(value);
+    native_error("Argument 1 of %s() must be an array.", name);
+    return NULL;
+}
+
+/*
+    min(a, b) is the smaller number, that's what OP_MIN does too, and
+    min(array) the smallest element, nil if there's none. max() is
+    the same the other way round. both skip NaNs like vector_min()
+*/
+bool min_native(int arg_count, Value* args, Value* result){
+    if(arg_count == 2){
+        if(!both_numbers(args, "min")) return false;
+        double a = AS_NUMBER(args[0]);
+        double b = AS_NUMBER(args[1]);
+        *result = NUMBER_VAL(b != b || a < b ? a : b);
+        return true;
+    }
+
+    ObjArray* array = numbers_in(args[0], "min");
+    if(array == NULL) return false;
+    *result = array->count == 0 ? NIL_VAL : NUMBER_VAL(vector_min(array->numbers, array->count));
+    return true;
+}
+
+bool max_native(int arg_count, Value* args, Value* result){
+    if(arg_count == 2){
+        if(!both_numbers(args, "max")) return false;
+        double a = AS_NUMBER(args[0]);
+        double b = AS_NUMBER(args[1]);
+        *result = NUMBER_VAL(b != b || a > b ? a : b);
+        return true;
+    }
+
+    ObjArray* array = numbers_in(args[0], "max");
+    if(array == NULL) return false;
+    *result = array->count == 0 ? NIL_VAL : NUMBER_VAL(vector_max(array->numbers, array->count));
+    return true;
+}
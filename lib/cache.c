@@ -0,0 +1,520 @@
+#ifndef _WIN32
+#define _XOPEN_SOURCE 700
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "arena.h"
+#include "cache.h"
+#include "compiler.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+/*
+    a .loxc file is a header followed by the script function,
+    every function is written as
+
+        arity, upvalue count, name, code, lines, constants
+
+    and nested functions are written inline where they show up
+    in the constant table, strings are re-interned on load. functions
+    that haven't been compiled yet (LAZY_COMPILE) are written as their
+    source instead and stay lazy after loading
+*/
+#define LOXC_MAGIC "LOXC"
+#define LAZY_BODY -1
+
+typedef enum{
+    CONST_NIL,
+    CONST_BOOL,
+    CONST_NUMBER,
+    CONST_STRING,
+    CONST_FUNCTION
+} ConstantTag;
+
+typedef struct{
+    char magic[4];
+    uint32_t version;
+    uint64_t source_hash;
+    uint32_t source_length;
+    uint32_t toggles;
+} CacheHeader;
+
+typedef struct{
+    const uint8_t* current;
+    const uint8_t* end;
+    bool error;
+} Reader;
+
+static ObjFunction* read_function(Reader* reader);
+static uint32_t toggle_fingerprint();
+static bool write_function(FILE* file, ObjFunction* function);
+
+/*
+    the common.h toggles that change the bytecode the compiler emits,
+    a cache written by a build with other ones can't be run by this one
+*/
+static uint32_t toggle_fingerprint(){
+    uint32_t toggles = 0;
+#ifdef PEEPHOLE_OPTIMIZE
+    toggles |= 1 << 0;
+#endif
+#ifdef LAZY_COMPILE
+    toggles |= 1 << 1;
+#endif
+#ifdef INLINE_CALLS
+    toggles |= 1 << 2;
+    toggles |= (uint32_t)(INLINE_BUDGET & 0xff) << 8;
+#endif
+#ifdef SPECIALIZE_NUMBERS
+    toggles |= 1 << 3;
+#endif
+#ifdef FUSE_COUNTING_LOOPS
+    toggles |= 1 << 4;
+#endif
+#ifdef INLINE_CACHES
+    toggles |= 1 << 5;
+#endif
+#ifdef JUMP_TABLES
+    toggles |= 1 << 6;
+    toggles |= (uint32_t)(JUMP_TABLE_MIN & 0xff) << 16;
+#endif
+    return toggles;
+}
+
+/*FNV-1a, the 64 bit flavour of hash_string()*/
+static uint64_t hash_source(const char* source, size_t length){
+    uint64_t hash = 14695981039346656037u;
+    for (size_t i = 0; i < length; i++){
+        hash ^= (uint8_t)source[i];
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+/*
+    script.lox -> script.loxc, next to the script unless
+    CLOX_CACHE_DIR points somewhere else. scripts from different
+    directories can share a name there, so the file gets a hash of the
+    script's full path too: script.<hash>.loxc
+*/
+char* cache_path(const char* script_path){
+    const char* dir = getenv("CLOX_CACHE_DIR");
+    const char* name = script_path;
+    size_t dir_length = 0;
+    uint64_t path_hash = 0;
+
+    if(dir != NULL && dir[0] != '\0'){
+        const char* slash = strrchr(script_path, '/');
+        const char* back_slash = strrchr(script_path, '\\');
+        if(back_slash != NULL && (slash == NULL || back_slash > slash)) slash = back_slash;
+        if(slash != NULL) name = slash + 1;
+        dir_length = strlen(dir) + 1;
+
+#ifdef _WIN32
+        char* full_path = _fullpath(NULL, script_path, 0);
+#else
+        char* full_path = realpath(script_path, NULL);
+#endif
+        const char* hashed = full_path != NULL ? full_path : script_path;
+        path_hash = hash_source(hashed, strlen(hashed));
+        free(full_path);
+    }
+
+    size_t name_length = strlen(name);
+    bool has_extension = name_length >= 4 && strcmp(name + name_length - 4, ".lox") == 0;
+    if(has_extension) name_length -= 4;
+    /*".", 16 hex digits and ".loxc"*/
+    size_t length = dir_length + name_length + (dir_length > 0 ? 17 : 0) + 5;
+
+    char* path = (char*)malloc(length + 1);
+    if(path == NULL) return NULL;
+
+    if(dir_length > 0){
+        sprintf(path, "%s/%.*s.%016llx.loxc", dir, (int)name_length, name, (unsigned long long)path_hash);
+    }else{
+        sprintf(path, "%.*s.loxc", (int)name_length, name);
+    }
+    return path;
+}
+
+/*reading*/
+static bool read_bytes(Reader* reader, void* destination, size_t size){
+    if(reader->error || (size_t)(reader->end - reader->current) < size){
+        reader->error = true;
+        return false;
+    }
+
+    memcpy(destination, reader->current, size);
+    reader->current += size;
+    return true;
+}
+
+static int32_t read_int(Reader* reader){
+    int32_t value = 0;
+    read_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+/*
+    lengths come straight out of the file, so a truncated or
+    corrupted cache must not make us allocate garbage sizes
+*/
+static bool check_length(Reader* reader, int32_t length, size_t element_size){
+    if(length < 0 ||
+        (size_t)length * element_size > (size_t)(reader->end - reader->current)){
+        reader->error = true;
+    }
+    return !reader->error;
+}
+
+static int32_t read_length(Reader* reader, size_t element_size){
+    int32_t length = read_int(reader);
+    return check_length(reader, length, element_size) ? length : 0;
+}
+
+static ObjString* read_chars(Reader* reader, int32_t length){
+    if(!check_length(reader, length, 1)) return NULL;
+
+    ObjString* string = copy_string((const char*)reader->current, length);
+    reader->current += length;
+    return string;
+}
+
+static ObjString* read_string(Reader* reader){
+    return read_chars(reader, read_int(reader));
+}
+
+static bool read_constant(Reader* reader, Value* value){
+    uint8_t tag;
+    if(!read_bytes(reader, &tag, 1)) return false;
+
+    switch (tag){
+        case CONST_NIL:
+            *value = NIL_VAL;
+            return true;
+        case CONST_BOOL:{
+            uint8_t boolean;
+            if(!read_bytes(reader, &boolean, 1)) return false;
+            *value = BOOL_VAL(boolean != 0);
+            return true;
+        }
+        case CONST_NUMBER:{
+            double number;
+            if(!read_bytes(reader, &number, sizeof(number))) return false;
+            *value = NUMBER_VAL(number);
+            return true;
+        }
+        case CONST_STRING:{
+            ObjString* string = read_string(reader);
+            if(string == NULL) return false;
+            *value = OBJ_VAL(string);
+            return true;
+        }
+        case CONST_FUNCTION:{
+            ObjFunction* function = read_function(reader);
+            if(function == NULL) return false;
+            *value = OBJ_VAL(function);
+            return true;
+        }
+        default:
+            reader->error = true;
+            return false;
+    }
+}
+
+static ObjFunction* read_function(Reader* reader){
+    ObjFunction* function = new_function();
+    function->arity = read_int(reader);
+    function->upvalue_count = read_int(reader);
+    if(function->upvalue_count < 0 || function->upvalue_count > UINT8_COUNT) reader->error = true;
+
+    /*the script itself has no name, it's written as -1*/
+    int32_t name_length = read_int(reader);
+    if(name_length >= 0) function->name = read_chars(reader, name_length);
+
+    /*a function whose body hasn't been compiled yet keeps its source*/
+    int32_t count = read_int(reader);
+    if(count == LAZY_BODY){
+        function->source_line = read_int(reader);
+        function->visible_constants = read_int(reader);
+        function->source = read_string(reader);
+        return reader->error ? NULL : function;
+    }
+
+    if(!check_length(reader, count, 1)) return NULL;
+
+    /*
+        the chunk owns its code, so copy it out of the mapping
+        instead of pointing into it, the mapping goes away as soon
+        as loading is done
+    */
+    Chunk* chunk = &function->chunk;
+    chunk->code = GROW_ARRAY(uint8_t, chunk->code, 0, count);
+    chunk->capacity = count;
+    chunk->count = count;
+    read_bytes(reader, chunk->code, count);
+
+    int32_t line_count = read_length(reader, sizeof(LineStart));
+    chunk->lines = GROW_ARRAY(LineStart, chunk->lines, 0, line_count);
+    chunk->line_capacity = line_count;
+    chunk->line_count = line_count;
+    read_bytes(reader, chunk->lines, sizeof(LineStart) * line_count);
+
+    /*every frame's call line can only be in the function or in a frame before it*/
+    int32_t frame_count = read_length(reader, 2 * sizeof(int32_t));
+    if(frame_count > MAX_INLINE_FRAMES) reader->error = true;
+    if(!reader->error && frame_count > 0){
+        function->inline_frames = ALLOCATE(InlineFrame, frame_count);
+        function->inline_frame_capacity = frame_count;
+        for (int i = 0; i < frame_count && !reader->error; i++){
+            InlineFrame* frame = &function->inline_frames[i];
+            frame->name = read_string(reader);
+            frame->line = read_int(reader);
+            function->inline_frame_count++;
+            if(frame->name == NULL || LINE_FRAME(frame->line) > i) reader->error = true;
+        }
+    }
+
+    int32_t constant_count = read_length(reader, 1);
+    for (int i = 0; i < constant_count && !reader->error; i++){
+        Value value;
+        if(read_constant(reader, &value)) add_constant(chunk, value);
+    }
+
+    return reader->error ? NULL : function;
+}
+
+static ObjFunction* read_cache(const uint8_t* bytes, size_t size, const char* source){
+    CacheHeader header;
+    Reader reader = {bytes, bytes + size, false};
+    if(!read_bytes(&reader, &header, sizeof(header))) return NULL;
+
+    size_t source_length = strlen(source);
+    if(memcmp(header.magic, LOXC_MAGIC, 4) != 0 ||
+        header.version != LOXC_VERSION ||
+        header.toggles != toggle_fingerprint() ||
+        header.source_length != source_length ||
+        header.source_hash != hash_source(source, source_length)){
+        return NULL;
+    }
+
+    /*
+        the global consts, lazy bodies still fold the ones declared
+        before their function. they're only defined once the whole
+        file has been read, a bad one gets compiled from scratch
+    */
+    ValueArray names;
+    ValueArray values;
+    init_value_array(&names);
+    init_value_array(&values);
+    int32_t constant_count = read_length(&reader, sizeof(int32_t) + 1);
+    for (int i = 0; i < constant_count && !reader.error; i++){
+        ObjString* name = read_string(&reader);
+        Value value;
+        if(name == NULL || !read_constant(&reader, &value)) break;
+        write_value_array(&names, OBJ_VAL(name));
+        write_value_array(&values, value);
+    }
+
+    ObjFunction* function = reader.error ? NULL : read_function(&reader);
+    if(function != NULL && reader.current == reader.end){
+        for (int i = 0; i < names.count; i++){
+            define_global_constant(AS_STRING(names.values[i]), values.values[i]);
+        }
+        freeze_function(function);
+    }else{
+        function = NULL;
+    }
+
+    free_value_array(&names);
+    free_value_array(&values);
+    return function;
+}
+
+/*
+    returns NULL when there's no usable cache for this source,
+    the caller then falls back to compile()
+*/
+ObjFunction* load_cache(const char* path, const char* source){
+#ifdef _WIN32
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) return NULL;
+
+    fseek(file, 0L, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    if(size <= 0){
+        fclose(file);
+        return NULL;
+    }
+
+    uint8_t* bytes = (uint8_t*)malloc(size);
+    if(bytes == NULL || fread(bytes, 1, size, file) != (size_t)size){
+        free(bytes);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    ObjFunction* function = read_cache(bytes, size, source);
+    free(bytes);
+    return function;
+#else
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return NULL;
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size <= 0){
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)info.st_size;
+    void* bytes = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(bytes == MAP_FAILED) return NULL;
+
+    ObjFunction* function = read_cache((const uint8_t*)bytes, size, source);
+    munmap(bytes, size);
+    return function;
+#endif
+}
+
+/*writing*/
+static bool write_int(FILE* file, int32_t value){
+    return fwrite(&value, sizeof(value), 1, file) == 1;
+}
+
+static bool write_string(FILE* file, ObjString* string){
+    return write_int(file, string->length) &&
+        fwrite(string->chars, 1, string->length, file) == (size_t)string->length;
+}
+
+static bool write_constant(FILE* file, Value value){
+    uint8_t tag;
+    switch (value.type){
+        case VAL_NIL:
+            tag = CONST_NIL;
+            return fwrite(&tag, 1, 1, file) == 1;
+        case VAL_BOOL:{
+            tag = CONST_BOOL;
+            uint8_t boolean = AS_BOOL(value) ? 1 : 0;
+            return fwrite(&tag, 1, 1, file) == 1 &&
+                fwrite(&boolean, 1, 1, file) == 1;
+        }
+        case VAL_NUMBER:{
+            tag = CONST_NUMBER;
+            double number = AS_NUMBER(value);
+            return fwrite(&tag, 1, 1, file) == 1 &&
+                fwrite(&number, sizeof(number), 1, file) == 1;
+        }
+        case VAL_OBJ:
+            if(IS_STRING(value)){
+                tag = CONST_STRING;
+                return fwrite(&tag, 1, 1, file) == 1 &&
+                    write_string(file, AS_STRING(value));
+            }
+            if(IS_FUNCTION(value)){
+                tag = CONST_FUNCTION;
+                return fwrite(&tag, 1, 1, file) == 1 &&
+                    write_function(file, AS_FUNCTION(value));
+            }
+            /*natives never end up in a constant table*/
+            return false;
+    }
+    return false;
+}
+
+static bool write_function(FILE* file, ObjFunction* function){
+    Chunk* chunk = &function->chunk;
+    if(!write_int(file, function->arity) || !write_int(file, function->upvalue_count)) return false;
+
+    if(function->name == NULL){
+        if(!write_int(file, -1)) return false;
+    }else if(!write_string(file, function->name)){
+        return false;
+    }
+
+    if(function->source != NULL){
+        return write_int(file, LAZY_BODY) &&
+            write_int(file, function->source_line) &&
+            write_int(file, function->visible_constants) &&
+            write_string(file, function->source);
+    }
+
+    if(!write_int(file, chunk->count) ||
+        fwrite(chunk->code, 1, chunk->count, file) != (size_t)chunk->count ||
+        !write_int(file, chunk->line_count) ||
+        fwrite(chunk->lines, sizeof(LineStart), chunk->line_count, file) != (size_t)chunk->line_count){
+        return false;
+    }
+
+    if(!write_int(file, function->inline_frame_count)) return false;
+    for (int i = 0; i < function->inline_frame_count; i++){
+        InlineFrame* frame = &function->inline_frames[i];
+        if(!write_string(file, frame->name) || !write_int(file, frame->line)) return false;
+    }
+
+    if(!write_int(file, chunk->constants.count)) return false;
+    for (int i = 0; i < chunk->constants.count; i++){
+        if(!write_constant(file, chunk->constants.values[i])) return false;
+    }
+    return true;
+}
+
+/*
+    writes to a temporary file first and renames it into place so a
+    crash half way never leaves a truncated cache behind
+*/
+bool write_cache(const char* path, const char* source, ObjFunction* function){
+    size_t path_length = strlen(path);
+    char* temp_path = (char*)malloc(path_length + 5);
+    if(temp_path == NULL) return false;
+    sprintf(temp_path, "%s.tmp", path);
+
+    FILE* file = fopen(temp_path, "wb");
+    if(file == NULL){
+        free(temp_path);
+        return false;
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LOXC_MAGIC, 4);
+    header.version = LOXC_VERSION;
+    header.toggles = toggle_fingerprint();
+    header.source_length = (uint32_t)strlen(source);
+    header.source_hash = hash_source(source, header.source_length);
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        write_int(file, global_constant_count());
+    for (int i = 0; ok && i < global_constant_count(); i++){
+        Value value;
+        ObjString* name = global_constant(i, &value);
+        ok = write_string(file, name) && write_constant(file, value);
+    }
+    ok = ok && write_function(file, function);
+    ok = fclose(file) == 0 && ok;
+
+#ifdef _WIN32
+    if(ok) remove(path);
+#endif
+    if(!ok || rename(temp_path, path) != 0){
+        remove(temp_path);
+        ok = false;
+    }
+
+    free(temp_path);
+    return ok;
+}
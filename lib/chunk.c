@@ -1,13 +1,25 @@
 #include <stdlib.h>
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 #include "value.h"
 
 void init_chunk(Chunk* chunk){
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
+    chunk->line_count = 0;
+    chunk->line_capacity = 0;
     chunk->lines = NULL;
+    chunk->frozen = false;
+    chunk->registers = NULL;
+    chunk->untranslatable = false;
+    chunk->caches = NULL;
+    chunk->cache_count = 0;
+    chunk->case_tables = NULL;
+    chunk->case_table_count = 0;
+    chunk->property_caches = NULL;
+    chunk->property_cache_count = 0;
     init_value_array(&chunk->constants);
 }
 
@@ -16,18 +28,62 @@ void write_chunk(Chunk* chunk, uint8_t byte, int line){
         int old_capacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(old_capacity);
         chunk->code = GROW_ARRAY(uint8_t, chunk->code, old_capacity, chunk->capacity);
-        chunk->lines = GROW_ARRAY(int,chunk->lines,old_capacity,chunk->capacity);
     }
 
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
     chunk->count++;
+
+    /*still on the same line, the current run just gets longer*/
+    if(chunk->line_count > 0 && chunk->lines[chunk->line_count - 1].line == line){
+        return;
+    }
+
+    if(chunk->line_capacity < chunk->line_count + 1){
+        int old_capacity = chunk->line_capacity;
+        chunk->line_capacity = GROW_CAPACITY(old_capacity);
+        chunk->lines = GROW_ARRAY(LineStart, chunk->lines, old_capacity, chunk->line_capacity);
+    }
+
+    LineStart* line_start = &chunk->lines[chunk->line_count++];
+    line_start->offset = chunk->count - 1;
+    line_start->line = line;
+}
+
+/*
+    drops everything from `count` onwards, the compiler uses this to
+    replace code it has just emitted
+*/
+void truncate_chunk(Chunk* chunk, int count){
+    if(count >= chunk->count) return;
+    chunk->count = count;
+
+    while(chunk->line_count > 0 &&
+        chunk->lines[chunk->line_count - 1].offset >= count){
+        chunk->line_count--;
+    }
 }
 
 void free_chunk(Chunk* chunk){
+    if(chunk->registers != NULL){
+        free_chunk(chunk->registers);
+        FREE(Chunk, chunk->registers);
+    }
+    FREE_ARRAY(GlobalCache, chunk->caches, chunk->cache_count);
+    for (int i = 0; i < chunk->case_table_count; i++){
+        FREE_ARRAY(int, chunk->case_tables[i].slots, chunk->case_tables[i].capacity);
+    }
+    FREE_ARRAY(CaseTable, chunk->case_tables, chunk->case_table_count);
+    FREE_ARRAY(PropertyCache, chunk->property_caches, chunk->property_cache_count);
+
+    /*frozen chunks belong to their arena, free_arenas() cleans those up*/
+    if(chunk->frozen){
+        init_chunk(chunk);
+        return;
+    }
+
     /* we are freeing the byte array here*/
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int,chunk->lines,chunk->capacity);
+    FREE_ARRAY(LineStart,chunk->lines,chunk->line_capacity);
     free_value_array(&chunk->constants);
     init_chunk(chunk);
 }
@@ -36,4 +92,230 @@ int add_constant(Chunk* chunk, Value value){
     write_value_array(&chunk->constants, value);
     /*it's a zero index array so count is always greater by 1*/
     return chunk->constants.count - 1;
+}
+
+/*
+    size in bytes of the instruction at offset, opcode included
+*/
+int instruction_length(Chunk* chunk, int offset){
+    switch (chunk->code[offset]){
+        case OP_CONSTANT:
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_CALL:
+        case OP_ADD_LOCAL:
+        case OP_SUBTRACT_LOCAL:
+        case OP_MULTIPLY_LOCAL:
+        case OP_DIVIDE_LOCAL:
+        case OP_ADD_GLOBAL:
+        case OP_SUBTRACT_GLOBAL:
+        case OP_MULTIPLY_GLOBAL:
+        case OP_DIVIDE_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_ADD_UPVALUE:
+        case OP_SUBTRACT_UPVALUE:
+        case OP_MULTIPLY_UPVALUE:
+        case OP_DIVIDE_UPVALUE:
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_ADD_PROPERTY:
+        case OP_SUBTRACT_PROPERTY:
+        case OP_MULTIPLY_PROPERTY:
+        case OP_DIVIDE_PROPERTY:
+        case OP_ARRAY:
+        case OP_MAP:
+        case OP_CONCAT_N:
+            return 2;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_CALL_GLOBAL:
+        case OP_SWITCH:
+        case OP_SWITCH_HASH:
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+            return 3;
+        case OP_FOR_LOOP:
+        case OP_FOR_LOOP_K:
+            return 6;
+        case OP_CLOSURE:{
+            ObjFunction* function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+            return 2 + 2 * function->upvalue_count;
+        }
+        default:
+            return 1;
+    }
+}
+
+/*
+    how many slots the instruction at the start of `code` pops and
+    pushes, false for opcodes that don't have a fixed effect
+*/
+bool stack_effect(uint8_t* code, int* pops, int* pushes){
+    *pops = 0;
+    *pushes = 0;
+    switch (code[0]){
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_CLOSURE:
+        case OP_CLASS:
+            *pushes = 1;
+            return true;
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_ADD_NUMBER:
+        case OP_SUBTRACT_NUMBER:
+        case OP_MULTIPLY_NUMBER:
+        case OP_DIVIDE_NUMBER:
+        case OP_GREATER_NUMBER:
+        case OP_GREATER_EQUAL_NUMBER:
+        case OP_LESS_NUMBER:
+        case OP_LESS_EQUAL_NUMBER:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_ADD_PROPERTY:
+        case OP_SUBTRACT_PROPERTY:
+        case OP_MULTIPLY_PROPERTY:
+        case OP_DIVIDE_PROPERTY:
+        case OP_GET_INDEX:
+        case OP_SQRT:
+        case OP_FLOOR:
+        case OP_ABS:
+        case OP_LEN:
+            *pops = 2;
+            *pushes = 1;
+            return true;
+        case OP_SET_INDEX:
+        case OP_ADD_INDEX:
+        case OP_SUBTRACT_INDEX:
+        case OP_MULTIPLY_INDEX:
+        case OP_DIVIDE_INDEX:
+        case OP_MIN:
+        case OP_MAX:
+            *pops = 3;
+            *pushes = 1;
+            return true;
+        case OP_ARRAY:
+        case OP_CONCAT_N:
+            *pops = code[1];
+            *pushes = 1;
+            return true;
+        case OP_MAP:
+            *pops = code[1] * 2;
+            *pushes = 1;
+            return true;
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_SET_LOCAL:
+        case OP_SET_GLOBAL:
+        case OP_JUMP_IF_FALSE:
+        case OP_ADD_LOCAL:
+        case OP_SUBTRACT_LOCAL:
+        case OP_MULTIPLY_LOCAL:
+        case OP_DIVIDE_LOCAL:
+        case OP_ADD_GLOBAL:
+        case OP_SUBTRACT_GLOBAL:
+        case OP_MULTIPLY_GLOBAL:
+        case OP_DIVIDE_GLOBAL:
+        case OP_SET_UPVALUE:
+        case OP_ADD_UPVALUE:
+        case OP_SUBTRACT_UPVALUE:
+        case OP_MULTIPLY_UPVALUE:
+        case OP_DIVIDE_UPVALUE:
+        case OP_GET_PROPERTY:
+            *pops = 1;
+            *pushes = 1;
+            return true;
+        case OP_PRINT:
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_RETURN:
+        case OP_SWITCH:
+        case OP_SWITCH_HASH:
+        case OP_CLOSE_UPVALUE:
+        case OP_INHERIT:
+        case OP_METHOD:
+            *pops = 1;
+            return true;
+        case OP_CALL:
+        case OP_CALL_GLOBAL:
+            *pops = code[1] + 1;
+            *pushes = 1;
+            return true;
+        case OP_INVOKE:
+            *pops = code[2] + 1;
+            *pushes = 1;
+            return true;
+        /*the superclass comes off the top after the arguments*/
+        case OP_SUPER_INVOKE:
+            *pops = code[2] + 2;
+            *pushes = 1;
+            return true;
+        /*these are the fall through, a taken jump leaves one slot behind*/
+        case OP_JUMP_IF_NOT_LESS:
+            *pops = 2;
+            return true;
+        case OP_FOR_LOOP:
+        case OP_FOR_LOOP_K:
+            return true;
+        case OP_JUMP:
+        case OP_LOOP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*how many JUMPs make up the table after a jump table instruction, 0 for anything else*/
+int jump_table_size(uint8_t* code){
+    switch (code[0]){
+        case OP_SWITCH:
+        case OP_SWITCH_HASH:
+            return code[2] + 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+    binary search for the last run starting at or before offset,
+    only errors and the disassembler ever need this
+*/
+int get_line(Chunk* chunk, int offset){
+    int low = 0;
+    int high = chunk->line_count - 1;
+    int line = 0;
+
+    while(low <= high){
+        int middle = low + (high - low) / 2;
+        if(chunk->lines[middle].offset <= offset){
+            line = chunk->lines[middle].line;
+            low = middle + 1;
+        }else{
+            high = middle - 1;
+        }
+    }
+
+    return line;
 }
\ No newline at end of file
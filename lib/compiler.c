@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,6 +7,12 @@
 #include "compiler.h"
 #include "scanner.h"
 #include "object.h"
+#include "memory.h"
+#include "arena.h"
+#include "optimizer.h"
+#include "inline.h"
+#include "specialize.h"
+#include "table.h"
 
 
 #ifdef DEBUG_PRINT_CODE
@@ -43,28 +50,160 @@ typedef struct
     Precedence precedence;
 }ParseRule;
 
+/*
+    a local declared with const keeps its value here, reads compile
+    to it. `captured` and `assigned` decide how closures capture it,
+    see settle_captures()
+*/
 typedef struct{
     Token name;
     int depth;
+    bool constant;
+    Value value;
+    bool captured;
+    bool assigned;
 }Local;
 
+typedef struct{
+    uint8_t index;
+    bool is_local;
+}Upvalue;
+
+/*
+    the CaptureKind byte of an OP_CLOSURE that captures `local`, it's
+    filled in once the local goes out of scope
+*/
+typedef struct{
+    int local;
+    int offset;
+}Capture;
+
 typedef enum{
     TYPE_FUNCTION,
+    TYPE_INITIALIZER,
+    TYPE_METHOD,
     TYPE_SCRIPT
 } FunctionType;
 
+/*
+    the last constant pushed into the current chunk, binary() and
+    unary() fold operators whose operands are both sitting right at
+    the end of the chunk
+*/
+typedef struct{
+    int start;      // offset of the instruction that pushes it
+    int end;        // chunk count right after it, -1 if there's none
+    int added;      // the constant table slot it appended, -1 if none
+    Value value;
+}ConstantOperand;
+
+/*
+    the last `+` compiled and how many operands the chain of them it
+    ends has, see emit_add()
+*/
 typedef struct{
-    Compiler* enclosing;
+    int start;      // offset of its ADD or CONCAT_N
+    int end;        // chunk count right after it, -1 if there's none
+    int operands;
+    bool has_string;
+}Concatenation;
+
+typedef struct Compiler{
+    struct Compiler* enclosing;
     ObjFunction* function;
     FunctionType type;
     Local locals[UINT8_COUNT];
     int local_count;
     int scope_depth;
+    ConstantOperand last_constant;
+    Concatenation last_add;
+    /*interned string -> its slot in the constant table*/
+    Table constants;
+    /*offset of the last GET_GLOBAL, call() checks if it's the callee*/
+    int last_global;
+    /*where the last postfix update starts and ends, see drop_postfix_value()*/
+    int postfix_start;
+    int postfix_end;
+    CallSite* call_sites;
+    int call_site_count;
+    int call_site_capacity;
+    Upvalue upvalues[UINT8_COUNT];
+    Capture* captures;
+    int capture_count;
+    int capture_capacity;
 }Compiler;
 
+/*the class whose methods are being compiled*/
+typedef struct ClassCompiler{
+    struct ClassCompiler* enclosing;
+    bool has_superclass;
+}ClassCompiler;
+
+/*
+    what INLINE_CALLS knows about the whole source, `functions` holds
+    the global functions that are safe to inline by name. that's none
+    unless `whole_program`, in the REPL a later line can still give
+    any global another function
+*/
+typedef struct{
+    Table functions;
+    bool whole_program;
+}Inliner;
+
+/*
+    what a pass over the whole source finds out about the names of its
+    globals before any of it is compiled. `assigned` is every name
+    that's assigned or declared anywhere and `redefined` the ones that
+    are assigned or declared more than once. they're kept until the
+    next compile() for the bodies LAZY_COMPILE fills in later, `scanned`
+    is false when there's been no pass, a program loaded from the cache
+*/
+typedef struct{
+    Table assigned;
+    Table redefined;
+    bool scanned;
+}GlobalNames;
+
+/*
+    the globals declared with const and the value each one stands
+    for, kept for as long as anything can be compiled. `names` and
+    `values` are in the order they're declared and `indices` has each
+    name's place in them. only the first `visible` of them fold, a
+    lazily compiled body sees the ones declared before its function.
+    `written` is every global something has assigned or declared so
+    far, a const can't take the name of one of those
+*/
+typedef struct{
+    Table indices;
+    ValueArray names;
+    ValueArray values;
+    int visible;
+    Table written;
+}GlobalConstants;
+
+/*
+    a switch statement while its cases are being parsed, bodies are
+    numbered in the order they're written and `exits` collects the
+    jumps that leave the switch
+*/
+typedef struct{
+    Value cases[UINT8_MAX];
+    int case_body[UINT8_MAX];
+    int case_count;
+    int body_start[UINT8_MAX];
+    int body_count;
+    int default_body;   // -1 if there's none
+    int exits[UINT8_MAX + UINT8_COUNT + 1];
+    int exit_count;
+}Switch;
+
 Parser parser;
 Compiler* current = NULL;
+ClassCompiler* current_class = NULL;
 Chunk* compiling_chunk;
+Inliner inliner;
+GlobalNames global_names;
+GlobalConstants global_constants;
 
 static ParseRule* get_rule(TokenType type);
 static void parse_precedence(Precedence precedence);
@@ -86,25 +225,52 @@ static bool match(TokenType Token);
 static ObjFunction* end_compiler();
 static uint8_t identifier_constant(Token* name);
 static bool check(TokenType type);
-
-static void init_compiler(Compiler* compiler, FunctionType type){
+static void block();
+static bool settle_captures(int slot);
+static uint8_t argument_list();
+
+/*
+    function is NULL unless we're filling in the body of a function
+    that was declared earlier, see compile_function_body()
+*/
+static void init_compiler(Compiler* compiler, FunctionType type, ObjFunction* function){
     compiler->enclosing = current;
     compiler->function = NULL;
     compiler->type = type;
     compiler->local_count = 0;
     compiler->scope_depth = 0;
-    compiler->function = new_function();
+    compiler->last_constant.end = -1;
+    compiler->last_add.end = -1;
+    compiler->last_global = -1;
+    compiler->postfix_end = -1;
+    compiler->call_sites = NULL;
+    compiler->call_site_count = 0;
+    compiler->call_site_capacity = 0;
+    compiler->captures = NULL;
+    compiler->capture_count = 0;
+    compiler->capture_capacity = 0;
+    init_table(&compiler->constants);
+    compiler->function = function != NULL ? function : new_function();
     current = compiler;
 
-    if(type != TYPE_SCRIPT){
+    if(type != TYPE_SCRIPT && function == NULL){
         current->function->name 
             = copy_string(parser.previous.start, parser.previous.length);
     }
 
+    /*methods keep their receiver in slot zero*/
     Local* local = &current->locals[current->local_count++];
     local->depth = 0;
-    local->name.start = "";
-    local->name.length = 0;
+    local->constant = false;
+    local->captured = false;
+    local->assigned = false;
+    if(type == TYPE_METHOD || type == TYPE_INITIALIZER){
+        local->name.start = "this";
+        local->name.length = 4;
+    }else{
+        local->name.start = "";
+        local->name.length = 0;
+    }
 }
 
 
@@ -112,10 +278,82 @@ static Chunk* current_chunk(){
     return &current->function->chunk;
 }
 
-ObjFunction* compile(const char* source){
+static bool is_compound_assignment(TokenType type){
+    return type == TOKEN_PLUS_EQUAL || type == TOKEN_MINUS_EQUAL ||
+        type == TOKEN_STAR_EQUAL || type == TOKEN_SLASH_EQUAL;
+}
+
+static bool match_compound_assignment(){
+    if(!is_compound_assignment(parser.current.type)) return false;
+    advance();
+    return true;
+}
+
+/*anything that updates a variable in place*/
+static bool is_update(TokenType type){
+    return is_compound_assignment(type) || type == TOKEN_PLUS_PLUS || type == TOKEN_MINUS_MINUS;
+}
+
+static void mark_redefined(Token* name){
+    ObjString* string = copy_string(name->start, name->length);
+    table_set(&global_names.redefined, string, BOOL_VAL(true));
+    table_set(&global_names.assigned, string, BOOL_VAL(true));
+}
+
+/*
+    a quick pass over the tokens before compiling, whether a global
+    keeps its function can't be known from the code seen so far
+*/
+static void scan_global_names(const char* source){
+    free_table(&global_names.assigned);
+    free_table(&global_names.redefined);
+    global_names.scanned = true;
+
+    Table* declared = &global_names.assigned;
+    init_scanner(source);
+
+    Token previous;
+    previous.type = TOKEN_EOF;
+    for(;;){
+        Token token = scan_token();
+        if(token.type == TOKEN_EOF) break;
+
+        if((token.type == TOKEN_EQUAL || is_update(token.type)) &&
+            previous.type == TOKEN_IDENTIFIER){
+            mark_redefined(&previous);
+        }
+        if(token.type == TOKEN_IDENTIFIER &&
+            (previous.type == TOKEN_PLUS_PLUS || previous.type == TOKEN_MINUS_MINUS)){
+            mark_redefined(&token);
+        }
+        if(token.type == TOKEN_IDENTIFIER &&
+            (previous.type == TOKEN_VAR || previous.type == TOKEN_CLASS ||
+            previous.type == TOKEN_CONST)){
+            mark_redefined(&token);
+        }
+        if(token.type == TOKEN_IDENTIFIER && previous.type == TOKEN_FUN){
+            ObjString* name = copy_string(token.start, token.length);
+            Value seen;
+            if(table_get(declared, name, &seen)) mark_redefined(&token);
+            table_set(declared, name, BOOL_VAL(true));
+        }
+        previous = token;
+    }
+}
+
+/*`whole_program` is false when more source can follow, see Inliner*/
+ObjFunction* compile(const char* source, bool whole_program){
+    scan_global_names(source);
+    global_constants.visible = INT_MAX;
+#ifdef INLINE_CALLS
+    init_table(&inliner.functions);
+    inliner.whole_program = whole_program;
+#else
+    (void)whole_program;
+#endif
     init_scanner(source);
     Compiler compiler;
-    init_compiler(&compiler,TYPE_SCRIPT);
+    init_compiler(&compiler,TYPE_SCRIPT, NULL);
 
     //compiling_chunk = chunk;
     parser.had_error = false;
@@ -128,7 +366,13 @@ ObjFunction* compile(const char* source){
     }
 
     ObjFunction* function = end_compiler();
-    return parser.had_error ? NULL : function;
+#ifdef INLINE_CALLS
+    free_table(&inliner.functions);
+#endif
+    if(parser.had_error) return NULL;
+
+    freeze_function(function);
+    return function;
 }
 
 
@@ -138,14 +382,14 @@ static void grouping(bool can_assign){
 }
 
 static void number(bool can_assign){
-    double value = strtod(parser.previous.start,NULL);
-    emit_constant(NUMBER_VAL(value));
+    emit_constant(NUMBER_VAL(parser.previous.number));
 }
 
 static int emit_jump(uint8_t instruction){
     emit_byte(instruction);
     emit_byte(0xff);
     emit_byte(0xff);
+    return current_chunk()->count - 2;
 }
 
 static void patch_jump(int offset){
@@ -156,6 +400,12 @@ static void patch_jump(int offset){
 
     current_chunk()->code[offset] = (jump >> 8) & 0xff;
     current_chunk()->code[offset + 1] = jump & 0xff;
+
+    /*the code here is now a jump target, it can't be folded away*/
+    current->last_constant.end = -1;
+    current->last_add.end = -1;
+    current->last_global = -1;
+    current->postfix_end = -1;
 }
 
 /*conditional operations*/
@@ -184,6 +434,27 @@ static void string(bool can_assign){
                                     parser.previous.length - 2)));
 }
 
+/*
+    the in-place opcode for an update operator on the variable that
+    `get_op` reads, the variable is read once the right hand side has
+    been evaluated. every kind has its ADD SUBTRACT MULTIPLY DIVIDE in
+    that order
+*/
+static uint8_t update_opcode(TokenType type, uint8_t get_op){
+    uint8_t add = get_op == OP_GET_LOCAL ? OP_ADD_LOCAL :
+        get_op == OP_GET_UPVALUE ? OP_ADD_UPVALUE :
+        get_op == OP_GET_PROPERTY ? OP_ADD_PROPERTY :
+        get_op == OP_GET_INDEX ? OP_ADD_INDEX : OP_ADD_GLOBAL;
+    switch (type){
+        case TOKEN_PLUS_EQUAL:
+        case TOKEN_PLUS_PLUS:   return add;
+        case TOKEN_MINUS_EQUAL:
+        case TOKEN_MINUS_MINUS: return add + 1;
+        case TOKEN_STAR_EQUAL:  return add + 2;
+        default:                return add + 3;
+    }
+}
+
 static bool identifiers_equal(Token* a, Token* b){
     if(a->length != b->length) return false;
 
@@ -204,24 +475,157 @@ static int resolve_local(Compiler* compiler, Token* name){
     return -1;
 }
 
-static void named_variable(Token name,bool can_assign){
-    uint8_t get_op, set_op;
-    int arg = resolve_local(current, &name);
+static int add_upvalue(Compiler* compiler, uint8_t index, bool is_local){
+    int count = compiler->function->upvalue_count;
+    for (int i = 0; i < count; i++){
+        Upvalue* upvalue = &compiler->upvalues[i];
+        if(upvalue->index == index && upvalue->is_local == is_local) return i;
+    }
+
+    if(count == UINT8_COUNT){
+        error("Too many closure variables in function.");
+        return 0;
+    }
+
+    compiler->upvalues[count].is_local = is_local;
+    compiler->upvalues[count].index = index;
+    return compiler->function->upvalue_count++;
+}
+
+/*a local of the enclosing function, or an upvalue it has itself*/
+static int resolve_upvalue(Compiler* compiler, Token* name){
+    if(compiler->enclosing == NULL) return -1;
 
-    if(arg != -1){
-        get_op = OP_GET_LOCAL;
-        set_op = OP_SET_LOCAL;
+    int local = resolve_local(compiler->enclosing, name);
+    if(local != -1){
+        compiler->enclosing->locals[local].captured = true;
+        return add_upvalue(compiler, (uint8_t)local, true);
+    }
+
+    int upvalue = resolve_upvalue(compiler->enclosing, name);
+    if(upvalue != -1) return add_upvalue(compiler, (uint8_t)upvalue, false);
+
+    return -1;
+}
+
+/*
+    the opcode that reads the variable `name` and its operand in
+    `arg`, a local of this function, an upvalue or a global
+*/
+static uint8_t resolve_variable(Token* name, int* arg){
+    if((*arg = resolve_local(current, name)) != -1) return OP_GET_LOCAL;
+    if((*arg = resolve_upvalue(current, name)) != -1) return OP_GET_UPVALUE;
+
+    *arg = identifier_constant(name);
+    return OP_GET_GLOBAL;
+}
+
+/*
+    whether `name` is a const, looked up through the functions around
+    this one and then the globals. its value goes in `value`
+*/
+static bool constant_variable(Token* name, Value* value){
+    for (Compiler* compiler = current; compiler != NULL; compiler = compiler->enclosing){
+        for (int i = compiler->local_count - 1; i >= 0; i--){
+            Local* local = &compiler->locals[i];
+            if(!identifiers_equal(&local->name, name)) continue;
+
+            *value = local->value;
+            return local->constant;
+        }
+    }
+    Value index;
+    if(!table_get(&global_constants.indices, copy_string(name->start, name->length), &index) ||
+        AS_NUMBER(index) >= global_constants.visible){
+        return false;
+    }
+    *value = global_constants.values.values[(int)AS_NUMBER(index)];
+    return true;
+}
+
+void define_global_constant(ObjString* name, Value value){
+    table_set(&global_constants.indices, name, NUMBER_VAL(global_constants.names.count));
+    write_value_array(&global_constants.names, OBJ_VAL(name));
+    write_value_array(&global_constants.values, value);
+}
+
+int global_constant_count(){
+    return global_constants.names.count;
+}
+
+ObjString* global_constant(int index, Value* value){
+    *value = global_constants.values.values[index];
+    return AS_STRING(global_constants.names.values[index]);
+}
+
+static void mark_written(uint8_t global){
+    ObjString* name = AS_STRING(current_chunk()->constants.values[global]);
+    table_set(&global_constants.written, name, BOOL_VAL(true));
+}
+
+/*an upvalue being assigned means the local it ends up at is too*/
+static void mark_upvalue_assigned(Compiler* compiler, int index){
+    Upvalue* upvalue = &compiler->upvalues[index];
+    if(upvalue->is_local){
+        compiler->enclosing->locals[upvalue->index].assigned = true;
+    }else{
+        mark_upvalue_assigned(compiler->enclosing, upvalue->index);
+    }
+}
+
+/*
+    notes that the variable read by `get_op` is about to be assigned,
+    a local that's never assigned can be copied into closures and a
+    global that's been assigned can't become a const
+*/
+static void mark_assigned(uint8_t get_op, int arg){
+    if(get_op == OP_GET_LOCAL){
+        current->locals[arg].assigned = true;
+    }else if(get_op == OP_GET_UPVALUE){
+        mark_upvalue_assigned(current, arg);
     }else{
-        arg = identifier_constant(&name);
-        get_op = OP_GET_GLOBAL;
-        set_op = OP_SET_GLOBAL;
+        mark_written((uint8_t)arg);
     }
+}
 
+static bool assignment_follows(bool can_assign){
+    return (can_assign && (check(TOKEN_EQUAL) || is_compound_assignment(parser.current.type))) ||
+        check(TOKEN_PLUS_PLUS) || check(TOKEN_MINUS_MINUS);
+}
+
+static void named_variable(Token name,bool can_assign){
+    Value value;
+    if(constant_variable(&name, &value)){
+        if(assignment_follows(can_assign)) error("Can not assign to a constant.");
+        emit_constant(value);
+        return;
+    }
+
+    int arg;
+    uint8_t get_op = resolve_variable(&name, &arg);
+    uint8_t set_op = get_op == OP_GET_LOCAL ? OP_SET_LOCAL :
+        get_op == OP_GET_UPVALUE ? OP_SET_UPVALUE : OP_SET_GLOBAL;
+    if(assignment_follows(can_assign)) mark_assigned(get_op, arg);
 
     if(can_assign && match(TOKEN_EQUAL)){
         expression();
         emit_bytes(set_op, (uint8_t)arg);
+    }else if(can_assign && match_compound_assignment()){
+        TokenType update = parser.previous.type;
+        expression();
+        emit_bytes(update_opcode(update, get_op), (uint8_t)arg);
+    }else if(match(TOKEN_PLUS_PLUS) || match(TOKEN_MINUS_MINUS)){
+        /*the old value stays below the update, whose result gets popped*/
+        TokenType update = parser.previous.type;
+        int start = current_chunk()->count;
+        emit_bytes(get_op, (uint8_t)arg);
+        emit_constant(NUMBER_VAL(1));
+        emit_bytes(update_opcode(update, get_op), (uint8_t)arg);
+        emit_byte(OP_POP);
+        current->postfix_start = start;
+        current->postfix_end = current_chunk()->count;
     }else{
+        if(get_op == OP_GET_GLOBAL) current->last_global = current_chunk()->count;
         emit_bytes(get_op, (uint8_t)arg);
     }
 }
@@ -230,11 +634,246 @@ static void variable(bool can_assign){
     named_variable(parser.previous, can_assign);
 }
 
+static Token synthetic_token(const char* text){
+    Token token;
+    token.type = TOKEN_IDENTIFIER;
+    token.start = text;
+    token.length = (int)strlen(text);
+    token.line = parser.previous.line;
+    return token;
+}
+
+static void this_(bool can_assign){
+    (void)can_assign;
+    if(current_class == NULL){
+        error("Can not use 'this' outside of a class.");
+        return;
+    }
+    variable(false);
+}
+
+/*
+    the superclass sits in a local called super around the methods,
+    they capture it like any other variable
+*/
+static void super_(bool can_assign){
+    (void)can_assign;
+    if(current_class == NULL){
+        error("Can not use 'super' outside of a class.");
+    }else if(!current_class->has_superclass){
+        error("Can not use 'super' in a class with no superclass.");
+    }
+
+    consume(TOKEN_DOT, "Expected '.' after 'super'.");
+    consume(TOKEN_IDENTIFIER, "Expected superclass method name.");
+    uint8_t name = identifier_constant(&parser.previous);
+
+    named_variable(synthetic_token("this"), false);
+    if(match(TOKEN_LEFT_PAREN)){
+        uint8_t arg_count = argument_list();
+        named_variable(synthetic_token("super"), false);
+        emit_bytes(OP_SUPER_INVOKE, name);
+        emit_byte(arg_count);
+    }else{
+        named_variable(synthetic_token("super"), false);
+        emit_bytes(OP_GET_SUPER, name);
+    }
+}
+
+/*++x and --x, the value is the variable after the update*/
+static void prefix_update(bool can_assign){
+    (void)can_assign;
+    TokenType operator_type = parser.previous.type;
+    consume(TOKEN_IDENTIFIER, "Expected a variable after '++' or '--'.");
+
+    Token name = parser.previous;
+    Value value;
+    if(constant_variable(&name, &value)){
+        error("Can not assign to a constant.");
+        return;
+    }
+
+    int arg;
+    uint8_t get_op = resolve_variable(&name, &arg);
+    mark_assigned(get_op, arg);
+
+    emit_constant(NUMBER_VAL(1));
+    emit_bytes(update_opcode(operator_type, get_op), (uint8_t)arg);
+}
+
+/*
+    a postfix update whose value is about to be thrown away is done
+    as a prefix one, that drops the GET that kept the old value and
+    the POP that got rid of the new one
+*/
+static void drop_postfix_value(){
+    Chunk* chunk = current_chunk();
+    if(current->postfix_end != chunk->count) return;
+
+    uint8_t update[4];
+    memcpy(update, &chunk->code[current->postfix_start + 2], 4);
+    truncate_chunk(chunk, current->postfix_start);
+    for (int i = 0; i < 4; i++) emit_byte(update[i]);
+    current->postfix_end = -1;
+    current->last_constant.end = -1;
+    current->last_add.end = -1;
+}
+
+static bool is_falsey(Value value){
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+/*
+    returns the constant the operand starting at `start` compiled to,
+    if it compiled to nothing but a single constant
+*/
+static bool constant_operand(int start, ConstantOperand* operand){
+    *operand = current->last_constant;
+    return operand->end == current_chunk()->count && operand->start == start;
+}
+
+/*
+    drops the folded operands and their constant slots, the slots
+    can only be in use by the code we're about to throw away
+*/
+static void discard_operands(ConstantOperand* left, ConstantOperand* right){
+    ValueArray* constants = &current_chunk()->constants;
+    ConstantOperand* operands[] = {right, left};
+    for (int i = 0; i < 2; i++){
+        ConstantOperand* operand = operands[i];
+        if(operand->added == -1 || operand->added != constants->count - 1) continue;
+
+        constants->count--;
+        if(IS_STRING(operand->value)){
+            table_delete(&current->constants, AS_STRING(operand->value));
+        }
+    }
+    truncate_chunk(current_chunk(), left->start);
+    if(current->last_add.end > left->start) current->last_add.end = -1;
+}
+
+/*
+    mirrors what the VM would do with two constants, anything that
+    would be a runtime error is left alone so it still fails at runtime
+*/
+static bool fold_binary(TokenType operator_type, Value a, Value b, Value* result){
+    if(operator_type == TOKEN_EQUAL_EQUAL){
+        *result = BOOL_VAL(values_equal(a, b));
+        return true;
+    }
+    if(operator_type == TOKEN_BANG_EQUAL){
+        *result = BOOL_VAL(!values_equal(a, b));
+        return true;
+    }
+
+    if(operator_type == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b)){
+        ObjString* left = AS_STRING(a);
+        ObjString* right = AS_STRING(b);
+        int length = left->length + right->length;
+        char* chars = ALLOCATE(char, length + 1);
+        memcpy(chars, left->chars, left->length);
+        memcpy(chars + left->length, right->chars, right->length);
+        chars[length] = '\0';
+        *result = OBJ_VAL(take_string(chars, length));
+        return true;
+    }
+
+    if(!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+
+    switch (operator_type)
+    {
+        case TOKEN_GREATER:         *result = BOOL_VAL(x > y); break;
+        case TOKEN_GREATER_EQUAL:   *result = BOOL_VAL(!(x < y)); break;
+        case TOKEN_LESS:            *result = BOOL_VAL(x < y); break;
+        case TOKEN_LESS_EQUAL:      *result = BOOL_VAL(!(x > y)); break;
+        case TOKEN_PLUS:            *result = NUMBER_VAL(x + y); break;
+        case TOKEN_MINUS:           *result = NUMBER_VAL(x - y); break;
+        case TOKEN_STAR:            *result = NUMBER_VAL(x * y); break;
+        case TOKEN_SLASH:           *result = NUMBER_VAL(x / y); break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+/*pushes a value with a single instruction that can't fail*/
+static bool is_plain_read(int start){
+    Chunk* chunk = current_chunk();
+    if(start >= chunk->count || start + instruction_length(chunk, start) != chunk->count) return false;
+
+    switch (chunk->code[start]){
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_UPVALUE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+    a chain of `+` with a string constant anywhere in it only works
+    out if every operand is a string, so it's done as one CONCAT_N of
+    all of them. the pairs used to be checked as soon as each operand
+    was there, an operand after the first two only joins the chain if
+    reading it can't fail or do anything else. `chained` is whether
+    the left operand is the chain last_add ends
+*/
+static void emit_add(bool chained, bool left_string, int right_start){
+    Chunk* chunk = current_chunk();
+    Concatenation* chain = &current->last_add;
+    ConstantOperand right;
+    bool right_string = constant_operand(right_start, &right) && IS_STRING(right.value);
+
+    if(chained && (chain->has_string || right_string) && chain->operands < UINT8_MAX &&
+        is_plain_read(right_start)){
+        uint8_t read[2];
+        int length = chunk->count - right_start;
+        memcpy(read, &chunk->code[right_start], length);
+        truncate_chunk(chunk, chain->start);
+        for (int i = 0; i < length; i++) emit_byte(read[i]);
+        chain->operands++;
+        chain->has_string = true;
+    }else{
+        chain->operands = 2;
+        chain->has_string = left_string || right_string;
+    }
+
+    chain->start = chunk->count;
+    if(chain->operands > 2){
+        emit_bytes(OP_CONCAT_N, (uint8_t)chain->operands);
+    }else{
+        emit_byte(OP_ADD);
+    }
+    chain->end = chunk->count;
+    current->last_constant.end = -1;
+}
+
 static void binary(bool can_assign){
     TokenType operator_type = parser.previous.type;
     ParseRule* rule = get_rule(operator_type);
+
+    ConstantOperand left = current->last_constant;
+    bool left_constant = left.end == current_chunk()->count;
+    bool chained = current->last_add.end == current_chunk()->count;
+    int right_start = current_chunk()->count;
+
     parse_precedence((Precedence) rule->precedence + 1);
 
+    ConstantOperand right;
+    Value folded;
+    if(left_constant && constant_operand(right_start, &right) &&
+        fold_binary(operator_type, left.value, right.value, &folded)){
+        discard_operands(&left, &right);
+        emit_constant(folded);
+        return;
+    }
+
     switch (operator_type)
     {
         case TOKEN_BANG_EQUAL :     emit_bytes(OP_EQUAL,OP_NOT);break;
@@ -243,7 +882,9 @@ static void binary(bool can_assign){
         case TOKEN_GREATER_EQUAL:   emit_bytes(OP_LESS,OP_NOT);break; 
         case TOKEN_LESS:            emit_byte(OP_LESS); break;
         case TOKEN_LESS_EQUAL:      emit_bytes(OP_GREATER,OP_NOT);break;
-        case TOKEN_PLUS:            emit_byte(OP_ADD); break;
+        case TOKEN_PLUS:
+            emit_add(chained, left_constant && IS_STRING(left.value), right_start);
+            break;
         case TOKEN_MINUS:           emit_byte(OP_SUBTRACT); break;
         case TOKEN_STAR:            emit_byte(OP_MULTIPLY); break;
         case TOKEN_SLASH:           emit_byte(OP_DIVIDE); break;
@@ -255,18 +896,33 @@ static void binary(bool can_assign){
 static void literal(bool can_assign){
     switch (parser.previous.type)
     {
-        case TOKEN_FALSE:   emit_byte(OP_FALSE); break;
-        case TOKEN_NIL:     emit_byte(OP_NIL); break;
-        case TOKEN_TRUE:    emit_byte(OP_TRUE); break;
+        case TOKEN_FALSE:   emit_constant(BOOL_VAL(false)); break;
+        case TOKEN_NIL:     emit_constant(NIL_VAL); break;
+        case TOKEN_TRUE:    emit_constant(BOOL_VAL(true)); break;
         default: return;
     }
 }
 
 static void unary(bool can_assign){
     TokenType operator_type = parser.previous.type;
+    int operand_start = current_chunk()->count;
 
     parse_precedence(PREC_UNARY);
 
+    ConstantOperand operand;
+    if(constant_operand(operand_start, &operand)){
+        if(operator_type == TOKEN_BANG){
+            discard_operands(&operand, &operand);
+            emit_constant(BOOL_VAL(is_falsey(operand.value)));
+            return;
+        }
+        if(operator_type == TOKEN_MINUS && IS_NUMBER(operand.value)){
+            discard_operands(&operand, &operand);
+            emit_constant(NUMBER_VAL(-AS_NUMBER(operand.value)));
+            return;
+        }
+    }
+
     switch (operator_type)
     {
         case TOKEN_BANG: emit_byte(OP_NOT);break;
@@ -300,39 +956,198 @@ static uint8_t argument_list(){
     return arg_count;
 }
 
+#ifdef INLINE_CALLS
+/*
+    remembers a call to a global function that can be inlined,
+    inline_calls() swaps the body in once the chunk is finished
+*/
+static void add_call_site(int callee, int call, uint8_t arg_count){
+    Chunk* chunk = current_chunk();
+    Value function;
+    ObjString* name = AS_STRING(chunk->constants.values[chunk->code[callee + 1]]);
+    if(!table_get(&inliner.functions, name, &function)) return;
+    if(AS_FUNCTION(function)->arity != arg_count) return;
+
+    /*the body's constants have to fit in the caller's table*/
+    ValueArray* constants = &AS_FUNCTION(function)->chunk.constants;
+    if(chunk->constants.count + constants->count > UINT8_COUNT) return;
+
+    if(current->call_site_capacity < current->call_site_count + 1){
+        int old_capacity = current->call_site_capacity;
+        current->call_site_capacity = GROW_CAPACITY(old_capacity);
+        current->call_sites = GROW_ARRAY(CallSite, current->call_sites,
+            old_capacity, current->call_site_capacity);
+    }
+
+    CallSite* site = &current->call_sites[current->call_site_count++];
+    site->callee = callee;
+    site->call = call;
+    site->function = AS_FUNCTION(function);
+    site->constants = ALLOCATE(uint8_t, constants->count);
+    for (int i = 0; i < constants->count; i++){
+        site->constants[i] = make_constant(constants->values[i]);
+    }
+}
+#endif
+
+/*
+    the opcode a call to the global named by constant `name` becomes,
+    if it holds an intrinsic and nothing in the source declares or
+    assigns that name. the REPL or LAZY_COMPILE can still compile an
+    assignment later, so the opcode checks its callee when it runs
+*/
+static bool intrinsic_call(uint8_t name, uint8_t arg_count, uint8_t* opcode){
+    if(!global_names.scanned) return false;
+
+    ObjString* string = AS_STRING(current_chunk()->constants.values[name]);
+    Value value;
+    if(table_get(&global_names.assigned, string, &value)) return false;
+    if(!table_get(&vm.globals, string, &value) || !IS_NATIVE(value)) return false;
+
+    ObjNative* native = AS_NATIVE(value);
+    if(native->intrinsic == -1 || native->arity != arg_count) return false;
+    *opcode = (uint8_t)native->intrinsic;
+    return true;
+}
+
 static void call(bool can_assign){
+    int callee = current->last_global;
+    bool global_callee = callee != -1 && callee + 2 == current_chunk()->count;
+
     uint8_t arg_count = argument_list();
+    int call = current_chunk()->count;
+
+    uint8_t intrinsic;
+    if(global_callee && intrinsic_call(current_chunk()->code[callee + 1], arg_count, &intrinsic)){
+        /*the callee stays, a later compile can still give the global something else*/
+        emit_byte(intrinsic);
+        return;
+    }
+#ifdef INLINE_CACHES
+    if(global_callee){
+        uint8_t name = current_chunk()->code[callee + 1];
+        emit_bytes(OP_CALL_GLOBAL, arg_count);
+        emit_byte(name);
+    }else{
+        emit_bytes(OP_CALL, arg_count);
+    }
+#else
     emit_bytes(OP_CALL, arg_count);
+#endif
+
+#ifdef INLINE_CALLS
+    if(global_callee) add_call_site(callee, call, arg_count);
+#else
+    (void)global_callee;
+    (void)call;
+#endif
+}
+
+/*`instance.name(...)` is a single INVOKE, there's no bound method in between*/
+static void dot(bool can_assign){
+    consume(TOKEN_IDENTIFIER, "Expected property name after '.'.");
+    uint8_t name = identifier_constant(&parser.previous);
+
+    if(can_assign && match(TOKEN_EQUAL)){
+        expression();
+        emit_bytes(OP_SET_PROPERTY, name);
+    }else if(can_assign && match_compound_assignment()){
+        TokenType update = parser.previous.type;
+        expression();
+        emit_bytes(update_opcode(update, OP_GET_PROPERTY), name);
+    }else if(match(TOKEN_LEFT_PAREN)){
+        uint8_t arg_count = argument_list();
+        emit_bytes(OP_INVOKE, name);
+        emit_byte(arg_count);
+    }else{
+        emit_bytes(OP_GET_PROPERTY, name);
+    }
+}
+
+static void array_literal(bool can_assign){
+    (void)can_assign;
+    int count = 0;
+    if(!check(TOKEN_RIGHT_BRACKET)){
+        do{
+            expression();
+            if(count == UINT8_MAX) error("Too many elements (255)");
+            count++;
+        } while (match(TOKEN_COMMA));
+    }
+
+    consume(TOKEN_RIGHT_BRACKET, "Expected ']' after the array elements.");
+    emit_bytes(OP_ARRAY, (uint8_t)count);
+}
+
+static void map_literal(bool can_assign){
+    (void)can_assign;
+    int count = 0;
+    if(!check(TOKEN_RIGHT_BRACE)){
+        do{
+            expression();
+            consume(TOKEN_COLON, "Expected ':' after a map key.");
+            expression();
+            if(count == UINT8_MAX) error("Too many entries (255)");
+            count++;
+        } while (match(TOKEN_COMMA));
+    }
+
+    consume(TOKEN_RIGHT_BRACE, "Expected '}' after the map entries.");
+    emit_bytes(OP_MAP, (uint8_t)count);
+}
+
+static void subscript(bool can_assign){
+    expression();
+    consume(TOKEN_RIGHT_BRACKET, "Expected ']' after the index.");
+
+    if(can_assign && match(TOKEN_EQUAL)){
+        expression();
+        emit_byte(OP_SET_INDEX);
+    }else if(can_assign && match_compound_assignment()){
+        TokenType update = parser.previous.type;
+        expression();
+        emit_byte(update_opcode(update, OP_GET_INDEX));
+    }else{
+        emit_byte(OP_GET_INDEX);
+    }
 }
 
 ParseRule rules[] = {
     [TOKEN_LEFT_PAREN]      = {grouping, call, PREC_CALL},
     [TOKEN_RIGHT_PAREN]     = {NULL, NULL, PREC_NONE},
-    [TOKEN_LEFT_BRACE]      = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACE]      = {map_literal, NULL, PREC_NONE},
     [TOKEN_RIGHT_BRACE]     = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACKET]    = {array_literal, subscript, PREC_CALL},
+    [TOKEN_RIGHT_BRACKET]   = {NULL, NULL, PREC_NONE},
     [TOKEN_COMMA]           = {NULL, NULL, PREC_NONE},
-    [TOKEN_DOT]             = {NULL, NULL, PREC_NONE},
+    [TOKEN_DOT]             = {NULL, dot, PREC_CALL},
     [TOKEN_MINUS]           = {unary, binary, PREC_TERM},
     [TOKEN_PLUS]            = {NULL, binary, PREC_TERM},
     [TOKEN_SEMICOLON]       = {NULL, NULL, PREC_NONE},
+    [TOKEN_COLON]           = {NULL, NULL, PREC_NONE},
     [TOKEN_SLASH]           = {NULL, binary, PREC_FACTOR},
     [TOKEN_STAR]            = {NULL, binary, PREC_FACTOR},
     [TOKEN_BANG]            = {unary, NULL, PREC_NONE},
-    [TOKEN_BANG_EQUAL]      = {NULL, binary, PREC_NONE},
+    [TOKEN_BANG_EQUAL]      = {NULL, binary, PREC_EQUALITY},
     [TOKEN_EQUAL]           = {NULL, NULL, PREC_NONE},
-    [TOKEN_EQUAL_EQUAL]     = {NULL, binary, PREC_NONE},
-    [TOKEN_GREATER]         = {NULL, binary, PREC_NONE},
-    [TOKEN_GREATER_EQUAL]   = {NULL, binary, PREC_NONE},
-    [TOKEN_LESS]            = {NULL, binary, PREC_NONE},
-    [TOKEN_LESS_EQUAL]      = {NULL, binary, PREC_NONE},
+    [TOKEN_EQUAL_EQUAL]     = {NULL, binary, PREC_EQUALITY},
+    [TOKEN_GREATER]         = {NULL, binary, PREC_COMPARISON},
+    [TOKEN_GREATER_EQUAL]   = {NULL, binary, PREC_COMPARISON},
+    [TOKEN_LESS]            = {NULL, binary, PREC_COMPARISON},
+    [TOKEN_LESS_EQUAL]      = {NULL, binary, PREC_COMPARISON},
+    [TOKEN_PLUS_EQUAL]      = {NULL, NULL, PREC_NONE},
+    [TOKEN_MINUS_EQUAL]     = {NULL, NULL, PREC_NONE},
+    [TOKEN_STAR_EQUAL]      = {NULL, NULL, PREC_NONE},
+    [TOKEN_SLASH_EQUAL]     = {NULL, NULL, PREC_NONE},
+    [TOKEN_PLUS_PLUS]       = {prefix_update, NULL, PREC_NONE},
+    [TOKEN_MINUS_MINUS]     = {prefix_update, NULL, PREC_NONE},
     [TOKEN_IDENTIFIER]      = {variable, NULL, PREC_NONE},
-    [TOKEN_STRING]          = {NULL, NULL, PREC_NONE},
+    [TOKEN_STRING]          = {string, NULL, PREC_NONE},
     [TOKEN_NUMBER]          = {number, NULL, PREC_NONE},
     [TOKEN_AND]             = {NULL, and_, PREC_AND},
     [TOKEN_CLASS]           = {NULL, NULL, PREC_NONE},
     [TOKEN_ELSE]            = {NULL, NULL, PREC_NONE},
     [TOKEN_FALSE]           = {literal, NULL, PREC_NONE},
-    [TOKEN_FALSE]           = {NULL, NULL, PREC_NONE},
     [TOKEN_FOR]             = {NULL, NULL, PREC_NONE},
     [TOKEN_FUN]             = {NULL, NULL, PREC_NONE},
     [TOKEN_IF]              = {NULL, NULL, PREC_NONE},
@@ -340,11 +1155,15 @@ ParseRule rules[] = {
     [TOKEN_OR]              = {NULL, or_, PREC_OR},
     [TOKEN_PRINT]           = {NULL, NULL, PREC_NONE},
     [TOKEN_RETURN]          = {NULL, NULL, PREC_NONE},
-    [TOKEN_SUPER]           = {NULL, NULL, PREC_NONE},
-    [TOKEN_THIS]            = {NULL, NULL, PREC_NONE},
+    [TOKEN_SUPER]           = {super_, NULL, PREC_NONE},
+    [TOKEN_THIS]            = {this_, NULL, PREC_NONE},
     [TOKEN_TRUE]            = {literal, NULL, PREC_NONE},
     [TOKEN_VAR]             = {NULL, NULL, PREC_NONE},
     [TOKEN_WHILE]           = {NULL, NULL, PREC_NONE},
+    [TOKEN_SWITCH]          = {NULL, NULL, PREC_NONE},
+    [TOKEN_CASE]            = {NULL, NULL, PREC_NONE},
+    [TOKEN_DEFAULT]         = {NULL, NULL, PREC_NONE},
+    [TOKEN_CONST]           = {NULL, NULL, PREC_NONE},
     [TOKEN_ERROR]           = {NULL, NULL, PREC_NONE},
     [TOKEN_EOF]             = {NULL, NULL, PREC_NONE},
 };
@@ -371,7 +1190,7 @@ static void parse_precedence(Precedence precedence){
         infix_rule(can_assign);
     }
 
-    if(can_assign && match(TOKEN_EQUAL)){
+    if(can_assign && (match(TOKEN_EQUAL) || match_compound_assignment())){
         error("Invalid assignment target");
     }
 }
@@ -392,28 +1211,118 @@ static void emit_bytes(uint8_t byte_1, uint8_t byte_2){
 
 static void emit_return(){
     //this thing is only called when there's no explicit return statement
-    emit_byte(OP_NIL);
+    if(current->type == TYPE_INITIALIZER){
+        emit_bytes(OP_GET_LOCAL, 0);
+    }else{
+        emit_byte(OP_NIL);
+    }
     emit_byte(OP_RETURN);
 }
 
 static ObjFunction* end_compiler(){
     emit_return();
     ObjFunction* function = current->function;
+    /*the function's own scope never ends, RETURN closes what's left of it*/
+    for (int i = current->local_count - 1; i >= 0; i--) settle_captures(i);
+    FREE_ARRAY(Capture, current->captures, current->capture_capacity);
+#ifdef INLINE_CALLS
+    int inlined = 0;
+    if(!parser.had_error){
+        inlined = inline_calls(function, function->arity + 1,
+            current->call_sites, current->call_site_count);
+    }
+    for (int i = 0; i < current->call_site_count; i++){
+        CallSite* site = &current->call_sites[i];
+        FREE_ARRAY(uint8_t, site->constants, site->function->chunk.constants.count);
+    }
+    FREE_ARRAY(CallSite, current->call_sites, current->call_site_capacity);
+#endif
+#ifdef PEEPHOLE_OPTIMIZE
+    int removed = 0;
+    if(!parser.had_error) removed = optimize_chunk(current_chunk());
+#endif
+#ifdef SPECIALIZE_NUMBERS
+    int specialized = 0;
+    if(!parser.had_error) specialized = specialize_chunk(current_chunk(), function->arity + 1);
+#endif
 #ifdef DEBUG_PRINT_CODE
     if(!parser.had_error){
         disassemble_chunk(current_chunk(), function->name != NULL ? function->name->chars : "<script>");
+#ifdef INLINE_CALLS
+        output_format(&vm.output, "-- inlined %d call(s) --\n", inlined);
+#endif
+#ifdef PEEPHOLE_OPTIMIZE
+        output_format(&vm.output, "-- peephole removed %d instruction(s) --\n", removed);
+#endif
+#ifdef SPECIALIZE_NUMBERS
+        output_format(&vm.output, "-- specialized %d instruction(s) --\n", specialized);
+#endif
     }
 #endif
+    free_table(&current->constants);
     current = current->enclosing;
     return function;
 }
 
+/*
+    nil and the booleans have their own opcodes, everything else
+    goes through the constant table
+*/
 static void emit_constant(Value value){
-    emit_bytes(OP_CONSTANT,make_constant(value));
+    int start = current_chunk()->count;
+    int pool_count = current_chunk()->constants.count;
+
+    if(IS_NIL(value)){
+        emit_byte(OP_NIL);
+    }else if(IS_BOOL(value)){
+        emit_byte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    }else{
+        emit_bytes(OP_CONSTANT,make_constant(value));
+    }
+
+    ConstantOperand* operand = &current->last_constant;
+    operand->start = start;
+    operand->end = current_chunk()->count;
+    operand->added = current_chunk()->constants.count > pool_count ? pool_count : -1;
+    operand->value = value;
+}
+
+/*
+    the slot `value` already has in this chunk's constant table or -1,
+    strings are interned so they can be looked up by pointer, numbers
+    are compared bit for bit so 0 and -0 keep their own slots
+*/
+static int find_constant(Value value){
+    if(IS_STRING(value)){
+        Value slot;
+        if(table_get(&current->constants, AS_STRING(value), &slot)){
+            return (int)AS_NUMBER(slot);
+        }
+        return -1;
+    }
+
+    if(IS_NUMBER(value)){
+        ValueArray* constants = &current_chunk()->constants;
+        double number = AS_NUMBER(value);
+        for (int i = 0; i < constants->count; i++){
+            if(IS_NUMBER(constants->values[i]) &&
+                memcmp(&constants->values[i].as.number, &number, sizeof(double)) == 0){
+                return i;
+            }
+        }
+    }
+
+    return -1;
 }
 
 static uint8_t make_constant(Value value){
-    int constant = add_constant(current_chunk(), value);
+    int constant = find_constant(value);
+    if(constant != -1) return (uint8_t)constant;
+
+    constant = add_constant(current_chunk(), value);
+    if(IS_STRING(value)){
+        table_set(&current->constants, AS_STRING(value), NUMBER_VAL(constant));
+    }
     if(constant > UINT8_MAX){
         error("Too many constants in one chunk");
         return 0;
@@ -454,6 +1363,7 @@ static void error_at(Token* token, const char* message){
     //and keep compiling... the byte code never gets executed
     if(parser.panic_mode) return;
     parser.panic_mode = true;
+    flush_output(&vm.output);
     fprintf(stderr,"[line %d] Error",token->line);
     if(token->type == TOKEN_EOF){
         fprintf(stderr, " at the end");
@@ -476,6 +1386,43 @@ static void begin_scope(){
     current->scope_depth++;
 }
 
+/*
+    decides how every closure captured the local in `slot`, nothing
+    can assign it anymore. a local that's assigned at all is shared
+    with its closures, true if it has to be closed over instead of
+    just popped
+*/
+static bool settle_captures(int slot){
+    Local* local = &current->locals[slot];
+    bool shared = local->captured && local->assigned;
+
+    int kept = 0;
+    for (int i = 0; i < current->capture_count; i++){
+        Capture* capture = &current->captures[i];
+        if(capture->local != slot){
+            current->captures[kept++] = *capture;
+            continue;
+        }
+        current_chunk()->code[capture->offset] = shared ? CAPTURE_LOCAL : CAPTURE_COPY;
+    }
+    current->capture_count = kept;
+    return shared;
+}
+
+/*the kind byte about to be emitted is settled later, see settle_captures()*/
+static void add_capture(int local){
+    if(current->capture_capacity < current->capture_count + 1){
+        int old_capacity = current->capture_capacity;
+        current->capture_capacity = GROW_CAPACITY(old_capacity);
+        current->captures = GROW_ARRAY(Capture, current->captures,
+            old_capacity, current->capture_capacity);
+    }
+
+    Capture* capture = &current->captures[current->capture_count++];
+    capture->local = local;
+    capture->offset = current_chunk()->count;
+}
+
 static void end_scope(){
     current->scope_depth--;
 
@@ -483,7 +1430,7 @@ static void end_scope(){
         current->locals[current->local_count -1].depth >
             current->scope_depth)
     {
-        emit_byte(OP_POP);
+        emit_byte(settle_captures(current->local_count - 1) ? OP_CLOSE_UPVALUE : OP_POP);
         current->local_count--;
     }
 }
@@ -509,6 +1456,9 @@ static void add_local(Token name){
     Local* local = &current->locals[current->local_count++];
     local->name = name;
     local->depth = -1;
+    local->constant = false;
+    local->captured = false;
+    local->assigned = false;
 }
 
 static void declare_variable(){
@@ -537,7 +1487,14 @@ static uint8_t parse_variable(const char* error_message){
     declare_variable();
     if(current->scope_depth > 0) return 0;
 
-    return identifier_constant(&parser.previous);
+    Value value;
+    ObjString* name = copy_string(parser.previous.start, parser.previous.length);
+    if(table_get(&global_constants.indices, name, &value)){
+        error("A constant already exists with this name.");
+    }
+    uint8_t global = identifier_constant(&parser.previous);
+    mark_written(global);
+    return global;
 }
 
 static void mark_initialized(){
@@ -571,6 +1528,48 @@ static void var_declaration(){
     define_variable(global);
 }
 
+/*
+    reads of a const compile to its value, which can then fold with
+    whatever's around it. a global one is still defined, code that
+    was compiled before the declaration reads it with GET_GLOBAL
+*/
+static void const_declaration(){
+    consume(TOKEN_IDENTIFIER, "Expected constant name after 'const'.");
+    Token name = parser.previous;
+    uint8_t global = 0;
+    Value value;
+
+    if(current->scope_depth > 0){
+        declare_variable();
+    }else{
+        ObjString* string = copy_string(name.start, name.length);
+        if(table_get(&global_constants.indices, string, &value)){
+            error("A constant already exists with this name.");
+        }else if(table_get(&global_constants.written, string, &value)){
+            error("Can not make a variable that's assigned elsewhere a constant.");
+        }
+        global = identifier_constant(&name);
+    }
+
+    consume(TOKEN_EQUAL, "Expected '=' after constant name.");
+    int start = current_chunk()->count;
+    expression();
+    ConstantOperand operand;
+    bool known = constant_operand(start, &operand);
+    if(!known) error("A constant's value has to be known at compile time.");
+    consume(TOKEN_SEMICOLON, "Expected ';' after constant declaration");
+
+    if(current->scope_depth > 0){
+        Local* local = &current->locals[current->local_count - 1];
+        local->constant = known;
+        local->value = operand.value;
+        mark_initialized();
+    }else{
+        if(known) define_global_constant(AS_STRING(current_chunk()->constants.values[global]), operand.value);
+        emit_bytes(OP_DEFINE_GLOBAL, global);
+    }
+}
+
 static void print_statement(){
     expression();
     consume(TOKEN_SEMICOLON,"Expected ';' after value");
@@ -580,6 +1579,7 @@ static void print_statement(){
 static void expression_statement(){
     expression();
     consume(TOKEN_SEMICOLON,"Expected ';' after expression");
+    drop_postfix_value();
     emit_byte(OP_POP);
 }
 
@@ -617,6 +1617,64 @@ static void while_statement(){
     emit_byte(OP_POP);
 }
 
+#ifdef FUSE_COUNTING_LOOPS
+static bool is_number_constant(uint8_t constant){
+    return IS_NUMBER(current_chunk()->constants.values[constant]);
+}
+
+/*
+    whether the condition just emitted from `start` is `i < n` with
+    `i` a local and `n` a local or a number, picks the loop opcode
+    that reads that kind of bound
+*/
+static bool counting_condition(int start, uint8_t* counter, uint8_t* opcode, uint8_t* bound){
+    uint8_t* code = &current_chunk()->code[start];
+    if(current_chunk()->count - start != 5) return false;
+    if(code[0] != OP_GET_LOCAL || code[4] != OP_LESS) return false;
+
+    if(code[2] == OP_GET_LOCAL){
+        *opcode = OP_FOR_LOOP;
+    }else if(code[2] == OP_CONSTANT && is_number_constant(code[3])){
+        *opcode = OP_FOR_LOOP_K;
+    }else{
+        return false;
+    }
+    *counter = code[1];
+    *bound = code[3];
+    return true;
+}
+
+/*
+    whether the increment just emitted from `start` is `i = i + step`
+    or `i += step` with a number step, `i++` is the latter by now
+*/
+static bool counting_increment(int start, uint8_t counter, uint8_t* step){
+    uint8_t* code = &current_chunk()->code[start];
+    if(current_chunk()->count - start == 4 && code[0] == OP_CONSTANT &&
+        is_number_constant(code[1]) && code[2] == OP_ADD_LOCAL && code[3] == counter){
+        *step = code[1];
+        return true;
+    }
+    if(current_chunk()->count - start != 7) return false;
+    if(code[0] != OP_GET_LOCAL || code[1] != counter) return false;
+    if(code[2] != OP_CONSTANT || !is_number_constant(code[3])) return false;
+    if(code[4] != OP_ADD || code[5] != OP_SET_LOCAL || code[6] != counter) return false;
+
+    *step = code[3];
+    return true;
+}
+#endif
+
+/*
+    a counting loop gets its increment and condition fused into one
+    instruction ahead of the body, the entry test runs as usual and
+    jumps over it:
+
+        condition, JUMP_IF_FALSE exit, POP, JUMP body
+        step:   FOR_LOOP counter bound step -> exit
+        body:   ..., LOOP step
+        exit:   POP
+*/
 static void for_statement(){
     begin_scope();
     consume(TOKEN_LEFT_PAREN, "Expected '(' after for statement.");
@@ -631,11 +1689,20 @@ static void for_statement(){
 
     int loop_start = current_chunk()->count;
     int exit_jump = -1;
+    int loop_exit = -1;
+    bool counting = false;
+    uint8_t counter = 0, loop_opcode = OP_FOR_LOOP, bound = 0, step = 0;
 
     /*condition clause*/
     if(!match(TOKEN_SEMICOLON)){
+        int condition_start = current_chunk()->count;
         expression();
         consume(TOKEN_SEMICOLON,"Expected ';' after condition.");
+#ifdef FUSE_COUNTING_LOOPS
+        counting = counting_condition(condition_start, &counter, &loop_opcode, &bound);
+#else
+        (void)condition_start;
+#endif
         exit_jump = emit_jump(OP_JUMP_IF_FALSE);
         emit_byte(OP_POP);
     }
@@ -645,9 +1712,24 @@ static void for_statement(){
         int body_jump = emit_jump(OP_JUMP);
         int increment_start = current_chunk()->count;
         expression();
-        emit_byte(OP_POP);
+        drop_postfix_value();
+#ifdef FUSE_COUNTING_LOOPS
+        counting = counting && counting_increment(increment_start, counter, &step);
+#else
+        counting = false;
+#endif
+        if(counting){
+            truncate_chunk(current_chunk(), increment_start);
+            current->last_add.end = -1;
+            loop_exit = emit_jump(loop_opcode);
+            emit_byte(counter);
+            emit_byte(bound);
+            emit_byte(step);
+        }else{
+            emit_byte(OP_POP);
+        }
         consume(TOKEN_RIGHT_PAREN,"Expected ')' after expression. In for statement");
-        emit_loop(loop_start);
+        if(!counting) emit_loop(loop_start);
         loop_start = increment_start;
         patch_jump(body_jump);
     }
@@ -657,20 +1739,212 @@ static void for_statement(){
 
     if(exit_jump != -1){
         patch_jump(exit_jump);
+        if(loop_exit != -1) patch_jump(loop_exit);
         emit_byte(OP_POP);
     }
 
     end_scope();
 }
 
-static void function(FunctionType type){
-    Compiler compiler;
-    init_compiler(&compiler, type);
+/*a case value has to compile down to a single number or string constant*/
+static Value case_value(){
+    int start = current_chunk()->count;
+    expression();
+
+    ConstantOperand operand;
+    if(!constant_operand(start, &operand) ||
+        (!IS_NUMBER(operand.value) && !IS_STRING(operand.value))){
+        error("Case values must be number or string constants.");
+        truncate_chunk(current_chunk(), start);
+        current->last_constant.end = -1;
+        current->last_add.end = -1;
+        return NIL_VAL;
+    }
+
+    /*nothing's left at the end of the chunk for binary() to fold*/
+    discard_operands(&operand, &operand);
+    current->last_constant.end = -1;
+    return operand.value;
+}
+
+/*jumps to `body`, or out of the switch if that's -1*/
+static void switch_entry(Switch* cases, int body){
+    if(body == -1){
+        cases->exits[cases->exit_count++] = emit_jump(OP_JUMP);
+    }else{
+        emit_loop(cases->body_start[body]);
+    }
+}
+
+#ifdef JUMP_TABLES
+/*
+    whether the cases are all integers close enough together to be
+    looked up by value, at least half of the table has to be cases
+*/
+static bool dense_cases(Switch* cases, double* low, int* size){
+    double min = 0, max = 0;
+    for (int i = 0; i < cases->case_count; i++){
+        if(!IS_NUMBER(cases->cases[i])) return false;
+        double value = AS_NUMBER(cases->cases[i]);
+        if(!(value >= -1e9 && value <= 1e9) || value != (int)value) return false;
+
+        if(i == 0 || value < min) min = value;
+        if(i == 0 || value > max) max = value;
+    }
+
+    *low = min;
+    *size = (int)(max - min) + 1;
+    return *size <= UINT8_MAX && *size <= 2 * cases->case_count;
+}
+
+static void emit_jump_table(Switch* cases, uint8_t slot){
+    double low;
+    int size;
+    emit_bytes(OP_GET_LOCAL, slot);
+
+    if(dense_cases(cases, &low, &size)){
+        emit_bytes(OP_SWITCH, make_constant(NUMBER_VAL(low)));
+        emit_byte((uint8_t)size);
+        for (int value = 0; value < size; value++){
+            int body = cases->default_body;
+            for (int i = 0; i < cases->case_count; i++){
+                if(AS_NUMBER(cases->cases[i]) == low + value) body = cases->case_body[i];
+            }
+            switch_entry(cases, body);
+        }
+    }else{
+        /*the cases go into the constant table side by side, found through a hash*/
+        int first = current_chunk()->constants.count;
+        if(first + cases->case_count > UINT8_COUNT){
+            error("Too many constants in one chunk");
+            first = 0;
+        }
+        for (int i = 0; i < cases->case_count; i++){
+            add_constant(current_chunk(), cases->cases[i]);
+        }
+
+        emit_bytes(OP_SWITCH_HASH, (uint8_t)first);
+        emit_byte((uint8_t)cases->case_count);
+        for (int i = 0; i < cases->case_count; i++) switch_entry(cases, cases->case_body[i]);
+    }
+
+    switch_entry(cases, cases->default_body);
+}
+#endif
+
+/*a compare and branch per case, cheaper than a table when there are only a few*/
+static void emit_case_chain(Switch* cases, uint8_t slot){
+    for (int i = 0; i < cases->case_count; i++){
+        emit_bytes(OP_GET_LOCAL, slot);
+        emit_constant(cases->cases[i]);
+        emit_byte(OP_EQUAL);
+        int next = emit_jump(OP_JUMP_IF_FALSE);
+        emit_byte(OP_POP);
+        emit_loop(cases->body_start[cases->case_body[i]]);
+        patch_jump(next);
+        emit_byte(OP_POP);
+    }
+
+    switch_entry(cases, cases->default_body);
+}
+
+/*
+    the dispatch goes after the bodies, it can only be picked once
+    every case is known:
+
+        value, JUMP dispatch
+        body:       ..., JUMP exit          (once per case or default)
+        dispatch:   GET_LOCAL value, SWITCH, a LOOP to the body of
+                    every entry and to the default, or a JUMP to exit
+        exit:       POP
+
+    the value sits in a local with no name so a chain of compares can
+    read it again for every case. bodies never fall into the next one
+*/
+static void switch_statement(){
+    consume(TOKEN_LEFT_PAREN, "Expected '(' after switch.");
+    begin_scope();
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "Expected ')' after the switch value.");
+    consume(TOKEN_LEFT_BRACE, "Expected '{' before the switch cases.");
+
+    Token hidden = parser.previous;
+    hidden.start = "";
+    hidden.length = 0;
+    add_local(hidden);
+    mark_initialized();
+    uint8_t slot = (uint8_t)(current->local_count - 1);
+
+    int dispatch = emit_jump(OP_JUMP);
+    Switch cases;
+    cases.case_count = 0;
+    cases.body_count = 0;
+    cases.default_body = -1;
+    cases.exit_count = 0;
+
+    while(!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)){
+        if(cases.body_count == UINT8_MAX){
+            error_at_current("Too many cases in one switch.");
+            break;
+        }
+
+        if(match(TOKEN_DEFAULT)){
+            if(cases.default_body != -1) error("A switch can only have one default.");
+            cases.default_body = cases.body_count;
+        }else if(match(TOKEN_CASE)){
+            do{
+                Value value = case_value();
+                if(IS_NIL(value)) continue;
+
+                for (int i = 0; i < cases.case_count; i++){
+                    if(values_equal(cases.cases[i], value)) error("Duplicate case value.");
+                }
+                if(cases.case_count == UINT8_MAX){
+                    error("Too many cases in one switch.");
+                    continue;
+                }
+                cases.cases[cases.case_count] = value;
+                cases.case_body[cases.case_count++] = cases.body_count;
+            }while(match(TOKEN_COMMA));
+        }else{
+            error_at_current("Expected 'case' or 'default' in switch.");
+            break;
+        }
+        consume(TOKEN_COLON, "Expected ':' after the case.");
+
+        cases.body_start[cases.body_count] = current_chunk()->count;
+        begin_scope();
+        while(!check(TOKEN_CASE) && !check(TOKEN_DEFAULT) &&
+            !check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)){
+            declaration();
+        }
+        end_scope();
+        cases.exits[cases.exit_count++] = emit_jump(OP_JUMP);
+        cases.body_count++;
+    }
+    consume(TOKEN_RIGHT_BRACE, "Expected '}' after the switch cases.");
+
+    patch_jump(dispatch);
+#ifdef JUMP_TABLES
+    if(cases.case_count >= JUMP_TABLE_MIN){
+        emit_jump_table(&cases, slot);
+    }else{
+        emit_case_chain(&cases, slot);
+    }
+#else
+    emit_case_chain(&cases, slot);
+#endif
+
+    for (int i = 0; i < cases.exit_count; i++) patch_jump(cases.exits[i]);
+    end_scope();
+}
+
+static void function_body(){
     begin_scope();
 
     consume(TOKEN_LEFT_PAREN,"Expect '(' after function name.");
 
-    if(!check(TOKEN_LEFT_PAREN)){
+    if(!check(TOKEN_RIGHT_PAREN)){
         do{
             current->function->arity ++;
             if(current->function->arity > 255){
@@ -685,23 +1959,203 @@ static void function(FunctionType type){
     consume(TOKEN_RIGHT_PAREN,"Expect ')' after function name.");
     consume(TOKEN_LEFT_BRACE,"Expect '{' after function name.");
     block();
+}
 
-    ObjFunction* function = end_compiler();
+#ifdef LAZY_COMPILE
+/*
+    only counts the parameters and walks the body matching braces,
+    the text from '(' to the closing '}' is kept on the function and
+    compiled by compile_function_body() the first time it's called
+*/
+static ObjFunction* lazy_function(){
+    ObjFunction* function = new_function();
+    function->name = copy_string(parser.previous.start, parser.previous.length);
+    const char* start = parser.current.start;
+    function->source_line = parser.current.line;
+    /*a const declared after it is still a global to its body*/
+    function->visible_constants = global_constants.names.count;
+
+    consume(TOKEN_LEFT_PAREN,"Expect '(' after function name.");
+    if(!check(TOKEN_RIGHT_PAREN)){
+        do{
+            function->arity++;
+            if(function->arity > 255){
+                error_at_current("Too many parameters. The number of parameters can not exceed 255.");
+            }
+            consume(TOKEN_IDENTIFIER, "Expected a parameter name.");
+        } while (match(TOKEN_COMMA));
+    }
+
+    consume(TOKEN_RIGHT_PAREN,"Expect ')' after function name.");
+    consume(TOKEN_LEFT_BRACE,"Expect '{' after function name.");
+
+    int depth = 1;
+    while(depth > 0 && !check(TOKEN_EOF)){
+        if(check(TOKEN_LEFT_BRACE)) depth++;
+        if(check(TOKEN_RIGHT_BRACE)) depth--;
+        advance();
+    }
+
+    if(depth > 0){
+        error_at_current("Expected '}' after block statement.");
+        return function;
+    }
+
+    const char* end = parser.previous.start + parser.previous.length;
+    function->source = copy_string(start, (int)(end - start));
     emit_bytes(OP_CONSTANT, make_constant(OBJ_VAL(function)));
+    return function;
+}
+#endif
+
+static ObjFunction* function(FunctionType type){
+#ifdef LAZY_COMPILE
+    /*
+        only global functions are deferred, their bodies can't see
+        anything but their own locals and globals so they compile
+        the same whenever we get to them
+    */
+    if(type == TYPE_FUNCTION && current->type == TYPE_SCRIPT && current->scope_depth == 0){
+        return lazy_function();
+    }
+#endif
+    Compiler compiler;
+    init_compiler(&compiler, type, NULL);
+    function_body();
+
+    ObjFunction* function = end_compiler();
+    if(function->upvalue_count == 0){
+        emit_bytes(OP_CONSTANT, make_constant(OBJ_VAL(function)));
+        return function;
+    }
+
+    emit_bytes(OP_CLOSURE, make_constant(OBJ_VAL(function)));
+    for (int i = 0; i < function->upvalue_count; i++){
+        Upvalue* upvalue = &compiler.upvalues[i];
+        if(upvalue->is_local) add_capture(upvalue->index);
+        emit_byte(upvalue->is_local ? CAPTURE_LOCAL : CAPTURE_UPVALUE);
+        emit_byte(upvalue->index);
+    }
+    return function;
+}
+
+bool compile_function_body(ObjFunction* function){
+    if(function->source == NULL) return true;
+
+    init_scanner_at(function->source->chars, function->source_line);
+    Compiler compiler;
+    init_compiler(&compiler, TYPE_FUNCTION, function);
+    int arity = function->arity;
+    function->arity = 0;
+    int visible = global_constants.visible;
+    global_constants.visible = function->visible_constants;
+
+    parser.had_error = false;
+    parser.panic_mode = false;
+
+    advance();
+    function_body();
+    end_compiler();
+    global_constants.visible = visible;
+
+    if(parser.had_error){
+        /*the half emitted chunk never runs, every call reports the error again*/
+        free_chunk(&function->chunk);
+        function->arity = arity;
+        return false;
+    }
+    function->source = NULL;
+    return true;
 }
 
 static void fun_declaration(){
     uint8_t global = parse_variable("Expect function name");
     mark_initialized();
-    function(TYPE_FUNCTION);
+    ObjFunction* compiled = function(TYPE_FUNCTION);
+    /*
+        a closure that calls itself captured its own slot before
+        there was anything in it, it can't be copied
+    */
+    if(current->scope_depth > 0){
+        Local* local = &current->locals[current->local_count - 1];
+        if(local->captured) local->assigned = true;
+    }
     define_variable(global);
+
+#ifdef INLINE_CALLS
+    if(inliner.whole_program && current->type == TYPE_SCRIPT && current->scope_depth == 0 &&
+        !parser.had_error){
+        ObjString* name = AS_STRING(current_chunk()->constants.values[global]);
+        Value redefined;
+        if(!table_get(&global_names.redefined, name, &redefined) && can_inline(compiled)){
+            table_set(&inliner.functions, name, OBJ_VAL(compiled));
+        }
+    }
+#else
+    (void)compiled;
+#endif
+}
+
+static void method(){
+    consume(TOKEN_IDENTIFIER, "Expected method name.");
+    uint8_t name = identifier_constant(&parser.previous);
+
+    FunctionType type = TYPE_METHOD;
+    if(parser.previous.length == 4 && memcmp(parser.previous.start, "init", 4) == 0){
+        type = TYPE_INITIALIZER;
+    }
+    function(type);
+    emit_bytes(OP_METHOD, name);
+}
+
+static void class_declaration(){
+    uint8_t global = parse_variable("Expected class name.");
+    Token class_name = parser.previous;
+    emit_bytes(OP_CLASS, identifier_constant(&class_name));
+    define_variable(global);
+
+    ClassCompiler class_compiler;
+    class_compiler.enclosing = current_class;
+    class_compiler.has_superclass = false;
+    current_class = &class_compiler;
+
+    if(match(TOKEN_LESS)){
+        consume(TOKEN_IDENTIFIER, "Expected superclass name.");
+        variable(false);
+        if(identifiers_equal(&class_name, &parser.previous)){
+            error("A class can not inherit from itself.");
+        }
+
+        begin_scope();
+        add_local(synthetic_token("super"));
+        define_variable(0);
+
+        named_variable(class_name, false);
+        emit_byte(OP_INHERIT);
+        class_compiler.has_superclass = true;
+    }
+
+    named_variable(class_name, false);
+    consume(TOKEN_LEFT_BRACE, "Expected '{' before class body.");
+    while(!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)){
+        method();
+    }
+    consume(TOKEN_RIGHT_BRACE, "Expected '}' after class body.");
+    emit_byte(OP_POP);
+
+    if(class_compiler.has_superclass) end_scope();
+    current_class = current_class->enclosing;
 }
 
 static void declaration(){
-    if(match(TOKEN_FUN)){
+    if(match(TOKEN_CLASS)){
+        class_declaration();
+    }else if(match(TOKEN_FUN)){
         fun_declaration();
     }else if(match(TOKEN_VAR)){
         var_declaration();
+    }else if(match(TOKEN_CONST)){
+        const_declaration();
     }else{
         statement();
     }
@@ -710,7 +2164,7 @@ static void declaration(){
 }
 
 static void block(){
-    while(!match(TOKEN_RIGHT_BRACE) && !match(EOF)){
+    while(!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)){
         declaration();
     }
 
@@ -727,6 +2181,9 @@ static void return_statement(){
         return;
     }
 
+    if(current->type == TYPE_INITIALIZER){
+        error("Can not return a value from an initializer.");
+    }
     expression();
     consume(TOKEN_SEMICOLON,"Expected ';' after the return statement.");
     emit_byte(OP_RETURN);
@@ -748,6 +2205,9 @@ static void statement(){
     }else if(match(TOKEN_IF)){
         if_statement();
 
+    }else if(match(TOKEN_SWITCH)){
+        switch_statement();
+
     }else if(match(TOKEN_RETURN)){
         return_statement();
     }
@@ -766,9 +2226,11 @@ static void synchronize(){
             case TOKEN_CLASS:
             case TOKEN_FUN:
             case TOKEN_VAR:
+            case TOKEN_CONST:
             case TOKEN_FOR:
             case TOKEN_IF:
             case TOKEN_WHILE:
+            case TOKEN_SWITCH:
             case TOKEN_PRINT:
             case TOKEN_RETURN:
             default:
@@ -1,10 +1,23 @@
 #include <stdio.h>
 #include "debug.h"
+#include "object.h"
+#include "registers.h"
 #include "value.h"
+#include "vm.h"
 
+static void print_offset(Chunk* chunk, int offset);
 static int simple_instruction(const char* name, int offset);
 static int constant_instruction(const char* name, Chunk* chunk, int offset);
 static int byte_instruction(const char* name, Chunk* chunk, int offset);
+static int jump_instruction(const char* name, int sign, Chunk* chunk, int offset);
+static int call_global_instruction(const char* name, Chunk* chunk, int offset);
+static int for_loop_instruction(const char* name, Chunk* chunk, int offset);
+static int switch_instruction(const char* name, Chunk* chunk, int offset);
+static int closure_instruction(const char* name, Chunk* chunk, int offset);
+static int invoke_instruction(const char* name, Chunk* chunk, int offset);
+static int register_instruction(const char* name, Chunk* chunk, int offset, int operands);
+static int register_constant_instruction(const char* name, Chunk* chunk, int offset, int operands);
+static int register_jump_instruction(const char* name, int sign, Chunk* chunk, int offset, int operands);
 
 /*
     assembling is when we get human readable instructions like 
@@ -14,7 +27,7 @@ static int byte_instruction(const char* name, Chunk* chunk, int offset);
     back to a readable format
 */
 void disassemble_chunk(Chunk* chunk, const char* name){
-    printf("== %s ==\n",name);
+    output_format(&vm.output, "== %s ==\n",name);
 
     for (int offset = 0; offset < chunk->count;)
     {
@@ -22,15 +35,20 @@ void disassemble_chunk(Chunk* chunk, const char* name){
     }
 }
 
-int disassemble_instruction(Chunk* chunk, int offset){
-    printf("%04d ",offset);
+static void print_offset(Chunk* chunk, int offset){
+    output_format(&vm.output, "%04d ",offset);
 
     /*if the instruction before is on the same line*/
-    if(offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]){
-        printf("    | ");
+    int line = get_line(chunk, offset);
+    if(offset > 0 && line == get_line(chunk, offset - 1)){
+        output_format(&vm.output, "    | ");
     }else{
-        printf("%4d ",chunk->lines[offset]);
+        output_format(&vm.output, "%4d ",LINE_NUMBER(line));
     }
+}
+
+int disassemble_instruction(Chunk* chunk, int offset){
+    print_offset(chunk, offset);
 
     uint8_t instruction = chunk->code[offset];
     switch (instruction)
@@ -76,6 +94,15 @@ int disassemble_instruction(Chunk* chunk, int offset){
 
         case OP_LESS:
             return simple_instruction("OP_LESS", offset);
+
+        case OP_NOT_EQUAL:
+            return simple_instruction("OP_NOT_EQUAL", offset);
+
+        case OP_GREATER_EQUAL:
+            return simple_instruction("OP_GREATER_EQUAL", offset);
+
+        case OP_LESS_EQUAL:
+            return simple_instruction("OP_LESS_EQUAL", offset);
         
         case OP_PRINT:
             return simple_instruction("OP_PRINT", offset);
@@ -100,23 +127,203 @@ int disassemble_instruction(Chunk* chunk, int offset){
 
         case OP_CALL:
             return byte_instruction("OP_CALL", chunk, offset);
+
+        case OP_JUMP:
+            return jump_instruction("OP_JUMP", 1, chunk, offset);
+
+        case OP_JUMP_IF_FALSE:
+            return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+
+        case OP_LOOP:
+            return jump_instruction("OP_LOOP", -1, chunk, offset);
+
+        case OP_ADD_NUMBER:
+            return simple_instruction("OP_ADD_NUMBER", offset);
+
+        case OP_SUBTRACT_NUMBER:
+            return simple_instruction("OP_SUBTRACT_NUMBER", offset);
+
+        case OP_MULTIPLY_NUMBER:
+            return simple_instruction("OP_MULTIPLY_NUMBER", offset);
+
+        case OP_DIVIDE_NUMBER:
+            return simple_instruction("OP_DIVIDE_NUMBER", offset);
+
+        case OP_GREATER_NUMBER:
+            return simple_instruction("OP_GREATER_NUMBER", offset);
+
+        case OP_GREATER_EQUAL_NUMBER:
+            return simple_instruction("OP_GREATER_EQUAL_NUMBER", offset);
+
+        case OP_LESS_NUMBER:
+            return simple_instruction("OP_LESS_NUMBER", offset);
+
+        case OP_LESS_EQUAL_NUMBER:
+            return simple_instruction("OP_LESS_EQUAL_NUMBER", offset);
+
+        case OP_JUMP_IF_NOT_LESS:
+            return jump_instruction("OP_JUMP_IF_NOT_LESS", 1, chunk, offset);
+
+        case OP_CALL_GLOBAL:
+            return call_global_instruction("OP_CALL_GLOBAL", chunk, offset);
+
+        case OP_FOR_LOOP:
+            return for_loop_instruction("OP_FOR_LOOP", chunk, offset);
+
+        case OP_FOR_LOOP_K:
+            return for_loop_instruction("OP_FOR_LOOP_K", chunk, offset);
+
+        case OP_ADD_LOCAL:
+            return byte_instruction("OP_ADD_LOCAL", chunk, offset);
+
+        case OP_SUBTRACT_LOCAL:
+            return byte_instruction("OP_SUBTRACT_LOCAL", chunk, offset);
+
+        case OP_MULTIPLY_LOCAL:
+            return byte_instruction("OP_MULTIPLY_LOCAL", chunk, offset);
+
+        case OP_DIVIDE_LOCAL:
+            return byte_instruction("OP_DIVIDE_LOCAL", chunk, offset);
+
+        case OP_ADD_GLOBAL:
+            return constant_instruction("OP_ADD_GLOBAL", chunk, offset);
+
+        case OP_SUBTRACT_GLOBAL:
+            return constant_instruction("OP_SUBTRACT_GLOBAL", chunk, offset);
+
+        case OP_MULTIPLY_GLOBAL:
+            return constant_instruction("OP_MULTIPLY_GLOBAL", chunk, offset);
+
+        case OP_DIVIDE_GLOBAL:
+            return constant_instruction("OP_DIVIDE_GLOBAL", chunk, offset);
+
+        case OP_SWITCH:
+            return switch_instruction("OP_SWITCH", chunk, offset);
+
+        case OP_SWITCH_HASH:
+            return switch_instruction("OP_SWITCH_HASH", chunk, offset);
+
+        case OP_CLOSURE:
+            return closure_instruction("OP_CLOSURE", chunk, offset);
+
+        case OP_GET_UPVALUE:
+            return byte_instruction("OP_GET_UPVALUE", chunk, offset);
+
+        case OP_SET_UPVALUE:
+            return byte_instruction("OP_SET_UPVALUE", chunk, offset);
+
+        case OP_CLOSE_UPVALUE:
+            return simple_instruction("OP_CLOSE_UPVALUE", offset);
+
+        case OP_ADD_UPVALUE:
+            return byte_instruction("OP_ADD_UPVALUE", chunk, offset);
+
+        case OP_SUBTRACT_UPVALUE:
+            return byte_instruction("OP_SUBTRACT_UPVALUE", chunk, offset);
+
+        case OP_MULTIPLY_UPVALUE:
+            return byte_instruction("OP_MULTIPLY_UPVALUE", chunk, offset);
+
+        case OP_DIVIDE_UPVALUE:
+            return byte_instruction("OP_DIVIDE_UPVALUE", chunk, offset);
+
+        case OP_CLASS:
+            return constant_instruction("OP_CLASS", chunk, offset);
+
+        case OP_INHERIT:
+            return simple_instruction("OP_INHERIT", offset);
+
+        case OP_METHOD:
+            return constant_instruction("OP_METHOD", chunk, offset);
+
+        case OP_GET_PROPERTY:
+            return constant_instruction("OP_GET_PROPERTY", chunk, offset);
+
+        case OP_SET_PROPERTY:
+            return constant_instruction("OP_SET_PROPERTY", chunk, offset);
+
+        case OP_INVOKE:
+            return invoke_instruction("OP_INVOKE", chunk, offset);
+
+        case OP_GET_SUPER:
+            return constant_instruction("OP_GET_SUPER", chunk, offset);
+
+        case OP_SUPER_INVOKE:
+            return invoke_instruction("OP_SUPER_INVOKE", chunk, offset);
+
+        case OP_ADD_PROPERTY:
+            return constant_instruction("OP_ADD_PROPERTY", chunk, offset);
+
+        case OP_SUBTRACT_PROPERTY:
+            return constant_instruction("OP_SUBTRACT_PROPERTY", chunk, offset);
+
+        case OP_MULTIPLY_PROPERTY:
+            return constant_instruction("OP_MULTIPLY_PROPERTY", chunk, offset);
+
+        case OP_DIVIDE_PROPERTY:
+            return constant_instruction("OP_DIVIDE_PROPERTY", chunk, offset);
+
+        case OP_ARRAY:
+            return byte_instruction("OP_ARRAY", chunk, offset);
+
+        case OP_MAP:
+            return byte_instruction("OP_MAP", chunk, offset);
+
+        case OP_GET_INDEX:
+            return simple_instruction("OP_GET_INDEX", offset);
+
+        case OP_SET_INDEX:
+            return simple_instruction("OP_SET_INDEX", offset);
+
+        case OP_ADD_INDEX:
+            return simple_instruction("OP_ADD_INDEX", offset);
+
+        case OP_SUBTRACT_INDEX:
+            return simple_instruction("OP_SUBTRACT_INDEX", offset);
+
+        case OP_MULTIPLY_INDEX:
+            return simple_instruction("OP_MULTIPLY_INDEX", offset);
+
+        case OP_DIVIDE_INDEX:
+            return simple_instruction("OP_DIVIDE_INDEX", offset);
+
+        case OP_SQRT:
+            return simple_instruction("OP_SQRT", offset);
+
+        case OP_FLOOR:
+            return simple_instruction("OP_FLOOR", offset);
+
+        case OP_ABS:
+            return simple_instruction("OP_ABS", offset);
+
+        case OP_MIN:
+            return simple_instruction("OP_MIN", offset);
+
+        case OP_MAX:
+            return simple_instruction("OP_MAX", offset);
+
+        case OP_LEN:
+            return simple_instruction("OP_LEN", offset);
+
+        case OP_CONCAT_N:
+            return byte_instruction("OP_CONCAT_N", chunk, offset);
             
         default:
-            printf("Unknown instruction %d\n", instruction);
-            break;
+            output_format(&vm.output, "Unknown instruction %d\n", instruction);
+            return offset + 1;
     }
 }
 
 static int simple_instruction(const char* name, int offset){
-    printf("%s\n",name);
+    output_format(&vm.output, "%s\n",name);
     return offset + 1;
 }
 
 static int constant_instruction(const char* name, Chunk* chunk, int offset){
     uint8_t constant = chunk->code[offset + 1];
-    printf("%-16s %4d '", name, constant);
+    output_format(&vm.output, "%-16s %4d '", name, constant);
     print_value(chunk->constants.values[constant]);
-    printf("'\n");
+    output_format(&vm.output, "'\n");
     /*this is because 
         unlike OP_RETURN(1 byte), OP_CONSTANT is 2 bytes long
         [1 for the opcode, other for the operand]
@@ -126,6 +333,169 @@ static int constant_instruction(const char* name, Chunk* chunk, int offset){
 
 static int byte_instruction(const char* name, Chunk* chunk, int offset){
     uint8_t slot = chunk->code[offset + 1];
-    printf("%-16s %4d\n",name, slot);
+    output_format(&vm.output, "%-16s %4d\n",name, slot);
     return offset +2;
-}
\ No newline at end of file
+}
+
+static int jump_instruction(const char* name, int sign, Chunk* chunk, int offset){
+    uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
+    jump |= chunk->code[offset + 2];
+    output_format(&vm.output, "%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+    return offset + 3;
+}
+
+static int call_global_instruction(const char* name, Chunk* chunk, int offset){
+    uint8_t arg_count = chunk->code[offset + 1];
+    uint8_t constant = chunk->code[offset + 2];
+    output_format(&vm.output, "%-16s %4d %4d '", name, arg_count, constant);
+    print_value(chunk->constants.values[constant]);
+    output_format(&vm.output, "'\n");
+    return offset + 3;
+}
+
+/*counter slot, bound slot or constant, step constant, then where it exits to*/
+static int for_loop_instruction(const char* name, Chunk* chunk, int offset){
+    uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
+    jump |= chunk->code[offset + 2];
+    output_format(&vm.output, "%-16s %4d %4d %4d '", name, chunk->code[offset + 3],
+        chunk->code[offset + 4], chunk->code[offset + 5]);
+    print_value(chunk->constants.values[chunk->code[offset + 5]]);
+    output_format(&vm.output, "' -> %d\n", offset + 3 + jump);
+    return offset + 6;
+}
+
+/*the first case's constant and how many entries the table has besides the default*/
+static int switch_instruction(const char* name, Chunk* chunk, int offset){
+    uint8_t constant = chunk->code[offset + 1];
+    output_format(&vm.output, "%-16s %4d '", name, constant);
+    print_value(chunk->constants.values[constant]);
+    output_format(&vm.output, "' %d\n", chunk->code[offset + 2]);
+    return offset + 3;
+}
+
+/*the method name's constant, then the argument count*/
+static int invoke_instruction(const char* name, Chunk* chunk, int offset){
+    uint8_t constant = chunk->code[offset + 1];
+    uint8_t arg_count = chunk->code[offset + 2];
+    output_format(&vm.output, "%-16s (%d args) %4d '", name, arg_count, constant);
+    print_value(chunk->constants.values[constant]);
+    output_format(&vm.output, "'\n");
+    return offset + 3;
+}
+
+/*every upvalue gets a line of its own under the closure*/
+static int closure_instruction(const char* name, Chunk* chunk, int offset){
+    static const char* kinds[] = {"upvalue", "local", "copy"};
+    uint8_t constant = chunk->code[offset + 1];
+    output_format(&vm.output, "%-16s %4d ", name, constant);
+    print_value(chunk->constants.values[constant]);
+    output_format(&vm.output, "\n");
+
+    ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
+    offset += 2;
+    for (int i = 0; i < function->upvalue_count; i++){
+        uint8_t kind = chunk->code[offset];
+        uint8_t index = chunk->code[offset + 1];
+        output_format(&vm.output, "%04d      |                     %s %d\n", offset, kinds[kind], index);
+        offset += 2;
+    }
+    return offset;
+}
+
+/*
+    register code from register_code(), operands are printed in
+    the order they're encoded, A first
+*/
+void disassemble_registers(Chunk* chunk, const char* name){
+    output_format(&vm.output, "== %s (registers) ==\n",name);
+
+    for (int offset = 0; offset < chunk->count;)
+    {
+        offset = disassemble_register_instruction(chunk, offset);
+    }
+}
+
+int disassemble_register_instruction(Chunk* chunk, int offset){
+    print_offset(chunk, offset);
+
+    uint8_t instruction = chunk->code[offset];
+    switch (instruction)
+    {
+        case REG_MOVE: return register_instruction("REG_MOVE", chunk, offset, 2);
+        case REG_CONSTANT: return register_constant_instruction("REG_CONSTANT", chunk, offset, 1);
+        case REG_NIL: return register_instruction("REG_NIL", chunk, offset, 1);
+        case REG_TRUE: return register_instruction("REG_TRUE", chunk, offset, 1);
+        case REG_FALSE: return register_instruction("REG_FALSE", chunk, offset, 1);
+        case REG_EQUAL: return register_instruction("REG_EQUAL", chunk, offset, 3);
+        case REG_NOT_EQUAL: return register_instruction("REG_NOT_EQUAL", chunk, offset, 3);
+        case REG_GREATER: return register_instruction("REG_GREATER", chunk, offset, 3);
+        case REG_GREATER_EQUAL: return register_instruction("REG_GREATER_EQUAL", chunk, offset, 3);
+        case REG_LESS: return register_instruction("REG_LESS", chunk, offset, 3);
+        case REG_LESS_EQUAL: return register_instruction("REG_LESS_EQUAL", chunk, offset, 3);
+        case REG_ADD: return register_instruction("REG_ADD", chunk, offset, 3);
+        case REG_SUBTRACT: return register_instruction("REG_SUBTRACT", chunk, offset, 3);
+        case REG_MULTIPLY: return register_instruction("REG_MULTIPLY", chunk, offset, 3);
+        case REG_DIVIDE: return register_instruction("REG_DIVIDE", chunk, offset, 3);
+        case REG_EQUAL_K: return register_constant_instruction("REG_EQUAL_K", chunk, offset, 2);
+        case REG_NOT_EQUAL_K: return register_constant_instruction("REG_NOT_EQUAL_K", chunk, offset, 2);
+        case REG_GREATER_K: return register_constant_instruction("REG_GREATER_K", chunk, offset, 2);
+        case REG_GREATER_EQUAL_K: return register_constant_instruction("REG_GREATER_EQUAL_K", chunk, offset, 2);
+        case REG_LESS_K: return register_constant_instruction("REG_LESS_K", chunk, offset, 2);
+        case REG_LESS_EQUAL_K: return register_constant_instruction("REG_LESS_EQUAL_K", chunk, offset, 2);
+        case REG_ADD_K: return register_constant_instruction("REG_ADD_K", chunk, offset, 2);
+        case REG_SUBTRACT_K: return register_constant_instruction("REG_SUBTRACT_K", chunk, offset, 2);
+        case REG_MULTIPLY_K: return register_constant_instruction("REG_MULTIPLY_K", chunk, offset, 2);
+        case REG_DIVIDE_K: return register_constant_instruction("REG_DIVIDE_K", chunk, offset, 2);
+        case REG_NOT: return register_instruction("REG_NOT", chunk, offset, 2);
+        case REG_NEGATE: return register_instruction("REG_NEGATE", chunk, offset, 2);
+        case REG_PRINT: return register_instruction("REG_PRINT", chunk, offset, 1);
+        case REG_GET_GLOBAL: return register_constant_instruction("REG_GET_GLOBAL", chunk, offset, 1);
+        case REG_SET_GLOBAL: return register_constant_instruction("REG_SET_GLOBAL", chunk, offset, 1);
+        case REG_DEFINE_GLOBAL: return register_constant_instruction("REG_DEFINE_GLOBAL", chunk, offset, 1);
+        case REG_ADD_GLOBAL: return register_constant_instruction("REG_ADD_GLOBAL", chunk, offset, 1);
+        case REG_SUBTRACT_GLOBAL: return register_constant_instruction("REG_SUBTRACT_GLOBAL", chunk, offset, 1);
+        case REG_MULTIPLY_GLOBAL: return register_constant_instruction("REG_MULTIPLY_GLOBAL", chunk, offset, 1);
+        case REG_DIVIDE_GLOBAL: return register_constant_instruction("REG_DIVIDE_GLOBAL", chunk, offset, 1);
+        case REG_JUMP: return register_jump_instruction("REG_JUMP", 1, chunk, offset, 0);
+        case REG_JUMP_IF_FALSE: return register_jump_instruction("REG_JUMP_IF_FALSE", 1, chunk, offset, 1);
+        case REG_LOOP: return register_jump_instruction("REG_LOOP", -1, chunk, offset, 0);
+        case REG_CALL: return register_instruction("REG_CALL", chunk, offset, 2);
+        case REG_CALL_GLOBAL: return register_constant_instruction("REG_CALL_GLOBAL", chunk, offset, 2);
+        case REG_RETURN: return register_instruction("REG_RETURN", chunk, offset, 1);
+        default:
+            output_format(&vm.output, "Unknown instruction %d\n", instruction);
+            return offset + 1;
+    }
+}
+
+static void print_registers(Chunk* chunk, int offset, int operands){
+    for (int i = 1; i <= operands; i++) output_format(&vm.output, " %4d", chunk->code[offset + i]);
+}
+
+static int register_instruction(const char* name, Chunk* chunk, int offset, int operands){
+    output_format(&vm.output, "%-20s", name);
+    print_registers(chunk, offset, operands);
+    output_format(&vm.output, "\n");
+    return offset + 1 + operands;
+}
+
+/*the constant is always the last operand*/
+static int register_constant_instruction(const char* name, Chunk* chunk, int offset, int operands){
+    uint8_t constant = chunk->code[offset + operands + 1];
+    output_format(&vm.output, "%-20s", name);
+    print_registers(chunk, offset, operands);
+    output_format(&vm.output, " %4d '", constant);
+    print_value(chunk->constants.values[constant]);
+    output_format(&vm.output, "'\n");
+    return offset + operands + 2;
+}
+
+static int register_jump_instruction(const char* name, int sign, Chunk* chunk, int offset, int operands){
+    int at = offset + 1 + operands;
+    uint16_t jump = (uint16_t)(chunk->code[at] << 8);
+    jump |= chunk->code[at + 1];
+    output_format(&vm.output, "%-20s", name);
+    print_registers(chunk, offset, operands);
+    output_format(&vm.output, " %4d -> %d\n", offset, at + 2 + sign * jump);
+    return at + 2;
+}
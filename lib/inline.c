@@ -0,0 +1,331 @@
+#include <stdlib.h>
+
+#include "common.h"
+#include "chunk.h"
+#include "inline.h"
+#include "listing.h"
+#include "memory.h"
+
+/*a jump whose offset gets filled in once `target` has a label*/
+typedef struct{
+    int at;
+    int target;
+} Patch;
+
+typedef struct{
+    Patch* patches;
+    int count;
+    int capacity;
+} Patches;
+
+static void add_patch(Patches* patches, int at, int target){
+    if(patches->capacity < patches->count + 1){
+        int old_capacity = patches->capacity;
+        patches->capacity = GROW_CAPACITY(old_capacity);
+        patches->patches = GROW_ARRAY(Patch, patches->patches, old_capacity, patches->capacity);
+    }
+    patches->patches[patches->count].at = at;
+    patches->patches[patches->count].target = target;
+    patches->count++;
+}
+
+/*jumps keep their direction from where they land, conditional ones can't go back*/
+static bool patch_jumps(Chunk* code, Patches* patches, int* label){
+    bool valid = true;
+    for (int i = 0; i < patches->count; i++){
+        int at = patches->patches[i].at;
+        int jump = label[patches->patches[i].target] - (at + 3);
+        uint8_t opcode = code->code[at];
+
+        if(is_conditional(opcode)){
+            if(jump < 0) valid = false;
+        }else{
+            opcode = jump < 0 ? OP_LOOP : OP_JUMP;
+        }
+        if(jump < 0) jump = -jump;
+        if(jump > UINT16_MAX) valid = false;
+
+        code->code[at] = opcode;
+        code->code[at + 1] = (jump >> 8) & 0xff;
+        code->code[at + 2] = jump & 0xff;
+    }
+
+    FREE_ARRAY(Patch, patches->patches, patches->capacity);
+    return valid;
+}
+
+static void write_jump(Chunk* code, Patches* patches, uint8_t opcode, int target, int line){
+    add_patch(patches, code->count, target);
+    write_chunk(code, opcode, line);
+    write_chunk(code, 0xff, line);
+    write_chunk(code, 0xff, line);
+}
+
+/*the callee's own lines go to `frame`, the ones it inlined to the copies after it*/
+static int inlined_line(int line, int frame){
+    return LINE_NUMBER(line) | ((frame + LINE_FRAME(line)) << LINE_FRAME_SHIFT);
+}
+
+/*
+    a frame for the call to `callee` at `line`, followed by copies of
+    the frames inlined into the callee itself. returns the new frame's
+    number, a line of the body goes through inlined_line() with it
+*/
+static int add_frames(ObjFunction* caller, ObjFunction* callee, int line){
+    int needed = caller->inline_frame_count + 1 + callee->inline_frame_count;
+    if(caller->inline_frame_capacity < needed){
+        int old_capacity = caller->inline_frame_capacity;
+        while(caller->inline_frame_capacity < needed){
+            caller->inline_frame_capacity = GROW_CAPACITY(caller->inline_frame_capacity);
+        }
+        caller->inline_frames = GROW_ARRAY(InlineFrame, caller->inline_frames,
+            old_capacity, caller->inline_frame_capacity);
+    }
+
+    int frame = caller->inline_frame_count + 1;
+    InlineFrame* frames = caller->inline_frames;
+    frames[frame - 1].name = callee->name;
+    frames[frame - 1].line = line;
+    for (int i = 0; i < callee->inline_frame_count; i++){
+        frames[frame + i].name = callee->inline_frames[i].name;
+        frames[frame + i].line = inlined_line(callee->inline_frames[i].line, frame);
+    }
+    caller->inline_frame_count = needed;
+    return frame;
+}
+
+/*the deepest the function's own stack gets, -1 if we can't tell*/
+static int frame_depth(ObjFunction* function){
+    Listing listing;
+    init_listing(&listing, &function->chunk);
+    int* depth = ALLOCATE(int, listing.count);
+    int deepest = stack_depths(&listing, function->arity + 1, depth);
+    FREE_ARRAY(int, depth, listing.count);
+    free_listing(&listing);
+    return deepest;
+}
+
+/*
+    small bodies that never call anything, methods included, that
+    way a body can't end up inlined into itself. a hashed switch needs
+    its cases in consecutive constants, which the copied constants
+    aren't. closures capture slots by number and are left alone too
+*/
+bool can_inline(ObjFunction* function){
+    Chunk* chunk = &function->chunk;
+    if(function->source != NULL || chunk->count > INLINE_BUDGET) return false;
+
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset)){
+        uint8_t opcode = chunk->code[offset];
+        if(opcode == OP_CALL || opcode == OP_CALL_GLOBAL || opcode == OP_SWITCH_HASH ||
+            opcode == OP_CLOSURE || opcode == OP_INVOKE || opcode == OP_SUPER_INVOKE){
+            return false;
+        }
+    }
+    return frame_depth(function) != -1;
+}
+
+/*
+    copies the body in with its slots moved up to `base`, every
+    RETURN leaves its value where the function itself sat, drops the
+    rest of the frame and jumps past the body. the code keeps the
+    body's own lines under `frame` so errors in it still show the call
+*/
+static bool emit_body(Chunk* code, CallSite* site, int base, int frame){
+    ObjFunction* function = site->function;
+    Chunk* body = &function->chunk;
+    Listing listing;
+    init_listing(&listing, body);
+    int* depth = ALLOCATE(int, listing.count);
+    int* label = ALLOCATE(int, listing.count + 1);
+    Patches patches = {NULL, 0, 0};
+    bool valid = stack_depths(&listing, function->arity + 1, depth) != -1;
+
+    int last = listing.count - 1;
+    while(last >= 0 && depth[last] == -1) last--;
+
+    for (int i = 0; valid && i < listing.count; i++){
+        Instruction* instruction = &listing.code[i];
+        uint8_t* bytes = &body->code[instruction->offset];
+        int line = inlined_line(instruction->line, frame);
+        label[i] = code->count;
+        if(depth[i] == -1) continue;
+
+        switch (instruction->opcode){
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+            case OP_ADD_LOCAL:
+            case OP_SUBTRACT_LOCAL:
+            case OP_MULTIPLY_LOCAL:
+            case OP_DIVIDE_LOCAL:
+                write_chunk(code, bytes[0], line);
+                write_chunk(code, base + bytes[1], line);
+                break;
+            case OP_SWITCH:
+                write_chunk(code, bytes[0], line);
+                write_chunk(code, site->constants[bytes[1]], line);
+                write_chunk(code, bytes[2], line);
+                break;
+            case OP_CONSTANT:
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL:
+            case OP_DEFINE_GLOBAL:
+            case OP_ADD_GLOBAL:
+            case OP_SUBTRACT_GLOBAL:
+            case OP_MULTIPLY_GLOBAL:
+            case OP_DIVIDE_GLOBAL:
+            case OP_CLASS:
+            case OP_METHOD:
+            case OP_GET_PROPERTY:
+            case OP_SET_PROPERTY:
+            case OP_GET_SUPER:
+            case OP_ADD_PROPERTY:
+            case OP_SUBTRACT_PROPERTY:
+            case OP_MULTIPLY_PROPERTY:
+            case OP_DIVIDE_PROPERTY:
+                write_chunk(code, bytes[0], line);
+                write_chunk(code, site->constants[bytes[1]], line);
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_LOOP:
+            case OP_JUMP_IF_NOT_LESS:
+                write_jump(code, &patches, instruction->opcode, instruction->target, line);
+                break;
+            case OP_FOR_LOOP:
+            case OP_FOR_LOOP_K:
+                write_jump(code, &patches, instruction->opcode, instruction->target, line);
+                write_chunk(code, base + bytes[3], line);
+                write_chunk(code, instruction->opcode == OP_FOR_LOOP ?
+                    base + bytes[4] : site->constants[bytes[4]], line);
+                write_chunk(code, site->constants[bytes[5]], line);
+                break;
+            case OP_RETURN:
+                write_chunk(code, OP_SET_LOCAL, line);
+                write_chunk(code, base, line);
+                for (int j = 1; j < depth[i]; j++) write_chunk(code, OP_POP, line);
+                if(i != last) write_jump(code, &patches, OP_JUMP, listing.count, line);
+                break;
+            default:
+                for (int j = 0; j < instruction->length; j++) write_chunk(code, bytes[j], line);
+                break;
+        }
+    }
+    label[listing.count] = code->count;
+
+    valid = patch_jumps(code, &patches, label) && valid;
+
+    FREE_ARRAY(int, depth, listing.count);
+    FREE_ARRAY(int, label, listing.count + 1);
+    free_listing(&listing);
+    return valid;
+}
+
+static int find_instruction(Listing* listing, int offset){
+    int low = 0;
+    int high = listing->count - 1;
+    while(low <= high){
+        int middle = low + (high - low) / 2;
+        int at = listing->code[middle].offset;
+        if(at == offset) return middle;
+        if(at < offset) low = middle + 1;
+        else high = middle - 1;
+    }
+    return -1;
+}
+
+/*
+    replaces every call site with the body of the function it calls,
+    the function's slot is kept as a NIL so the body's locals sit at
+    the same distance from it as in a real frame. `entry` is the stack
+    depth the chunk starts at. returns how many calls were inlined,
+    the chunk is left alone if that's none
+*/
+int inline_calls(ObjFunction* function, int entry, CallSite* sites, int count){
+    if(count == 0) return 0;
+
+    Chunk* chunk = &function->chunk;
+    int first_frame = function->inline_frame_count;
+    int frame_count = first_frame;
+
+    Listing listing;
+    init_listing(&listing, chunk);
+    int* depth = ALLOCATE(int, listing.count);
+    int* site_of = ALLOCATE(int, listing.count);
+    int* label = ALLOCATE(int, listing.count + 1);
+    int inlined = 0;
+
+    if(stack_depths(&listing, entry, depth) != -1){
+        for (int i = 0; i < listing.count; i++) site_of[i] = -1;
+
+        for (int i = 0; i < count; i++){
+            int callee = find_instruction(&listing, sites[i].callee);
+            int call = find_instruction(&listing, sites[i].call);
+            if(callee == -1 || call == -1 || depth[callee] == -1 || depth[call] == -1) continue;
+            uint8_t opcode = listing.code[call].opcode;
+            if(listing.code[callee].opcode != OP_GET_GLOBAL) continue;
+            if(opcode != OP_CALL && opcode != OP_CALL_GLOBAL) continue;
+            if(depth[callee] + frame_depth(sites[i].function) > UINT8_COUNT) continue;
+            /*the frame numbers have to fit in the lines above the line itself*/
+            int frames = frame_count + 1 + sites[i].function->inline_frame_count;
+            if(frames > MAX_INLINE_FRAMES || LINE_FRAME(listing.code[call].line) != 0) continue;
+            frame_count = frames;
+
+            site_of[callee] = i;
+            site_of[call] = i;
+            inlined++;
+        }
+    }
+
+    if(inlined > 0){
+        Chunk code;
+        init_chunk(&code);
+        Patches patches = {NULL, 0, 0};
+        bool valid = true;
+
+        for (int i = 0; i < listing.count; i++){
+            Instruction* instruction = &listing.code[i];
+            uint8_t* bytes = &chunk->code[instruction->offset];
+            label[i] = code.count;
+
+            if(site_of[i] != -1 && instruction->opcode == OP_GET_GLOBAL){
+                /*the slot stays, nothing in the body reads it*/
+                write_chunk(&code, OP_NIL, instruction->line);
+            }else if(site_of[i] != -1){
+                int base = depth[i] - bytes[1] - 1;
+                CallSite* site = &sites[site_of[i]];
+                int frame = add_frames(function, site->function, instruction->line);
+                valid = emit_body(&code, site, base, frame) && valid;
+            }else if(instruction->target != -1){
+                write_jump(&code, &patches, instruction->opcode, instruction->target, instruction->line);
+                for (int j = 3; j < instruction->length; j++){
+                    write_chunk(&code, bytes[j], instruction->line);
+                }
+            }else{
+                for (int j = 0; j < instruction->length; j++){
+                    write_chunk(&code, bytes[j], instruction->line);
+                }
+            }
+        }
+        label[listing.count] = code.count;
+
+        valid = patch_jumps(&code, &patches, label) && valid;
+
+        if(valid){
+            code.constants = chunk->constants;
+            init_value_array(&chunk->constants);
+            free_chunk(chunk);
+            *chunk = code;
+        }else{
+            free_chunk(&code);
+            function->inline_frame_count = first_frame;
+            inlined = 0;
+        }
+    }
+
+    FREE_ARRAY(int, depth, listing.count);
+    FREE_ARRAY(int, site_of, listing.count);
+    FREE_ARRAY(int, label, listing.count + 1);
+    free_listing(&listing);
+    return inlined;
+}
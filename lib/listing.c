@@ -0,0 +1,307 @@
+#include <stdlib.h>
+
+#include "common.h"
+#include "chunk.h"
+#include "listing.h"
+#include "memory.h"
+
+static bool is_jump(uint8_t opcode){
+    return opcode == OP_JUMP || opcode == OP_LOOP || is_conditional(opcode);
+}
+
+/*conditional jumps only ever go forwards*/
+bool is_conditional(uint8_t opcode){
+    switch (opcode){
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_FOR_LOOP:
+        case OP_FOR_LOOP_K:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*the in-place updates whose operand is a local's slot*/
+bool updates_local(uint8_t opcode){
+    switch (opcode){
+        case OP_ADD_LOCAL:
+        case OP_SUBTRACT_LOCAL:
+        case OP_MULTIPLY_LOCAL:
+        case OP_DIVIDE_LOCAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void init_listing(Listing* listing, Chunk* chunk){
+    listing->chunk = chunk;
+    listing->count = 0;
+    listing->capacity = chunk->count;
+    listing->code = ALLOCATE(Instruction, chunk->count);
+    listing->bytes = NULL;
+    listing->byte_count = 0;
+    listing->byte_capacity = 0;
+
+    /*byte offset -> instruction index, the extra slot is the end of the chunk*/
+    int* index_of = ALLOCATE(int, chunk->count + 1);
+    for (int offset = 0; offset < chunk->count;){
+        Instruction* instruction = &listing->code[listing->count];
+        instruction->offset = offset;
+        instruction->length = instruction_length(chunk, offset);
+        instruction->line = get_line(chunk, offset);
+        instruction->opcode = chunk->code[offset];
+        instruction->target = -1;
+        instruction->removed = false;
+        instruction->is_target = false;
+        instruction->reachable = false;
+        instruction->in_table = false;
+        instruction->before_count = 0;
+        instruction->after_count = 0;
+        instruction->operands = -1;
+        index_of[offset] = listing->count++;
+        offset += instruction->length;
+    }
+    index_of[chunk->count] = listing->count;
+
+    for (int i = 0; i < listing->count; i++){
+        Instruction* instruction = &listing->code[i];
+        int entries = jump_table_size(&chunk->code[instruction->offset]);
+        for (int k = 1; k <= entries && i + k < listing->count; k++){
+            listing->code[i + k].in_table = true;
+        }
+        if(!is_jump(instruction->opcode)) continue;
+
+        uint8_t* code = &chunk->code[instruction->offset];
+        int jump = (code[1] << 8) | code[2];
+        int after = instruction->offset + 3;
+        instruction->target =
+            index_of[instruction->opcode == OP_LOOP ? after - jump : after + jump];
+    }
+
+    FREE_ARRAY(int, index_of, chunk->count + 1);
+}
+
+void free_listing(Listing* listing){
+    FREE_ARRAY(Instruction, listing->code, listing->capacity);
+    FREE_ARRAY(uint8_t, listing->bytes, listing->byte_capacity);
+    listing->code = NULL;
+    listing->bytes = NULL;
+}
+
+/*removed instructions still count when there's code spliced around them*/
+static bool is_present(Instruction* instruction){
+    return !instruction->removed ||
+        instruction->before_count > 0 || instruction->after_count > 0;
+}
+
+int next_live(Listing* listing, int index){
+    while(index < listing->count && !is_present(&listing->code[index])) index++;
+    return index;
+}
+
+/*
+    where a jump really lands, jumping onto removed code means
+    landing on whatever follows it
+*/
+int resolve(Listing* listing, int index){
+    return next_live(listing, listing->code[index].target);
+}
+
+static int append_bytes(Listing* listing, uint8_t* bytes, int count){
+    if(listing->byte_capacity < listing->byte_count + count){
+        int old_capacity = listing->byte_capacity;
+        int capacity = GROW_CAPACITY(old_capacity);
+        while(capacity < listing->byte_count + count) capacity *= 2;
+        listing->bytes = GROW_ARRAY(uint8_t, listing->bytes, old_capacity, capacity);
+        listing->byte_capacity = capacity;
+    }
+
+    int start = listing->byte_count;
+    for (int i = 0; i < count; i++) listing->bytes[start + i] = bytes[i];
+    listing->byte_count += count;
+    return start;
+}
+
+/*
+    spliced code must not jump, splicing twice onto the same
+    instruction replaces what was there
+*/
+void splice_before(Listing* listing, int index, uint8_t* bytes, int count){
+    Instruction* instruction = &listing->code[index];
+    instruction->before = append_bytes(listing, bytes, count);
+    instruction->before_count = count;
+}
+
+void splice_after(Listing* listing, int index, uint8_t* bytes, int count){
+    Instruction* instruction = &listing->code[index];
+    instruction->after = append_bytes(listing, bytes, count);
+    instruction->after_count = count;
+}
+
+/*
+    gives the instruction new operands, and the length that goes with
+    them. a jump's offset is still worked out from its target
+*/
+void replace_operands(Listing* listing, int index, uint8_t* bytes, int count){
+    Instruction* instruction = &listing->code[index];
+    instruction->operands = append_bytes(listing, bytes, count);
+    instruction->length = count + 1;
+}
+
+/*lays the listing back out as bytecode and swaps it into the chunk*/
+void rebuild_listing(Listing* listing){
+    Chunk* chunk = listing->chunk;
+    int* new_offset = ALLOCATE(int, listing->count + 1);
+
+    int offset = 0;
+    for (int i = 0; i < listing->count; i++){
+        Instruction* instruction = &listing->code[i];
+        new_offset[i] = offset;
+        offset += instruction->before_count + instruction->after_count;
+        if(!instruction->removed) offset += instruction->length;
+    }
+    new_offset[listing->count] = offset;
+
+    Chunk optimized;
+    init_chunk(&optimized);
+
+    for (int i = 0; i < listing->count; i++){
+        Instruction* instruction = &listing->code[i];
+
+        for (int j = 0; j < instruction->before_count; j++){
+            write_chunk(&optimized, listing->bytes[instruction->before + j], instruction->line);
+        }
+
+        if(!instruction->removed){
+            uint8_t opcode = instruction->opcode;
+            uint8_t* operands = instruction->operands != -1 ?
+                &listing->bytes[instruction->operands] : &chunk->code[instruction->offset + 1];
+
+            if(instruction->target != -1){
+                int at = new_offset[i] + instruction->before_count;
+                int target = new_offset[resolve(listing, i)];
+                int jump = target - (at + 3);
+                if(!is_conditional(opcode)) opcode = jump < 0 ? OP_LOOP : OP_JUMP;
+                if(jump < 0) jump = -jump;
+
+                write_chunk(&optimized, opcode, instruction->line);
+                write_chunk(&optimized, (jump >> 8) & 0xff, instruction->line);
+                write_chunk(&optimized, jump & 0xff, instruction->line);
+                /*operands that come after the offset*/
+                for (int j = 2; j < instruction->length - 1; j++){
+                    write_chunk(&optimized, operands[j], instruction->line);
+                }
+            }else{
+                write_chunk(&optimized, opcode, instruction->line);
+                for (int j = 0; j < instruction->length - 1; j++){
+                    write_chunk(&optimized, operands[j], instruction->line);
+                }
+            }
+        }
+
+        for (int j = 0; j < instruction->after_count; j++){
+            write_chunk(&optimized, listing->bytes[instruction->after + j], instruction->line);
+        }
+    }
+
+    /*the constant table doesn't change, hand it over as is*/
+    optimized.constants = chunk->constants;
+    init_value_array(&chunk->constants);
+    free_chunk(chunk);
+    *chunk = optimized;
+
+    FREE_ARRAY(int, new_offset, listing->count + 1);
+}
+
+static bool reach(Listing* listing, int* depth, int* worklist, int* count, int index, int value){
+    if(index >= listing->count) return false;
+
+    if(depth[index] == -1){
+        depth[index] = value;
+        worklist[(*count)++] = index;
+        return true;
+    }
+    return depth[index] == value;
+}
+
+/*
+    fills `depth` with the stack depth ahead of every instruction, -1
+    where it's unreachable, `entry` is the depth the code starts at.
+    returns the deepest the stack gets or -1 if paths disagree on the
+    depth somewhere, the stack underflows, a local is out of range or
+    the code runs off its end
+*/
+int stack_depths(Listing* listing, int entry, int* depth){
+    int* worklist = ALLOCATE(int, listing->count);
+    int count = 0;
+    int deepest = entry;
+    bool valid = listing->count > 0;
+
+    for (int i = 0; i < listing->count; i++) depth[i] = -1;
+    if(valid) reach(listing, depth, worklist, &count, 0, entry);
+
+    while(valid && count > 0){
+        int index = worklist[--count];
+        Instruction* instruction = &listing->code[index];
+        uint8_t* code = &listing->chunk->code[instruction->offset];
+
+        int pops, pushes;
+        if(!stack_effect(code, &pops, &pushes) || depth[index] < pops){
+            valid = false;
+            break;
+        }
+        if((code[0] == OP_GET_LOCAL || code[0] == OP_SET_LOCAL) && code[1] >= depth[index]){
+            valid = false;
+            break;
+        }
+        if(updates_local(code[0]) && code[1] >= depth[index] - 1){
+            valid = false;
+            break;
+        }
+        if((code[0] == OP_FOR_LOOP || code[0] == OP_FOR_LOOP_K) && (code[3] >= depth[index] ||
+            (code[0] == OP_FOR_LOOP && code[4] >= depth[index]))){
+            valid = false;
+            break;
+        }
+
+        int after = depth[index] - pops + pushes;
+        if(depth[index] > deepest) deepest = depth[index];
+        if(after > deepest) deepest = after;
+
+        switch (code[0]){
+            case OP_RETURN:
+                break;
+            case OP_JUMP:
+            case OP_LOOP:
+                valid = reach(listing, depth, worklist, &count, instruction->target, after);
+                break;
+            case OP_JUMP_IF_FALSE:
+                valid = reach(listing, depth, worklist, &count, instruction->target, after) &&
+                    reach(listing, depth, worklist, &count, index + 1, after);
+                break;
+            case OP_JUMP_IF_NOT_LESS:
+            case OP_FOR_LOOP:
+            case OP_FOR_LOOP_K:
+                valid = reach(listing, depth, worklist, &count, instruction->target, after + 1) &&
+                    reach(listing, depth, worklist, &count, index + 1, after);
+                break;
+            case OP_SWITCH:
+            case OP_SWITCH_HASH:
+                for (int k = 1; valid && k <= jump_table_size(code); k++){
+                    int entry = index + k;
+                    valid = entry < listing->count && (listing->code[entry].opcode == OP_JUMP ||
+                        listing->code[entry].opcode == OP_LOOP) &&
+                        reach(listing, depth, worklist, &count, entry, after);
+                }
+                break;
+            default:
+                valid = reach(listing, depth, worklist, &count, index + 1, after);
+                break;
+        }
+    }
+
+    FREE_ARRAY(int, worklist, listing->count);
+    return valid ? deepest : -1;
+}
@@ -0,0 +1,62 @@
+#include "common.h"
+#include "map.h"
+#include "array.h"
+#include "table.h"
+
+/*NaN isn't equal to itself, it could be set but never found*/
+bool is_map_key(Value key){
+    if(IS_NUMBER(key)) return AS_NUMBER(key) == AS_NUMBER(key);
+    return IS_BOOL(key) || IS_STRING(key);
+}
+
+bool map_get(ObjMap* map, Value key, Value* value){
+    return table_get_value(&map->table, key, value);
+}
+
+void map_set(ObjMap* map, Value key, Value value){
+    if(table_set_value(&map->table, key, value)) map->count++;
+}
+
+/*has(map, key), false for keys a map can't hold*/
+bool has_native(int arg_count, Value* args, Value* result){
+    (void)arg_count;
+    Value value;
+    *result = BOOL_VAL(is_map_key(args[1]) && map_get(AS_MAP(args[0]), args[1], &value));
+    return true;
+}
+
+/*remove(map, key), whether the key was there*/
+bool remove_native(int arg_count, Value* args, Value* result){
+    (void)arg_count;
+    ObjMap* map = AS_MAP(args[0]);
+    bool removed = is_map_key(args[1]) && table_delete_value(&map->table, args[1]);
+    if(removed) map->count--;
+    *result = BOOL_VAL(removed);
+    return true;
+}
+
+/*
+    the keys or the values as an array, in the table's order. both
+    come out in the same order as long as the map isn't changed
+*/
+static Value entries_of(ObjMap* map, bool keys){
+    Table* table = &map->table;
+    ObjArray* array = new_array();
+    for (int i = 0; i < table->capacity; i++){
+        Entry* entry = &table->entries[i];
+        if(!IS_NIL(entry->key)) array_append(array, keys ? entry->key : entry->value);
+    }
+    return OBJ_VAL(array);
+}
+
+bool keys_native(int arg_count, Value* args, Value* result){
+    (void)arg_count;
+    *result = entries_of(AS_MAP(args[0]), true);
+    return true;
+}
+
+bool values_native(int arg_count, Value* args, Value* result){
+    (void)arg_count;
+    *result = entries_of(AS_MAP(args[0]), false);
+    return true;
+}
@@ -35,10 +35,52 @@ static void free_object(Obj* object){
         case OBJ_FUNCTION:
             ObjFunction* function = (ObjFunction*)object;
             free_chunk(&function->chunk);
+            if(function->optimized != NULL){
+                free_chunk(function->optimized);
+                FREE(Chunk, function->optimized);
+            }
+            FREE_ARRAY(InlineFrame, function->inline_frames, function->inline_frame_capacity);
             FREE(ObjFunction,object);
             break;
         case OBJ_NATIVE:
             FREE(ObjNative, object);
             break;
+        case OBJ_CLOSURE:
+            ObjClosure* closure = (ObjClosure*)object;
+            FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalue_count);
+            FREE_ARRAY(ObjUpvalue, closure->copies, closure->upvalue_count);
+            FREE(ObjClosure, object);
+            break;
+        case OBJ_UPVALUE:
+            FREE(ObjUpvalue, object);
+            break;
+        case OBJ_SHAPE:
+            ObjShape* shape = (ObjShape*)object;
+            free_table(&shape->slots);
+            free_table(&shape->transitions);
+            FREE(ObjShape, object);
+            break;
+        case OBJ_CLASS:
+            free_table(&((ObjClass*)object)->methods);
+            FREE(ObjClass, object);
+            break;
+        case OBJ_INSTANCE:
+            ObjInstance* instance = (ObjInstance*)object;
+            FREE_ARRAY(Value, instance->fields, instance->capacity);
+            FREE(ObjInstance, object);
+            break;
+        case OBJ_BOUND_METHOD:
+            FREE(ObjBoundMethod, object);
+            break;
+        case OBJ_ARRAY:
+            ObjArray* array = (ObjArray*)object;
+            FREE_ARRAY(double, array->numbers, array->capacity);
+            FREE_ARRAY(Value, array->values, array->capacity);
+            FREE(ObjArray, object);
+            break;
+        case OBJ_MAP:
+            free_table(&((ObjMap*)object)->table);
+            FREE(ObjMap, object);
+            break;
     }
 }
\ No newline at end of file
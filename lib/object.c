@@ -55,24 +55,68 @@ static Obj* allocate_object(size_t size, ObjType type){
 
 static void print_function(ObjFunction* function){
     if(function->name == NULL){
-        printf("<script>");
+        output_string(&vm.output, "<script>");
+        return;
     }
-    
-    printf("<fn %s>", function->name->chars);
+
+    output_format(&vm.output, "<fn %s>", function->name->chars);
 }
 
 void print_object(Value value){
-    printf("in print_object");
     switch (OBJ_TYPE(value)){
         case OBJ_STRING:
-            printf("%s",AS_CSTRING(value));
+            output_chars(&vm.output, AS_CSTRING(value), AS_STRING(value)->length);
             break;
         case OBJ_FUNCTION:
             print_function(AS_FUNCTION(value));
             break;
         case OBJ_NATIVE:
-            printf("<native fn>");
+            output_string(&vm.output, "<native fn>");
+            break;
+        case OBJ_CLOSURE:
+            print_function(AS_CLOSURE(value)->function);
+            break;
+        case OBJ_UPVALUE:
+            output_string(&vm.output, "upvalue");
+            break;
+        case OBJ_SHAPE:
+            output_string(&vm.output, "shape");
+            break;
+        case OBJ_CLASS:
+            output_format(&vm.output, "%s", AS_CLASS(value)->name->chars);
+            break;
+        case OBJ_INSTANCE:
+            output_format(&vm.output, "%s instance", AS_INSTANCE(value)->klass->name->chars);
+            break;
+        case OBJ_BOUND_METHOD:
+            print_object(OBJ_VAL(AS_BOUND_METHOD(value)->method));
+            break;
+        case OBJ_ARRAY:{
+            ObjArray* array = AS_ARRAY(value);
+            output_string(&vm.output, "[");
+            for (int i = 0; i < array->count; i++){
+                if(i > 0) output_string(&vm.output, ", ");
+                print_value(array->unboxed ? NUMBER_VAL(array->numbers[i]) : array->values[i]);
+            }
+            output_string(&vm.output, "]");
             break;
+        }
+        case OBJ_MAP:{
+            Table* table = &AS_MAP(value)->table;
+            bool first = true;
+            output_string(&vm.output, "{");
+            for (int i = 0; i < table->capacity; i++){
+                Entry* entry = &table->entries[i];
+                if(IS_NIL(entry->key)) continue;
+                if(!first) output_string(&vm.output, ", ");
+                print_value(entry->key);
+                output_string(&vm.output, ": ");
+                print_value(entry->value);
+                first = false;
+            }
+            output_string(&vm.output, "}");
+            break;
+        }
         default:
             break;
     }
@@ -97,13 +141,119 @@ ObjString* take_string(char* chars, int length){
 ObjFunction* new_function(){
     ObjFunction* function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
+    function->upvalue_count = 0;
     function->name = NULL;
+    function->source = NULL;
+    function->source_line = 0;
+    function->visible_constants = 0;
+    function->hotness = 0;
+    function->optimized = NULL;
+    function->inline_frames = NULL;
+    function->inline_frame_count = 0;
+    function->inline_frame_capacity = 0;
     init_chunk(&function->chunk);
     return function;
 }
 
-ObjNative* new_native(NativeFn function){
+ObjNative* new_native(NativeFn function, const char* name, const char* params, int optional){
     ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
     native->function = function;
+    native->name = name;
+    native->params = params;
+    native->arity = (int)strlen(params);
+    native->optional = optional;
+    native->typed = strspn(params, ".") != strlen(params);
+    native->intrinsic = -1;
     return native;
-}
\ No newline at end of file
+}
+
+ObjClosure* new_closure(ObjFunction* function){
+    int count = function->upvalue_count;
+    ObjUpvalue** upvalues = ALLOCATE(ObjUpvalue*, count);
+    ObjUpvalue* copies = ALLOCATE(ObjUpvalue, count);
+    for (int i = 0; i < count; i++) upvalues[i] = NULL;
+
+    ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
+    closure->function = function;
+    closure->upvalues = upvalues;
+    closure->copies = copies;
+    closure->upvalue_count = count;
+    return closure;
+}
+
+ObjUpvalue* new_upvalue(Value* slot){
+    ObjUpvalue* upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
+    upvalue->location = slot;
+    upvalue->closed = NIL_VAL;
+    upvalue->next = NULL;
+    return upvalue;
+}
+
+ObjShape* new_shape(){
+    ObjShape* shape = ALLOCATE_OBJ(ObjShape, OBJ_SHAPE);
+    init_table(&shape->slots);
+    init_table(&shape->transitions);
+    shape->slot_count = 0;
+    return shape;
+}
+
+/*the shape an instance of `shape` has once it gets the field `name`*/
+ObjShape* shape_with(ObjShape* shape, ObjString* name){
+    Value next;
+    if(table_get(&shape->transitions, name, &next)) return (ObjShape*)AS_OBJ(next);
+
+    ObjShape* added = new_shape();
+    table_add_all(&shape->slots, &added->slots);
+    table_set(&added->slots, name, NUMBER_VAL(shape->slot_count));
+    added->slot_count = shape->slot_count + 1;
+    table_set(&shape->transitions, name, OBJ_VAL(added));
+    return added;
+}
+
+/*where the field `name` sits in instances of `shape`, -1 if they don't have it*/
+int shape_slot(ObjShape* shape, ObjString* name){
+    Value slot;
+    if(!table_get(&shape->slots, name, &slot)) return -1;
+    return (int)AS_NUMBER(slot);
+}
+
+ObjClass* new_class(ObjString* name){
+    ObjClass* klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
+    klass->name = name;
+    init_table(&klass->methods);
+    klass->shape = new_shape();
+    return klass;
+}
+
+ObjInstance* new_instance(ObjClass* klass){
+    ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
+    instance->klass = klass;
+    instance->shape = klass->shape;
+    instance->fields = NULL;
+    instance->capacity = 0;
+    return instance;
+}
+
+ObjBoundMethod* new_bound_method(Value receiver, Obj* method){
+    ObjBoundMethod* bound = ALLOCATE_OBJ(ObjBoundMethod, OBJ_BOUND_METHOD);
+    bound->receiver = receiver;
+    bound->method = method;
+    return bound;
+}
+
+ObjArray* new_array(){
+    ObjArray* array = ALLOCATE_OBJ(ObjArray, OBJ_ARRAY);
+    array->unboxed = true;
+    array->count = 0;
+    array->capacity = 0;
+    array->numbers = NULL;
+    array->values = NULL;
+    return array;
+}
+
+ObjMap* new_map(){
+    ObjMap* map = ALLOCATE_OBJ(ObjMap, OBJ_MAP);
+    init_table(&map->table);
+    map->count = 0;
+    return map;
+}
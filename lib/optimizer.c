@@ -0,0 +1,214 @@
+#include <stdlib.h>
+
+#include "common.h"
+#include "chunk.h"
+#include "listing.h"
+#include "memory.h"
+#include "optimizer.h"
+
+static bool is_unconditional(uint8_t opcode){
+    return opcode == OP_JUMP || opcode == OP_LOOP;
+}
+
+/*pushes a value without any other effect, so PUSH POP is a no-op*/
+static bool is_pure_push(uint8_t opcode){
+    switch (opcode){
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void mark_targets(Listing* listing){
+    for (int i = 0; i < listing->count; i++) listing->code[i].is_target = false;
+
+    for (int i = 0; i < listing->count; i++){
+        Instruction* instruction = &listing->code[i];
+        if(instruction->removed || instruction->target == -1) continue;
+
+        int target = resolve(listing, i);
+        if(target < listing->count) listing->code[target].is_target = true;
+    }
+}
+
+/*
+    walks the control flow from the first instruction, whatever
+    isn't reached (the code after a return, an else that can't run)
+    gets dropped
+*/
+static bool remove_unreachable(Listing* listing){
+    int* work = ALLOCATE(int, listing->count);
+    int work_count = 0;
+
+    for (int i = 0; i < listing->count; i++) listing->code[i].reachable = false;
+
+    int entry = next_live(listing, 0);
+    if(entry < listing->count){
+        listing->code[entry].reachable = true;
+        work[work_count++] = entry;
+    }
+
+    while(work_count > 0){
+        int index = work[--work_count];
+        Instruction* instruction = &listing->code[index];
+        int successors[2 + UINT8_COUNT];
+        int successor_count = 0;
+
+        if(instruction->target != -1){
+            successors[successor_count++] = resolve(listing, index);
+        }
+        if(instruction->opcode != OP_RETURN && !is_unconditional(instruction->opcode)){
+            successors[successor_count++] = next_live(listing, index + 1);
+        }
+        /*any JUMP of a jump table can be taken, not only the first*/
+        int entries = jump_table_size(&listing->chunk->code[instruction->offset]);
+        for (int k = 2; k <= entries; k++) successors[successor_count++] = index + k;
+
+        for (int i = 0; i < successor_count; i++){
+            int successor = successors[i];
+            if(successor >= listing->count || listing->code[successor].reachable) continue;
+            listing->code[successor].reachable = true;
+            work[work_count++] = successor;
+        }
+    }
+
+    bool changed = false;
+    for (int i = 0; i < listing->count; i++){
+        Instruction* instruction = &listing->code[i];
+        if(!instruction->removed && !instruction->reachable){
+            instruction->removed = true;
+            changed = true;
+        }
+    }
+
+    FREE_ARRAY(int, work, listing->count);
+    return changed;
+}
+
+/*
+    a jump onto an unconditional jump can go straight to where that
+    one goes, and JUMP_IF_FALSE onto another JUMP_IF_FALSE tests the
+    same value (neither pops it) so it can skip ahead as well
+*/
+static bool thread_jump(Listing* listing, int index){
+    Instruction* jump = &listing->code[index];
+    int target = resolve(listing, index);
+
+    for (int hops = 0; hops < listing->count && target < listing->count; hops++){
+        Instruction* next = &listing->code[target];
+        bool follows = is_unconditional(next->opcode) ||
+            (jump->opcode == OP_JUMP_IF_FALSE && next->opcode == OP_JUMP_IF_FALSE);
+        if(!follows) break;
+
+        int after = resolve(listing, target);
+        if(after == target || after >= listing->count) break;
+
+        /*conditional jumps can only go forwards*/
+        int after_offset = listing->code[after].offset;
+        if(is_conditional(jump->opcode) && after_offset <= jump->offset) break;
+        if(abs(after_offset - (jump->offset + 3)) > UINT16_MAX) break;
+        target = after;
+    }
+
+    if(target == resolve(listing, index)) return false;
+    jump->target = target;
+    listing->code[target].is_target = true;
+    return true;
+}
+
+static bool fuse_not(Instruction* instruction){
+    switch (instruction->opcode){
+        case OP_EQUAL:          instruction->opcode = OP_NOT_EQUAL; return true;
+        case OP_NOT_EQUAL:      instruction->opcode = OP_EQUAL; return true;
+        case OP_LESS:           instruction->opcode = OP_GREATER_EQUAL; return true;
+        case OP_GREATER_EQUAL:  instruction->opcode = OP_LESS; return true;
+        case OP_GREATER:        instruction->opcode = OP_LESS_EQUAL; return true;
+        case OP_LESS_EQUAL:     instruction->opcode = OP_GREATER; return true;
+        default:
+            return false;
+    }
+}
+
+static bool rewrite(Listing* listing){
+    bool changed = false;
+
+    for (int i = 0; i < listing->count; i++){
+        Instruction* instruction = &listing->code[i];
+        if(instruction->removed) continue;
+
+        if(instruction->target != -1){
+            changed |= thread_jump(listing, i);
+
+            int target = resolve(listing, i);
+            int next = next_live(listing, i + 1);
+            /*the others leave the stack different depending on whether they jump*/
+            bool plain = instruction->opcode == OP_JUMP || instruction->opcode == OP_JUMP_IF_FALSE;
+            if(instruction->in_table) continue;
+            if(plain && target == next){
+                instruction->removed = true;
+                changed = true;
+                continue;
+            }
+
+            /*jumping to a return is the same as returning*/
+            if(instruction->opcode == OP_JUMP && target < listing->count &&
+                listing->code[target].opcode == OP_RETURN){
+                instruction->opcode = OP_RETURN;
+                instruction->length = 1;
+                instruction->target = -1;
+                changed = true;
+                continue;
+            }
+        }
+
+        int next = next_live(listing, i + 1);
+        if(next >= listing->count) continue;
+        Instruction* following = &listing->code[next];
+        if(following->is_target) continue;
+
+        if(following->opcode == OP_NOT && fuse_not(instruction)){
+            following->removed = true;
+            changed = true;
+        }else if(following->opcode == OP_POP && is_pure_push(instruction->opcode)){
+            instruction->removed = true;
+            following->removed = true;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+/*
+    rewrites a finished chunk in place and returns how many
+    instructions it got rid of
+*/
+int optimize_chunk(Chunk* chunk){
+    if(chunk->count == 0) return 0;
+
+    Listing listing;
+    init_listing(&listing, chunk);
+
+    bool modified = false;
+    bool changed = true;
+    while(changed){
+        changed = remove_unreachable(&listing);
+        mark_targets(&listing);
+        changed |= rewrite(&listing);
+        modified |= changed;
+    }
+
+    int removed = 0;
+    for (int i = 0; i < listing.count; i++){
+        if(listing.code[i].removed) removed++;
+    }
+
+    if(modified) rebuild_listing(&listing);
+    free_listing(&listing);
+    return removed;
+}
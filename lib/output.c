@@ -0,0 +1,453 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#define isatty _isatty
+#define STDOUT_FILENO 1
+#else
+#include <unistd.h>
+#endif
+
+#include "common.h"
+#include "memory.h"
+#include "output.h"
+
+/*a 64 bit significand with a binary exponent, f * 2^e*/
+typedef struct{
+    uint64_t f;
+    int e;
+} DiyFp;
+
+typedef struct{
+    uint64_t f;
+    int16_t e;
+    int16_t decimal_exponent;
+} CachedPower;
+
+/*grisu wants the scaled number's exponent somewhere in here*/
+#define MIN_TARGET_EXPONENT -60
+#define MAX_TARGET_EXPONENT -32
+#define CACHED_POWERS_OFFSET 348
+#define CACHED_POWERS_STEP 8
+
+/*10^-348 through 10^340 every 8 powers, each rounded to 64 bits*/
+static const CachedPower cached_powers[] = {
+    {0xfa8fd5a0081c0288u, -1220, -348},
+    {0xbaaee17fa23ebf76u, -1193, -340},
+    {0x8b16fb203055ac76u, -1166, -332},
+    {0xcf42894a5dce35eau, -1140, -324},
+    {0x9a6bb0aa55653b2du, -1113, -316},
+    {0xe61acf033d1a45dfu, -1087, -308},
+    {0xab70fe17c79ac6cau, -1060, -300},
+    {0xff77b1fcbebcdc4fu, -1034, -292},
+    {0xbe5691ef416bd60cu, -1007, -284},
+    {0x8dd01fad907ffc3cu, -980, -276},
+    {0xd3515c2831559a83u, -954, -268},
+    {0x9d71ac8fada6c9b5u, -927, -260},
+    {0xea9c227723ee8bcbu, -901, -252},
+    {0xaecc49914078536du, -874, -244},
+    {0x823c12795db6ce57u, -847, -236},
+    {0xc21094364dfb5637u, -821, -228},
+    {0x9096ea6f3848984fu, -794, -220},
+    {0xd77485cb25823ac7u, -768, -212},
+    {0xa086cfcd97bf97f4u, -741, -204},
+    {0xef340a98172aace5u, -715, -196},
+    {0xb23867fb2a35b28eu, -688, -188},
+    {0x84c8d4dfd2c63f3bu, -661, -180},
+    {0xc5dd44271ad3cdbau, -635, -172},
+    {0x936b9fcebb25c996u, -608, -164},
+    {0xdbac6c247d62a584u, -582, -156},
+    {0xa3ab66580d5fdaf6u, -555, -148},
+    {0xf3e2f893dec3f126u, -529, -140},
+    {0xb5b5ada8aaff80b8u, -502, -132},
+    {0x87625f056c7c4a8bu, -475, -124},
+    {0xc9bcff6034c13053u, -449, -116},
+    {0x964e858c91ba2655u, -422, -108},
+    {0xdff9772470297ebdu, -396, -100},
+    {0xa6dfbd9fb8e5b88fu, -369, -92},
+    {0xf8a95fcf88747d94u, -343, -84},
+    {0xb94470938fa89bcfu, -316, -76},
+    {0x8a08f0f8bf0f156bu, -289, -68},
+    {0xcdb02555653131b6u, -263, -60},
+    {0x993fe2c6d07b7facu, -236, -52},
+    {0xe45c10c42a2b3b06u, -210, -44},
+    {0xaa242499697392d3u, -183, -36},
+    {0xfd87b5f28300ca0eu, -157, -28},
+    {0xbce5086492111aebu, -130, -20},
+    {0x8cbccc096f5088ccu, -103, -12},
+    {0xd1b71758e219652cu, -77, -4},
+    {0x9c40000000000000u, -50, 4},
+    {0xe8d4a51000000000u, -24, 12},
+    {0xad78ebc5ac620000u, 3, 20},
+    {0x813f3978f8940984u, 30, 28},
+    {0xc097ce7bc90715b3u, 56, 36},
+    {0x8f7e32ce7bea5c70u, 83, 44},
+    {0xd5d238a4abe98068u, 109, 52},
+    {0x9f4f2726179a2245u, 136, 60},
+    {0xed63a231d4c4fb27u, 162, 68},
+    {0xb0de65388cc8ada8u, 189, 76},
+    {0x83c7088e1aab65dbu, 216, 84},
+    {0xc45d1df942711d9au, 242, 92},
+    {0x924d692ca61be758u, 269, 100},
+    {0xda01ee641a708deau, 295, 108},
+    {0xa26da3999aef774au, 322, 116},
+    {0xf209787bb47d6b85u, 348, 124},
+    {0xb454e4a179dd1877u, 375, 132},
+    {0x865b86925b9bc5c2u, 402, 140},
+    {0xc83553c5c8965d3du, 428, 148},
+    {0x952ab45cfa97a0b3u, 455, 156},
+    {0xde469fbd99a05fe3u, 481, 164},
+    {0xa59bc234db398c25u, 508, 172},
+    {0xf6c69a72a3989f5cu, 534, 180},
+    {0xb7dcbf5354e9beceu, 561, 188},
+    {0x88fcf317f22241e2u, 588, 196},
+    {0xcc20ce9bd35c78a5u, 614, 204},
+    {0x98165af37b2153dfu, 641, 212},
+    {0xe2a0b5dc971f303au, 667, 220},
+    {0xa8d9d1535ce3b396u, 694, 228},
+    {0xfb9b7cd9a4a7443cu, 720, 236},
+    {0xbb764c4ca7a44410u, 747, 244},
+    {0x8bab8eefb6409c1au, 774, 252},
+    {0xd01fef10a657842cu, 800, 260},
+    {0x9b10a4e5e9913129u, 827, 268},
+    {0xe7109bfba19c0c9du, 853, 276},
+    {0xac2820d9623bf429u, 880, 284},
+    {0x80444b5e7aa7cf85u, 907, 292},
+    {0xbf21e44003acdd2du, 933, 300},
+    {0x8e679c2f5e44ff8fu, 960, 308},
+    {0xd433179d9c8cb841u, 986, 316},
+    {0x9e19db92b4e31ba9u, 1013, 324},
+    {0xeb96bf6ebadf77d9u, 1039, 332},
+    {0xaf87023b9bf0ee6bu, 1066, 340}
+};
+
+static const uint32_t small_powers[] = {
+    0, 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static FlushPolicy default_policy();
+static void write_all(const char* chars, int length);
+static DiyFp multiply(DiyFp x, DiyFp y);
+static DiyFp normalize(DiyFp x);
+static bool round_weed(char* digits, int length, uint64_t distance_too_high_w, uint64_t unsafe_interval, uint64_t rest, uint64_t ten_kappa, uint64_t unit);
+static bool grisu3(double number, char* digits, int* length, int* exponent);
+static void search_digits(double number, char* digits, int* length, int* exponent);
+static int layout_number(char* buffer, bool negative, const char* digits, int length, int exponent);
+
+/*
+    CLOX_FLUSH picks the policy, a terminal gets its lines as they're
+    printed and anything else gets whole blocks
+*/
+static FlushPolicy default_policy(){
+    const char* policy = getenv("CLOX_FLUSH");
+    if(policy != NULL){
+        if(strcmp(policy, "line") == 0) return FLUSH_LINE;
+        if(strcmp(policy, "block") == 0) return FLUSH_BLOCK;
+        if(strcmp(policy, "explicit") == 0) return FLUSH_EXPLICIT;
+    }
+    return isatty(STDOUT_FILENO) ? FLUSH_LINE : FLUSH_BLOCK;
+}
+
+void init_output(Output* output){
+    output->policy = default_policy();
+    output->capacity = OUTPUT_BUFFER_SIZE;
+    output->chars = ALLOCATE(char, output->capacity);
+    output->count = 0;
+}
+
+void free_output(Output* output){
+    flush_output(output);
+    FREE_ARRAY(char, output->chars, output->capacity);
+    output->chars = NULL;
+    output->capacity = 0;
+}
+
+/*a write can take less than it's given or be interrupted, output that can't go anywhere is dropped*/
+static void write_all(const char* chars, int length){
+    while(length > 0){
+        long written = (long)write(STDOUT_FILENO, chars, length);
+        if(written < 0){
+            if(errno == EINTR) continue;
+            return;
+        }
+        chars += written;
+        length -= (int)written;
+    }
+}
+
+void flush_output(Output* output){
+    write_all(output->chars, output->count);
+    output->count = 0;
+}
+
+void output_chars(Output* output, const char* chars, int length){
+    if(output->count + length > output->capacity){
+        if(output->policy == FLUSH_EXPLICIT){
+            int old_capacity = output->capacity;
+            while(output->capacity < output->count + length) output->capacity *= 2;
+            output->chars = GROW_ARRAY(char, output->chars, old_capacity, output->capacity);
+        }else{
+            flush_output(output);
+            /*too big to be worth copying*/
+            if(length > output->capacity){
+                write_all(chars, length);
+                return;
+            }
+        }
+    }
+
+    memcpy(output->chars + output->count, chars, length);
+    output->count += length;
+    if(output->policy == FLUSH_LINE && memchr(chars, '\n', length) != NULL){
+        flush_output(output);
+    }
+}
+
+void output_string(Output* output, const char* string){
+    output_chars(output, string, (int)strlen(string));
+}
+
+/*the 128 bit product rounded back to its top 64 bits*/
+static DiyFp multiply(DiyFp x, DiyFp y){
+    uint64_t a = x.f >> 32, b = x.f & 0xffffffffu;
+    uint64_t c = y.f >> 32, d = y.f & 0xffffffffu;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t middle = (bd >> 32) + (ad & 0xffffffffu) + (bc & 0xffffffffu) + (1u << 31);
+    DiyFp product = {ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64};
+    return product;
+}
+
+static DiyFp normalize(DiyFp x){
+    while(!(x.f & ((uint64_t)1 << 63))){
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+/*
+    nudges the last digit towards the exact value, false when the
+    digits might not be the closest shortest ones
+*/
+static bool round_weed(char* digits, int length, uint64_t distance_too_high_w, uint64_t unsafe_interval, uint64_t rest, uint64_t ten_kappa, uint64_t unit){
+    uint64_t small_distance = distance_too_high_w - unit;
+    uint64_t big_distance = distance_too_high_w + unit;
+
+    while(rest < small_distance && unsafe_interval - rest >= ten_kappa &&
+        (rest + ten_kappa < small_distance || small_distance - rest >= rest + ten_kappa - small_distance)){
+        digits[length - 1]--;
+        rest += ten_kappa;
+    }
+
+    if(rest < big_distance && unsafe_interval - rest >= ten_kappa &&
+        (rest + ten_kappa < big_distance || big_distance - rest > rest + ten_kappa - big_distance)){
+        return false;
+    }
+    return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+}
+
+/*
+    Loitsch's grisu3, the shortest digits that read back as number,
+    which has to be finite and above zero. the number is
+    digits * 10^exponent. it gives up on roughly 0.5% of doubles
+*/
+static bool grisu3(double number, char* digits, int* length, int* exponent){
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    int biased = (int)((bits >> 52) & 0x7ff);
+    uint64_t significand = bits & (((uint64_t)1 << 52) - 1);
+
+    DiyFp v;
+    if(biased != 0){
+        v.f = significand | ((uint64_t)1 << 52);
+        v.e = biased - 1075;
+    }else{
+        v.f = significand;
+        v.e = -1074;
+    }
+
+    /*the halfway points to the neighbouring doubles, the lower one is closer at a power of two*/
+    DiyFp plus = {(v.f << 1) + 1, v.e - 1};
+    plus = normalize(plus);
+    DiyFp minus;
+    if(significand == 0 && biased > 1){
+        minus.f = (v.f << 2) - 1;
+        minus.e = v.e - 2;
+    }else{
+        minus.f = (v.f << 1) - 1;
+        minus.e = v.e - 1;
+    }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+    DiyFp w = normalize(v);
+
+    /*scale by a cached 10^-k so the exponent lands in the target range*/
+    int min_exponent = MIN_TARGET_EXPONENT - (w.e + 64);
+    int k = (int)ceil((min_exponent + 63) * 0.30102999566398114);
+    const CachedPower* power = &cached_powers[(CACHED_POWERS_OFFSET + k - 1) / CACHED_POWERS_STEP + 1];
+    DiyFp ten_mk = {power->f, power->e};
+    int mk = -power->decimal_exponent;
+
+    DiyFp scaled_w = multiply(w, ten_mk);
+    DiyFp low = multiply(minus, ten_mk);
+    DiyFp high = multiply(plus, ten_mk);
+
+    /*every product is off by up to one unit, so only digits inside the unsafe interval are certain*/
+    uint64_t unit = 1;
+    DiyFp too_low = {low.f - unit, low.e};
+    DiyFp too_high = {high.f + unit, high.e};
+    uint64_t unsafe_interval = too_high.f - too_low.f;
+    int shift = -scaled_w.e;
+    uint64_t one = (uint64_t)1 << shift;
+    uint32_t integrals = (uint32_t)(too_high.f >> shift);
+    uint64_t fractionals = too_high.f & (one - 1);
+
+    int kappa = ((64 - shift + 1) * 1233 >> 12) + 1;
+    if(integrals < small_powers[kappa]) kappa--;
+    uint32_t divisor = small_powers[kappa];
+    *length = 0;
+
+    while(kappa > 0){
+        digits[(*length)++] = (char)('0' + integrals / divisor);
+        integrals %= divisor;
+        kappa--;
+        uint64_t rest = ((uint64_t)integrals << shift) + fractionals;
+        if(rest < unsafe_interval){
+            *exponent = mk + kappa;
+            return round_weed(digits, *length, too_high.f - scaled_w.f, unsafe_interval, rest, (uint64_t)divisor << shift, unit);
+        }
+        divisor /= 10;
+    }
+
+    for(;;){
+        fractionals *= 10;
+        unit *= 10;
+        unsafe_interval *= 10;
+        digits[(*length)++] = (char)('0' + (fractionals >> shift));
+        fractionals &= one - 1;
+        kappa--;
+        if(fractionals < unsafe_interval){
+            *exponent = mk + kappa;
+            return round_weed(digits, *length, (too_high.f - scaled_w.f) * unit, unsafe_interval, fractionals, one, unit);
+        }
+    }
+}
+
+/*the slow way for what grisu3 gives up on, the fewest "%e" digits that read back*/
+static void search_digits(double number, char* digits, int* length, int* exponent){
+    char buffer[32];
+    for(int precision = 1; precision <= 17; precision++){
+        snprintf(buffer, sizeof(buffer), "%.*e", precision - 1, number);
+        if(strtod(buffer, NULL) == number) break;
+    }
+
+    *length = 0;
+    char* c = buffer;
+    for(; *c != 'e'; c++){
+        if(*c != '.') digits[(*length)++] = *c;
+    }
+    while(*length > 1 && digits[*length - 1] == '0') (*length)--;
+    *exponent = atoi(c + 1) - *length + 1;
+}
+
+/*
+    lays the digits out the way "%g" does, only with as many
+    significant digits as they need and never fewer than its six
+*/
+static int layout_number(char* buffer, bool negative, const char* digits, int length, int exponent){
+    int count = 0;
+    int scientific = length + exponent - 1;
+    int precision = length > 6 ? length : 6;
+    if(negative) buffer[count++] = '-';
+
+    if(scientific < -4 || scientific >= precision){
+        buffer[count++] = digits[0];
+        if(length > 1){
+            buffer[count++] = '.';
+            memcpy(buffer + count, digits + 1, length - 1);
+            count += length - 1;
+        }
+        count += sprintf(buffer + count, "e%c%02d", scientific < 0 ? '-' : '+', abs(scientific));
+    }else if(scientific < 0){
+        buffer[count++] = '0';
+        buffer[count++] = '.';
+        for(int i = -1; i > scientific; i--) buffer[count++] = '0';
+        memcpy(buffer + count, digits, length);
+        count += length;
+    }else{
+        for(int i = 0; i < length || i <= scientific; i++){
+            if(i == scientific + 1) buffer[count++] = '.';
+            buffer[count++] = i < length ? digits[i] : '0';
+        }
+    }
+    return count;
+}
+
+/*
+    the shortest digits that read back as the same double, laid out
+    like "%g". whole numbers under a million, which is most of what
+    gets printed, come straight out of a digit loop
+*/
+void output_number(Output* output, double number){
+    char buffer[40];
+    char digits[20];
+    int length;
+    int exponent;
+
+    if(number > -1e6 && number < 1e6 && number == (double)(int32_t)number){
+        int32_t whole = (int32_t)number;
+        char* end = buffer + sizeof(buffer);
+        char* start = end;
+        uint32_t magnitude = whole < 0 ? (uint32_t)-whole : (uint32_t)whole;
+        do{
+            *--start = (char)('0' + magnitude % 10);
+            magnitude /= 10;
+        }while(magnitude != 0);
+        if(whole < 0 || signbit(number)) *--start = '-';
+        output_chars(output, start, (int)(end - start));
+        return;
+    }
+
+    if(isinf(number) || isnan(number)){
+        length = snprintf(buffer, sizeof(buffer), "%g", number);
+        output_chars(output, buffer, length);
+        return;
+    }
+
+    bool negative = signbit(number);
+    if(negative) number = -number;
+    if(!grisu3(number, digits, &length, &exponent)){
+        search_digits(number, digits, &length, &exponent);
+    }
+    output_chars(output, buffer, layout_number(buffer, negative, digits, length, exponent));
+}
+
+void output_format(Output* output, const char* format, ...){
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    if(length < (int)sizeof(buffer)){
+        output_chars(output, buffer, length);
+        return;
+    }
+
+    char* chars = ALLOCATE(char, length + 1);
+    va_start(args, format);
+    vsnprintf(chars, length + 1, format, args);
+    va_end(args);
+    output_chars(output, chars, length);
+    FREE_ARRAY(char, chars, length + 1);
+}
@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "chunk.h"
+#include "debug.h"
+#include "listing.h"
+#include "memory.h"
+#include "registers.h"
+
+/*
+    the stack code is translated to register code one instruction at
+    a time while keeping track of what every stack slot holds, a slot
+    either has its value in place or it's a value we haven't bothered
+    writing yet, that way GET_LOCAL and constants end up as operands
+    of the instruction that uses them instead of instructions of
+    their own
+*/
+typedef enum{
+    OPERAND_IN_PLACE,
+    OPERAND_COPY,       // same value as slot `index`
+    OPERAND_CONSTANT,   // constant `index`
+    OPERAND_NIL,
+    OPERAND_TRUE,
+    OPERAND_FALSE
+} OperandKind;
+
+typedef struct{
+    OperandKind kind;
+    int index;
+} Operand;
+
+typedef struct{
+    int at;             // offset of the 16 bit operand
+    int end;            // offset right after the jump
+    int target;         // instruction it lands on
+} Patch;
+
+typedef struct{
+    Listing listing;
+    int* depth;         // stack depth ahead of every instruction, -1 when unreachable
+    int* label;         // where every instruction starts in the register code
+    Patch* patches;
+    int patch_count;
+    Operand slots[UINT8_COUNT];
+    int top;
+    /*
+        the last instruction if all it did was write slot `producer_slot`,
+        a SET_LOCAL right after it can have it write the local instead
+    */
+    int producer;
+    int producer_slot;
+    Chunk* code;
+    int line;
+} Translator;
+
+static bool find_depths(Translator* translator, int arity);
+static bool translate(Translator* translator);
+static bool patch_jumps(Translator* translator);
+
+Chunk* register_code(ObjFunction* function, Chunk* chunk){
+    if(chunk->registers != NULL) return chunk->registers;
+    if(chunk->untranslatable) return NULL;
+
+    Translator translator;
+    init_listing(&translator.listing, chunk);
+    int count = translator.listing.count;
+    translator.depth = ALLOCATE(int, count);
+    translator.label = ALLOCATE(int, count);
+    translator.patches = ALLOCATE(Patch, count);
+    translator.patch_count = 0;
+    translator.code = ALLOCATE(Chunk, 1);
+    init_chunk(translator.code);
+
+    bool translated = find_depths(&translator, function->arity) &&
+        translate(&translator) && patch_jumps(&translator);
+
+    FREE_ARRAY(int, translator.depth, count);
+    FREE_ARRAY(int, translator.label, count);
+    FREE_ARRAY(Patch, translator.patches, count);
+    free_listing(&translator.listing);
+
+    if(!translated){
+        free_chunk(translator.code);
+        FREE(Chunk, translator.code);
+        chunk->untranslatable = true;
+        return NULL;
+    }
+
+    for (int i = 0; i < chunk->constants.count; i++){
+        write_value_array(&translator.code->constants, chunk->constants.values[i]);
+    }
+
+#ifdef DEBUG_PRINT_CODE
+    disassemble_registers(translator.code,
+        function->name != NULL ? function->name->chars : "<script>");
+#endif
+    chunk->registers = translator.code;
+    return translator.code;
+}
+
+/*
+    the code is rejected if it needs more slots than an operand can
+    name or has a conditional jump going backwards
+*/
+static bool find_depths(Translator* translator, int arity){
+    Listing* listing = &translator->listing;
+    int deepest = stack_depths(listing, arity + 1, translator->depth);
+    if(deepest == -1 || deepest > UINT8_COUNT) return false;
+
+    for (int i = 0; i < listing->count; i++){
+        Instruction* instruction = &listing->code[i];
+        if(is_conditional(instruction->opcode) && instruction->target <= i) return false;
+        if(instruction->target != -1) listing->code[instruction->target].is_target = true;
+    }
+    return true;
+}
+
+static void emit(Translator* translator, uint8_t byte){
+    write_chunk(translator->code, byte, translator->line);
+}
+
+static void emit_instruction(Translator* translator, uint8_t opcode, int a){
+    translator->producer = -1;
+    emit(translator, opcode);
+    emit(translator, a);
+}
+
+/*an instruction whose only effect is writing slot `a`*/
+static void emit_result(Translator* translator, uint8_t opcode, int a){
+    int offset = translator->code->count;
+    emit_instruction(translator, opcode, a);
+    translator->producer = offset;
+    translator->producer_slot = a;
+}
+
+/*writes a pending value to its own slot*/
+static void materialize(Translator* translator, int slot){
+    Operand* operand = &translator->slots[slot];
+    switch (operand->kind){
+        case OPERAND_IN_PLACE:
+            return;
+        case OPERAND_COPY:
+            emit_result(translator, REG_MOVE, slot);
+            emit(translator, operand->index);
+            break;
+        case OPERAND_CONSTANT:
+            emit_result(translator, REG_CONSTANT, slot);
+            emit(translator, operand->index);
+            break;
+        case OPERAND_NIL: emit_result(translator, REG_NIL, slot); break;
+        case OPERAND_TRUE: emit_result(translator, REG_TRUE, slot); break;
+        case OPERAND_FALSE: emit_result(translator, REG_FALSE, slot); break;
+    }
+    operand->kind = OPERAND_IN_PLACE;
+}
+
+static void flush(Translator* translator, int from){
+    for (int slot = from; slot < translator->top; slot++) materialize(translator, slot);
+}
+
+/*the slot an instruction can read the value of `slot` from*/
+static int read_slot(Translator* translator, int slot){
+    Operand* operand = &translator->slots[slot];
+    if(operand->kind == OPERAND_COPY) return operand->index;
+    materialize(translator, slot);
+    return slot;
+}
+
+/*copies still waiting on the old value of `slot` have to be written out first*/
+static bool has_copies(Translator* translator, int slot){
+    for (int i = 0; i < translator->top; i++){
+        Operand* operand = &translator->slots[i];
+        if(operand->kind == OPERAND_COPY && operand->index == slot) return true;
+    }
+    return false;
+}
+
+static void protect(Translator* translator, int slot){
+    for (int i = 0; i < translator->top; i++){
+        Operand* operand = &translator->slots[i];
+        if(operand->kind == OPERAND_COPY && operand->index == slot) materialize(translator, i);
+    }
+}
+
+static void push_operand(Translator* translator, OperandKind kind, int index){
+    Operand* operand = &translator->slots[translator->top++];
+    operand->kind = kind;
+    operand->index = index;
+}
+
+static void set_local(Translator* translator, int slot){
+    int value = translator->top - 1;
+    Operand* operand = &translator->slots[value];
+    if(operand->kind == OPERAND_COPY && operand->index == slot) return;
+
+    if(operand->kind == OPERAND_IN_PLACE && translator->producer != -1 &&
+        translator->producer_slot == value && !has_copies(translator, slot)){
+        translator->code->code[translator->producer + 1] = slot;
+        translator->producer = -1;
+        operand->kind = OPERAND_COPY;
+        operand->index = slot;
+        translator->slots[slot].kind = OPERAND_IN_PLACE;
+        return;
+    }
+
+    protect(translator, slot);
+    switch (operand->kind){
+        case OPERAND_IN_PLACE:
+        case OPERAND_COPY:{
+            int b = read_slot(translator, value);
+            emit_result(translator, REG_MOVE, slot);
+            emit(translator, b);
+            break;
+        }
+        case OPERAND_CONSTANT:
+            emit_result(translator, REG_CONSTANT, slot);
+            emit(translator, operand->index);
+            break;
+        case OPERAND_NIL: emit_result(translator, REG_NIL, slot); break;
+        case OPERAND_TRUE: emit_result(translator, REG_TRUE, slot); break;
+        case OPERAND_FALSE: emit_result(translator, REG_FALSE, slot); break;
+    }
+    translator->slots[slot].kind = OPERAND_IN_PLACE;
+}
+
+static void binary(Translator* translator, uint8_t opcode, uint8_t constant_opcode){
+    int right = --translator->top;
+    int left = right - 1;
+    Operand* operand = &translator->slots[right];
+
+    if(operand->kind == OPERAND_CONSTANT){
+        int constant = operand->index;
+        int b = read_slot(translator, left);
+        emit_result(translator, constant_opcode, left);
+        emit(translator, b);
+        emit(translator, constant);
+    }else{
+        int b = read_slot(translator, left);
+        int c = read_slot(translator, right);
+        emit_result(translator, opcode, left);
+        emit(translator, b);
+        emit(translator, c);
+    }
+    translator->slots[left].kind = OPERAND_IN_PLACE;
+}
+
+/*
+    the local is updated where it sits, what's left on the stack is
+    just a copy of it
+*/
+static void update_local(Translator* translator, int slot, uint8_t opcode, uint8_t constant_opcode){
+    int right = translator->top - 1;
+    Operand* operand = &translator->slots[right];
+
+    materialize(translator, slot);
+    protect(translator, slot);
+    if(operand->kind == OPERAND_CONSTANT){
+        emit_instruction(translator, constant_opcode, slot);
+        emit(translator, slot);
+        emit(translator, operand->index);
+    }else{
+        int c = read_slot(translator, right);
+        emit_instruction(translator, opcode, slot);
+        emit(translator, slot);
+        emit(translator, c);
+    }
+    operand->kind = OPERAND_COPY;
+    operand->index = slot;
+}
+
+static void unary(Translator* translator, uint8_t opcode){
+    int slot = translator->top - 1;
+    int b = read_slot(translator, slot);
+    emit_result(translator, opcode, slot);
+    emit(translator, b);
+    translator->slots[slot].kind = OPERAND_IN_PLACE;
+}
+
+static void jump(Translator* translator, int index, uint8_t opcode, int condition){
+    translator->producer = -1;
+    emit(translator, opcode);
+    if(opcode == REG_JUMP_IF_FALSE) emit(translator, condition);
+
+    Patch* patch = &translator->patches[translator->patch_count++];
+    patch->at = translator->code->count;
+    patch->end = patch->at + 2;
+    patch->target = translator->listing.code[index].target;
+    emit(translator, 0xff);
+    emit(translator, 0xff);
+}
+
+static bool translate(Translator* translator){
+    Listing* listing = &translator->listing;
+    Chunk* chunk = listing->chunk;
+    bool live = false;
+    translator->producer = -1;
+    translator->line = listing->code[0].line;
+
+    for (int i = 0; i < listing->count; i++){
+        Instruction* instruction = &listing->code[i];
+        uint8_t* code = &chunk->code[instruction->offset];
+
+        /*every path into a jump target has its slots written out*/
+        if(live && instruction->is_target){
+            flush(translator, 0);
+            translator->producer = -1;
+        }
+        translator->label[i] = translator->code->count;
+
+        if(translator->depth[i] == -1){
+            live = false;
+            continue;
+        }
+        if(!live){
+            translator->top = translator->depth[i];
+            for (int slot = 0; slot < translator->top; slot++){
+                translator->slots[slot].kind = OPERAND_IN_PLACE;
+            }
+            translator->producer = -1;
+            live = true;
+        }
+        translator->line = instruction->line;
+
+        switch (code[0]){
+            case OP_CONSTANT: push_operand(translator, OPERAND_CONSTANT, code[1]); break;
+            case OP_NIL: push_operand(translator, OPERAND_NIL, 0); break;
+            case OP_TRUE: push_operand(translator, OPERAND_TRUE, 0); break;
+            case OP_FALSE: push_operand(translator, OPERAND_FALSE, 0); break;
+            case OP_GET_LOCAL:{
+                Operand local = translator->slots[code[1]];
+                if(local.kind == OPERAND_IN_PLACE){
+                    local.kind = OPERAND_COPY;
+                    local.index = code[1];
+                }
+                push_operand(translator, local.kind, local.index);
+                break;
+            }
+            case OP_SET_LOCAL: set_local(translator, code[1]); break;
+            case OP_POP: translator->top--; break;
+            case OP_GET_GLOBAL:
+                push_operand(translator, OPERAND_IN_PLACE, 0);
+                emit_result(translator, REG_GET_GLOBAL, translator->top - 1);
+                emit(translator, code[1]);
+                break;
+            case OP_SET_GLOBAL:
+            case OP_DEFINE_GLOBAL:{
+                int a = read_slot(translator, translator->top - 1);
+                emit_instruction(translator,
+                    code[0] == OP_SET_GLOBAL ? REG_SET_GLOBAL : REG_DEFINE_GLOBAL, a);
+                emit(translator, code[1]);
+                if(code[0] == OP_DEFINE_GLOBAL) translator->top--;
+                break;
+            }
+            case OP_ADD_LOCAL: update_local(translator, code[1], REG_ADD, REG_ADD_K); break;
+            case OP_SUBTRACT_LOCAL: update_local(translator, code[1], REG_SUBTRACT, REG_SUBTRACT_K); break;
+            case OP_MULTIPLY_LOCAL: update_local(translator, code[1], REG_MULTIPLY, REG_MULTIPLY_K); break;
+            case OP_DIVIDE_LOCAL: update_local(translator, code[1], REG_DIVIDE, REG_DIVIDE_K); break;
+            case OP_ADD_GLOBAL:
+            case OP_SUBTRACT_GLOBAL:
+            case OP_MULTIPLY_GLOBAL:
+            case OP_DIVIDE_GLOBAL:
+                /*the opcodes are in the same order in both sets*/
+                materialize(translator, translator->top - 1);
+                emit_instruction(translator, REG_ADD_GLOBAL + (code[0] - OP_ADD_GLOBAL),
+                    translator->top - 1);
+                emit(translator, code[1]);
+                break;
+            case OP_EQUAL: binary(translator, REG_EQUAL, REG_EQUAL_K); break;
+            case OP_NOT_EQUAL: binary(translator, REG_NOT_EQUAL, REG_NOT_EQUAL_K); break;
+            case OP_GREATER:
+            case OP_GREATER_NUMBER: binary(translator, REG_GREATER, REG_GREATER_K); break;
+            case OP_GREATER_EQUAL:
+            case OP_GREATER_EQUAL_NUMBER: binary(translator, REG_GREATER_EQUAL, REG_GREATER_EQUAL_K); break;
+            case OP_LESS:
+            case OP_LESS_NUMBER: binary(translator, REG_LESS, REG_LESS_K); break;
+            case OP_LESS_EQUAL:
+            case OP_LESS_EQUAL_NUMBER: binary(translator, REG_LESS_EQUAL, REG_LESS_EQUAL_K); break;
+            case OP_ADD:
+            case OP_ADD_NUMBER: binary(translator, REG_ADD, REG_ADD_K); break;
+            case OP_SUBTRACT:
+            case OP_SUBTRACT_NUMBER: binary(translator, REG_SUBTRACT, REG_SUBTRACT_K); break;
+            case OP_MULTIPLY:
+            case OP_MULTIPLY_NUMBER: binary(translator, REG_MULTIPLY, REG_MULTIPLY_K); break;
+            case OP_DIVIDE:
+            case OP_DIVIDE_NUMBER: binary(translator, REG_DIVIDE, REG_DIVIDE_K); break;
+            case OP_NOT: unary(translator, REG_NOT); break;
+            case OP_NEGATE: unary(translator, REG_NEGATE); break;
+            case OP_PRINT:
+                emit_instruction(translator, REG_PRINT, read_slot(translator, translator->top - 1));
+                translator->top--;
+                break;
+            case OP_RETURN:
+                emit_instruction(translator, REG_RETURN, read_slot(translator, translator->top - 1));
+                live = false;
+                break;
+            case OP_CALL:
+            case OP_CALL_GLOBAL:{
+                /*the callee's frame starts at `callee`, everything under it stays put*/
+                int callee = translator->top - code[1] - 1;
+                flush(translator, callee);
+                emit_instruction(translator, code[0] == OP_CALL ? REG_CALL : REG_CALL_GLOBAL, callee);
+                emit(translator, code[1]);
+                if(code[0] == OP_CALL_GLOBAL) emit(translator, code[2]);
+                translator->top = callee + 1;
+                break;
+            }
+            case OP_JUMP_IF_FALSE:
+                flush(translator, 0);
+                jump(translator, i, REG_JUMP_IF_FALSE, translator->top - 1);
+                break;
+            case OP_JUMP_IF_NOT_LESS:
+                /*a taken jump leaves the comparison's false in the slot*/
+                binary(translator, REG_LESS, REG_LESS_K);
+                flush(translator, 0);
+                jump(translator, i, REG_JUMP_IF_FALSE, translator->top - 1);
+                translator->top--;
+                break;
+            case OP_FOR_LOOP:
+            case OP_FOR_LOOP_K:{
+                /*the comparison goes where a taken jump leaves its false*/
+                int counter = code[3];
+                int condition = translator->top;
+                flush(translator, 0);
+                emit_instruction(translator, REG_ADD_K, counter);
+                emit(translator, counter);
+                emit(translator, code[5]);
+                emit_instruction(translator,
+                    code[0] == OP_FOR_LOOP ? REG_LESS : REG_LESS_K, condition);
+                emit(translator, counter);
+                emit(translator, code[4]);
+                jump(translator, i, REG_JUMP_IF_FALSE, condition);
+                break;
+            }
+            case OP_JUMP:
+            case OP_LOOP:
+                flush(translator, 0);
+                jump(translator, i, instruction->target > i ? REG_JUMP : REG_LOOP, 0);
+                live = false;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return !live;
+}
+
+static bool patch_jumps(Translator* translator){
+    uint8_t* code = translator->code->code;
+
+    for (int i = 0; i < translator->patch_count; i++){
+        Patch* patch = &translator->patches[i];
+        int jump = translator->label[patch->target] - patch->end;
+        if(jump < 0) jump = -jump;
+        if(jump > UINT16_MAX) return false;
+
+        code[patch->at] = (jump >> 8) & 0xff;
+        code[patch->at + 1] = jump & 0xff;
+    }
+    return true;
+}
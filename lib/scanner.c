@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "common.h"
@@ -22,6 +23,7 @@ static void skip_white_space();
 static char advance();
 static bool is_digit(char c);
 static Token number();
+static void add_digit(uint64_t* mantissa, int* digits, char c);
 static Token identifier();
 static bool match(char expected);
 static Token string();
@@ -33,9 +35,17 @@ static bool is_alpha(char c);
 static TokenType check_keyword(int start, int length, const char* rest, TokenType type);
 
 void init_scanner(const char* source){
+    init_scanner_at(source, 1);
+}
+
+/*
+    starts scanning part way into a file, for function bodies that
+    are compiled lazily
+*/
+void init_scanner_at(const char* source, int line){
     scanner.start = source;
     scanner.current = source;
-    scanner.line = 1;
+    scanner.line = line;
 }
 
 Token scan_token(){
@@ -54,13 +64,22 @@ Token scan_token(){
         case ')': return make_token(TOKEN_RIGHT_PAREN);
         case '{': return make_token(TOKEN_LEFT_BRACE);
         case '}': return make_token(TOKEN_RIGHT_BRACE);
+        case '[': return make_token(TOKEN_LEFT_BRACKET);
+        case ']': return make_token(TOKEN_RIGHT_BRACKET);
         case ';': return make_token(TOKEN_SEMICOLON);
+        case ':': return make_token(TOKEN_COLON);
         case ',': return make_token(TOKEN_COMMA);
         case '.': return make_token(TOKEN_DOT);
-        case '-': return make_token(TOKEN_MINUS);
-        case '+': return make_token(TOKEN_PLUS);
-        case '/': return make_token(TOKEN_SLASH);
-        case '*': return make_token(TOKEN_STAR);
+        case '-':
+            if(match('-')) return make_token(TOKEN_MINUS_MINUS);
+            return make_token(match('=') ? TOKEN_MINUS_EQUAL : TOKEN_MINUS);
+        case '+':
+            if(match('+')) return make_token(TOKEN_PLUS_PLUS);
+            return make_token(match('=') ? TOKEN_PLUS_EQUAL : TOKEN_PLUS);
+        case '/':
+            return make_token(match('=') ? TOKEN_SLASH_EQUAL : TOKEN_SLASH);
+        case '*':
+            return make_token(match('=') ? TOKEN_STAR_EQUAL : TOKEN_STAR);
         case '!':
             return make_token(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
         case '=':
@@ -80,16 +99,52 @@ Token scan_token(){
 /*
     picks up the number
 */
+/*every power of ten a double holds exactly*/
+static const double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*only the first 19 significant digits fit, past that the count is all that's kept*/
+static void add_digit(uint64_t* mantissa, int* digits, char c){
+    if(*mantissa == 0 && c == '0') return;
+    if(++*digits <= 19) *mantissa = *mantissa * 10 + (uint64_t)(c - '0');
+}
+
+/*
+    the value is worked out from the digits as they're scanned. a
+    whole number of up to 19 digits converts straight to a double, so
+    does one with up to 2^53 in digits and at most 22 after the point
+    once it's divided by the exact power of ten, both only round once.
+    anything longer goes to strtod
+*/
 static Token number(){
-    while(is_digit(peek())) advance();
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int fraction = 0;
+
+    /*scan_token() already took the first digit*/
+    add_digit(&mantissa, &digits, scanner.start[0]);
+    while(is_digit(peek())) add_digit(&mantissa, &digits, advance());
     /* pick up the fractional part */
     if(peek() == '.' && is_digit(peek_next())){
         /* consumes the "." */
         advance();
-        while (is_digit(peek())) advance();
+        while (is_digit(peek())){
+            add_digit(&mantissa, &digits, advance());
+            fraction++;
+        }
     }
 
-    return make_token(TOKEN_NUMBER);
+    Token token = make_token(TOKEN_NUMBER);
+    if(digits <= 19 && fraction == 0){
+        token.number = (double)mantissa;
+    }else if(digits <= 19 && mantissa <= ((uint64_t)1 << 53) && fraction <= 22){
+        token.number = (double)mantissa / exact_powers[fraction];
+    }else{
+        token.number = strtod(token.start, NULL);
+    }
+    return token;
 }
 /*
     scans strings
@@ -129,6 +184,7 @@ static void skip_white_space(){
                 }else{
                     return;
                 }
+                break;
             default:
                 return;
         }
@@ -143,7 +199,17 @@ static TokenType identifier_type(){
     switch (scanner.start[0])
     {
         case 'a': return check_keyword(1,2,"nd",TOKEN_AND);
-        case 'c': return check_keyword(1,4,"lass", TOKEN_CLASS);
+        case 'c':
+            if(scanner.current - scanner.start > 1){
+                switch (scanner.start[1])
+                {
+                    case 'a': return check_keyword(2,2,"se", TOKEN_CASE);
+                    case 'l': return check_keyword(2,3,"ass", TOKEN_CLASS);
+                    case 'o': return check_keyword(2,3,"nst", TOKEN_CONST);
+                }
+            }
+            break;
+        case 'd': return check_keyword(1,6,"efault", TOKEN_DEFAULT);
         case 'e': return check_keyword(1,3,"lse",TOKEN_ELSE);
         case 'f':
             if(scanner.current - scanner.start > 1){
@@ -159,7 +225,15 @@ static TokenType identifier_type(){
         case 'o': return check_keyword(1,1,"r", TOKEN_OR);
         case 'p': return check_keyword(1,4,"rint", TOKEN_PRINT);
         case 'r': return check_keyword(1,5,"eturn", TOKEN_RETURN);
-        case 's': return check_keyword(1,4,"uper", TOKEN_SUPER);
+        case 's':
+            if(scanner.current - scanner.start > 1){
+                switch (scanner.start[1])
+                {
+                    case 'u': return check_keyword(2,3,"per", TOKEN_SUPER);
+                    case 'w': return check_keyword(2,4,"itch", TOKEN_SWITCH);
+                }
+            }
+            break;
         case 't': 
             if (scanner.current - scanner.start > 1){
                 switch (scanner.start[1])
@@ -256,6 +330,7 @@ static Token make_token(TokenType type){
     token.start = scanner.start;
     token.length = (int)(scanner.current - scanner.start);
     token.line = scanner.line;
+    token.number = 0;
     return token;
 }
 /*
@@ -267,6 +342,7 @@ static Token error_token(const char* message){
     token.start = message;
     token.length = (int)strlen(message);
     token.line = scanner.line;
+    token.number = 0;
     return token;
 }
 
@@ -0,0 +1,165 @@
+#include "common.h"
+#include "simd.h"
+
+/*
+    the same loops for AVX, SSE2 or neither, picked by what the
+    compiler is targeting. the lanes are added or compared together
+    at the end and whatever doesn't fill a whole set of lanes is
+    done one at a time
+*/
+#if defined(SIMD_KERNELS) && defined(__AVX__)
+#include <immintrin.h>
+#define VECTOR_LANES 4
+typedef __m256d Lanes;
+#define lanes_load(pointer)         _mm256_loadu_pd(pointer)
+#define lanes_store(pointer, lanes) _mm256_storeu_pd(pointer, lanes)
+#define lanes_splat(number)         _mm256_set1_pd(number)
+#define lanes_add(a, b)             _mm256_add_pd(a, b)
+#define lanes_multiply(a, b)        _mm256_mul_pd(a, b)
+#define lanes_min(a, b)             _mm256_min_pd(a, b)
+#define lanes_max(a, b)             _mm256_max_pd(a, b)
+#elif defined(SIMD_KERNELS) && defined(__SSE2__)
+#include <emmintrin.h>
+#define VECTOR_LANES 2
+typedef __m128d Lanes;
+#define lanes_load(pointer)         _mm_loadu_pd(pointer)
+#define lanes_store(pointer, lanes) _mm_storeu_pd(pointer, lanes)
+#define lanes_splat(number)         _mm_set1_pd(number)
+#define lanes_add(a, b)             _mm_add_pd(a, b)
+#define lanes_multiply(a, b)        _mm_mul_pd(a, b)
+#define lanes_min(a, b)             _mm_min_pd(a, b)
+#define lanes_max(a, b)             _mm_max_pd(a, b)
+#endif
+
+/*
+    min and max skip NaNs, they're only the answer when there's
+    nothing else. the running value is never NaN, it starts at the
+    first number that isn't and only takes a new one that's strictly
+    smaller or bigger. the min and max instructions do the same with
+    the running value as their second operand
+*/
+static double smaller(double a, double b){
+    return a < b ? a : b;
+}
+
+static double bigger(double a, double b){
+    return a > b ? a : b;
+}
+
+/*-1 if they're all NaN*/
+static int first_number(const double* a, int count){
+    for (int i = 0; i < count; i++){
+        if(a[i] == a[i]) return i;
+    }
+    return -1;
+}
+
+#ifdef VECTOR_LANES
+static double add_lanes(Lanes lanes){
+    double parts[VECTOR_LANES];
+    lanes_store(parts, lanes);
+    double total = parts[0];
+    for (int i = 1; i < VECTOR_LANES; i++) total += parts[i];
+    return total;
+}
+#endif
+
+double vector_sum(const double* a, int count){
+    double total = 0;
+    int i = 0;
+#ifdef VECTOR_LANES
+    Lanes lanes = lanes_splat(0);
+    for (; i + VECTOR_LANES <= count; i += VECTOR_LANES){
+        lanes = lanes_add(lanes, lanes_load(&a[i]));
+    }
+    total = add_lanes(lanes);
+#endif
+    for (; i < count; i++) total += a[i];
+    return total;
+}
+
+double vector_dot(const double* a, const double* b, int count){
+    double total = 0;
+    int i = 0;
+#ifdef VECTOR_LANES
+    Lanes lanes = lanes_splat(0);
+    for (; i + VECTOR_LANES <= count; i += VECTOR_LANES){
+        lanes = lanes_add(lanes, lanes_multiply(lanes_load(&a[i]), lanes_load(&b[i])));
+    }
+    total = add_lanes(lanes);
+#endif
+    for (; i < count; i++) total += a[i] * b[i];
+    return total;
+}
+
+double vector_min(const double* a, int count){
+    int first = first_number(a, count);
+    if(first == -1) return a[0];
+    double result = a[first];
+    int i = first + 1;
+#ifdef VECTOR_LANES
+    if(count - i >= VECTOR_LANES){
+        Lanes lanes = lanes_splat(result);
+        for (; i + VECTOR_LANES <= count; i += VECTOR_LANES){
+            lanes = lanes_min(lanes_load(&a[i]), lanes);
+        }
+        double parts[VECTOR_LANES];
+        lanes_store(parts, lanes);
+        for (int j = 0; j < VECTOR_LANES; j++) result = smaller(parts[j], result);
+    }
+#endif
+    for (; i < count; i++) result = smaller(a[i], result);
+    return result;
+}
+
+double vector_max(const double* a, int count){
+    int first = first_number(a, count);
+    if(first == -1) return a[0];
+    double result = a[first];
+    int i = first + 1;
+#ifdef VECTOR_LANES
+    if(count - i >= VECTOR_LANES){
+        Lanes lanes = lanes_splat(result);
+        for (; i + VECTOR_LANES <= count; i += VECTOR_LANES){
+            lanes = lanes_max(lanes_load(&a[i]), lanes);
+        }
+        double parts[VECTOR_LANES];
+        lanes_store(parts, lanes);
+        for (int j = 0; j < VECTOR_LANES; j++) result = bigger(parts[j], result);
+    }
+#endif
+    for (; i < count; i++) result = bigger(a[i], result);
+    return result;
+}
+
+void vector_scale(double* out, const double* a, double k, int count){
+    int i = 0;
+#ifdef VECTOR_LANES
+    Lanes factor = lanes_splat(k);
+    for (; i + VECTOR_LANES <= count; i += VECTOR_LANES){
+        lanes_store(&out[i], lanes_multiply(lanes_load(&a[i]), factor));
+    }
+#endif
+    for (; i < count; i++) out[i] = a[i] * k;
+}
+
+void vector_add(double* out, const double* a, const double* b, int count){
+    int i = 0;
+#ifdef VECTOR_LANES
+    for (; i + VECTOR_LANES <= count; i += VECTOR_LANES){
+        lanes_store(&out[i], lanes_add(lanes_load(&a[i]), lanes_load(&b[i])));
+    }
+#endif
+    for (; i < count; i++) out[i] = a[i] + b[i];
+}
+
+void vector_add_scalar(double* out, const double* a, double k, int count){
+    int i = 0;
+#ifdef VECTOR_LANES
+    Lanes addend = lanes_splat(k);
+    for (; i + VECTOR_LANES <= count; i += VECTOR_LANES){
+        lanes_store(&out[i], lanes_add(lanes_load(&a[i]), addend));
+    }
+#endif
+    for (; i < count; i++) out[i] = a[i] + k;
+}
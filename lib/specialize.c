@@ -0,0 +1,387 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "chunk.h"
+#include "listing.h"
+#include "memory.h"
+#include "specialize.h"
+
+/*
+    works out which stack slots are certainly numbers ahead of every
+    instruction and swaps arithmetic and comparisons on two of them
+    for the unchecked opcodes.
+
+    only constants and the results of arithmetic count as numbers,
+    anything read from a global or returned by a call could be
+    anything since globals can be reassigned at any time, parameters
+    are unknown as well. a local is a number at some point if every
+    path there stored a number in it, unless a closure shares it and
+    could have stored anything in it since
+*/
+typedef struct{
+    Listing listing;
+    int* depth;
+    int* start;         // where each instruction's slots begin in `number`
+    bool* number;
+    bool* visited;
+    bool* queued;
+    int* worklist;
+    int work_count;
+    bool shared[UINT8_COUNT];   // slots some closure captured as CAPTURE_LOCAL
+} Inference;
+
+static uint8_t number_opcode(uint8_t opcode){
+    switch (opcode){
+        case OP_ADD:            return OP_ADD_NUMBER;
+        case OP_SUBTRACT:       return OP_SUBTRACT_NUMBER;
+        case OP_MULTIPLY:       return OP_MULTIPLY_NUMBER;
+        case OP_DIVIDE:         return OP_DIVIDE_NUMBER;
+        case OP_GREATER:        return OP_GREATER_NUMBER;
+        case OP_GREATER_EQUAL:  return OP_GREATER_EQUAL_NUMBER;
+        case OP_LESS:           return OP_LESS_NUMBER;
+        case OP_LESS_EQUAL:     return OP_LESS_EQUAL_NUMBER;
+        default:                return opcode;
+    }
+}
+
+static uint8_t checked_opcode(uint8_t opcode){
+    switch (opcode){
+        case OP_ADD_NUMBER:             return OP_ADD;
+        case OP_SUBTRACT_NUMBER:        return OP_SUBTRACT;
+        case OP_MULTIPLY_NUMBER:        return OP_MULTIPLY;
+        case OP_DIVIDE_NUMBER:          return OP_DIVIDE;
+        case OP_GREATER_NUMBER:         return OP_GREATER;
+        case OP_GREATER_EQUAL_NUMBER:   return OP_GREATER_EQUAL;
+        case OP_LESS_NUMBER:            return OP_LESS;
+        case OP_LESS_EQUAL_NUMBER:      return OP_LESS_EQUAL;
+        default:                        return opcode;
+    }
+}
+
+static void enqueue(Inference* inference, int index){
+    if(inference->queued[index]) return;
+    inference->queued[index] = true;
+    inference->worklist[inference->work_count++] = index;
+}
+
+/*
+    paths meeting at an instruction only agree on a number if all
+    of them have one there
+*/
+static void flow(Inference* inference, int index, bool* slots, int count){
+    if(index >= inference->listing.count || inference->depth[index] != count) return;
+    bool* number = &inference->number[inference->start[index]];
+
+    if(!inference->visited[index]){
+        inference->visited[index] = true;
+        memcpy(number, slots, sizeof(bool) * count);
+        enqueue(inference, index);
+        return;
+    }
+
+    bool changed = false;
+    for (int i = 0; i < count; i++){
+        if(number[i] && !slots[i]){
+            number[i] = false;
+            changed = true;
+        }
+    }
+    if(changed) enqueue(inference, index);
+}
+
+static void step(Inference* inference, int index, bool* slots){
+    Instruction* instruction = &inference->listing.code[index];
+    Chunk* chunk = inference->listing.chunk;
+    uint8_t* code = &chunk->code[instruction->offset];
+    int top = inference->depth[index];
+    memcpy(slots, &inference->number[inference->start[index]], sizeof(bool) * top);
+
+    int pops, pushes;
+    stack_effect(code, &pops, &pushes);
+    bool result = false;
+
+    switch (checked_opcode(code[0])){
+        case OP_CONSTANT:
+            result = IS_NUMBER(chunk->constants.values[code[1]]);
+            break;
+        case OP_GET_LOCAL:
+            result = slots[code[1]] && !inference->shared[code[1]];
+            break;
+        case OP_SET_LOCAL:
+            slots[code[1]] = slots[top - 1];
+            result = slots[top - 1];
+            break;
+        /*the counter is a number on both ways out, or it's an error*/
+        case OP_FOR_LOOP:
+        case OP_FOR_LOOP_K:
+            slots[code[3]] = true;
+            break;
+        case OP_ADD:
+            result = slots[top - 1] && slots[top - 2];
+            break;
+        case OP_ADD_LOCAL:
+            slots[code[1]] = slots[code[1]] && slots[top - 1];
+            result = slots[code[1]];
+            break;
+        case OP_SUBTRACT_LOCAL:
+        case OP_MULTIPLY_LOCAL:
+        case OP_DIVIDE_LOCAL:
+            slots[code[1]] = true;
+            result = true;
+            break;
+        /*these make a number or fail at runtime*/
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NEGATE:
+            result = true;
+            break;
+        default:
+            break;
+    }
+
+    top -= pops;
+    for (int i = 0; i < pushes; i++) slots[top++] = result;
+
+    switch (code[0]){
+        case OP_RETURN:
+            break;
+        case OP_JUMP:
+        case OP_LOOP:
+            flow(inference, instruction->target, slots, top);
+            break;
+        case OP_JUMP_IF_FALSE:
+            flow(inference, instruction->target, slots, top);
+            flow(inference, index + 1, slots, top);
+            break;
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_FOR_LOOP:
+        case OP_FOR_LOOP_K:
+            flow(inference, index + 1, slots, top);
+            slots[top] = false;
+            flow(inference, instruction->target, slots, top + 1);
+            break;
+        case OP_SWITCH:
+        case OP_SWITCH_HASH:
+            for (int k = 1; k <= jump_table_size(code); k++) flow(inference, index + k, slots, top);
+            break;
+        default:
+            flow(inference, index + 1, slots, top);
+            break;
+    }
+}
+
+static bool both_numbers(Inference* inference, int index){
+    int top = inference->depth[index];
+    bool* number = &inference->number[inference->start[index]];
+    return top >= 2 && number[top - 1] && number[top - 2];
+}
+
+/*
+    runs over a finished chunk after every other pass, `entry` is the
+    stack depth the chunk starts at. returns how many instructions
+    were specialized
+*/
+int specialize_chunk(Chunk* chunk, int entry){
+    if(chunk->count == 0) return 0;
+
+    Inference inference;
+    Listing* listing = &inference.listing;
+    init_listing(listing, chunk);
+    inference.depth = ALLOCATE(int, listing->count);
+    inference.start = ALLOCATE(int, listing->count);
+
+    int deepest = stack_depths(listing, entry, inference.depth);
+    if(deepest == -1){
+        FREE_ARRAY(int, inference.depth, listing->count);
+        FREE_ARRAY(int, inference.start, listing->count);
+        free_listing(listing);
+        return 0;
+    }
+
+    int total = 0;
+    for (int i = 0; i < listing->count; i++){
+        inference.start[i] = total;
+        if(inference.depth[i] > 0) total += inference.depth[i];
+    }
+    inference.number = ALLOCATE(bool, total);
+    inference.visited = ALLOCATE(bool, listing->count);
+    inference.queued = ALLOCATE(bool, listing->count);
+    inference.worklist = ALLOCATE(int, listing->count);
+    inference.work_count = 0;
+    for (int i = 0; i < listing->count; i++){
+        inference.visited[i] = false;
+        inference.queued[i] = false;
+    }
+    for (int i = 0; i < UINT8_COUNT; i++) inference.shared[i] = false;
+    for (int i = 0; i < listing->count; i++){
+        if(listing->code[i].opcode != OP_CLOSURE) continue;
+        uint8_t* captures = &chunk->code[listing->code[i].offset + 2];
+        for (int j = 0; 2 * j + 2 < listing->code[i].length; j++){
+            if(captures[2 * j] == CAPTURE_LOCAL) inference.shared[captures[2 * j + 1]] = true;
+        }
+    }
+
+    /*the function and its parameters could be anything*/
+    bool* slots = ALLOCATE(bool, deepest + 1);
+    for (int i = 0; i < entry; i++) slots[i] = false;
+    flow(&inference, 0, slots, entry);
+
+    while(inference.work_count > 0){
+        int index = inference.worklist[--inference.work_count];
+        inference.queued[index] = false;
+        step(&inference, index, slots);
+    }
+
+    int specialized = 0;
+    for (int i = 0; i < listing->count; i++){
+        Instruction* instruction = &listing->code[i];
+        if(!inference.visited[i] || !both_numbers(&inference, i)) continue;
+
+        uint8_t opcode = number_opcode(instruction->opcode);
+        if(opcode == instruction->opcode) continue;
+        instruction->opcode = opcode;
+        specialized++;
+    }
+
+    /*LESS_NUMBER JUMP_IF_FALSE POP, nothing may jump into the middle of it*/
+    for (int i = 0; i < listing->count; i++){
+        if(listing->code[i].target != -1) listing->code[listing->code[i].target].is_target = true;
+    }
+    for (int i = 0; i + 2 < listing->count; i++){
+        Instruction* compare = &listing->code[i];
+        Instruction* jump = &listing->code[i + 1];
+        Instruction* pop = &listing->code[i + 2];
+        if(compare->opcode != OP_LESS_NUMBER || jump->opcode != OP_JUMP_IF_FALSE ||
+            pop->opcode != OP_POP || jump->is_target || pop->is_target) continue;
+
+        compare->removed = true;
+        pop->removed = true;
+        jump->opcode = OP_JUMP_IF_NOT_LESS;
+    }
+
+    if(specialized > 0) rebuild_listing(listing);
+
+    FREE_ARRAY(bool, slots, deepest + 1);
+    FREE_ARRAY(int, inference.worklist, listing->count);
+    FREE_ARRAY(bool, inference.queued, listing->count);
+    FREE_ARRAY(bool, inference.visited, listing->count);
+    FREE_ARRAY(bool, inference.number, total);
+    FREE_ARRAY(int, inference.depth, listing->count);
+    FREE_ARRAY(int, inference.start, listing->count);
+    free_listing(listing);
+    return specialized;
+}
+
+static bool is_number_constant(Chunk* chunk, uint8_t* code){
+    return code[0] == OP_CONSTANT && IS_NUMBER(chunk->constants.values[code[1]]);
+}
+
+/*
+    the loop the compiler fuses and generalize_chunk() spells back
+    out, nothing may jump into the middle of it:
+
+        GET_LOCAL i, CONSTANT step, ADD, SET_LOCAL i, POP,
+        GET_LOCAL i, GET_LOCAL n or CONSTANT n, LESS, JUMP_IF_FALSE, POP
+*/
+static bool is_counting_step(Listing* listing, int index){
+    if(index + 10 > listing->count) return false;
+    Chunk* chunk = listing->chunk;
+    uint8_t* code[10];
+    for (int i = 0; i < 10; i++){
+        Instruction* instruction = &listing->code[index + i];
+        if(instruction->removed || (i > 0 && instruction->is_target)) return false;
+        code[i] = &chunk->code[instruction->offset];
+    }
+
+    uint8_t counter = code[0][1];
+    return code[0][0] == OP_GET_LOCAL && is_number_constant(chunk, code[1]) &&
+        code[2][0] == OP_ADD && code[3][0] == OP_SET_LOCAL && code[3][1] == counter &&
+        code[4][0] == OP_POP && code[5][0] == OP_GET_LOCAL && code[5][1] == counter &&
+        (code[6][0] == OP_GET_LOCAL || is_number_constant(chunk, code[6])) &&
+        code[7][0] == OP_LESS && code[8][0] == OP_JUMP_IF_FALSE && code[9][0] == OP_POP;
+}
+
+/*
+    fuses counting loops again after the optimizing tier, returns
+    how many it found
+*/
+int fuse_loops(Chunk* chunk){
+    if(chunk->count == 0) return 0;
+
+    Listing listing;
+    init_listing(&listing, chunk);
+    for (int i = 0; i < listing.count; i++){
+        if(listing.code[i].target != -1) listing.code[listing.code[i].target].is_target = true;
+    }
+
+    int fused = 0;
+    for (int i = 0; i < listing.count; i++){
+        if(!is_counting_step(&listing, i)) continue;
+
+        Instruction* step = &listing.code[i];
+        uint8_t* constant = &chunk->code[listing.code[i + 1].offset];
+        uint8_t* bound = &chunk->code[listing.code[i + 6].offset];
+        uint8_t operands[] = {0xff, 0xff, chunk->code[step->offset + 1], bound[1], constant[1]};
+
+        step->opcode = bound[0] == OP_GET_LOCAL ? OP_FOR_LOOP : OP_FOR_LOOP_K;
+        step->target = listing.code[i + 8].target;
+        replace_operands(&listing, i, operands, sizeof(operands));
+        for (int j = 1; j < 10; j++) listing.code[i + j].removed = true;
+        fused++;
+        i += 9;
+    }
+
+    if(fused > 0) rebuild_listing(&listing);
+    free_listing(&listing);
+    return fused;
+}
+
+/*
+    turns a specialized chunk back into the checked opcodes and fused
+    loops back into the code they stand for, the optimizing tier only
+    understands those and specializes again once it's done
+*/
+void generalize_chunk(Chunk* chunk){
+    Listing listing;
+    init_listing(&listing, chunk);
+    bool changed = false;
+
+    for (int i = 0; i < listing.count; i++){
+        Instruction* instruction = &listing.code[i];
+        uint8_t opcode = checked_opcode(instruction->opcode);
+
+        if(instruction->opcode == OP_JUMP_IF_NOT_LESS){
+            uint8_t compare = OP_LESS;
+            uint8_t pop = OP_POP;
+            splice_before(&listing, i, &compare, 1);
+            splice_after(&listing, i, &pop, 1);
+            opcode = OP_JUMP_IF_FALSE;
+        }
+
+        if(instruction->opcode == OP_FOR_LOOP || instruction->opcode == OP_FOR_LOOP_K){
+            uint8_t* operands = &chunk->code[instruction->offset];
+            uint8_t counter = operands[3];
+            uint8_t step[] = {
+                OP_GET_LOCAL, counter, OP_CONSTANT, operands[5], OP_ADD, OP_SET_LOCAL, counter, OP_POP,
+                OP_GET_LOCAL, counter,
+                instruction->opcode == OP_FOR_LOOP ? OP_GET_LOCAL : OP_CONSTANT, operands[4],
+                OP_LESS
+            };
+            uint8_t pop = OP_POP;
+            splice_before(&listing, i, step, sizeof(step));
+            splice_after(&listing, i, &pop, 1);
+            instruction->length = 3;
+            opcode = OP_JUMP_IF_FALSE;
+        }
+
+        if(opcode != instruction->opcode){
+            instruction->opcode = opcode;
+            changed = true;
+        }
+    }
+
+    if(changed) rebuild_listing(&listing);
+    free_listing(&listing);
+}
@@ -0,0 +1,1449 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "chunk.h"
+#include "debug.h"
+#include "listing.h"
+#include "memory.h"
+#include "object.h"
+#include "optimizer.h"
+#include "specialize.h"
+#include "ssa.h"
+#include "vm.h"
+
+/*
+    the optimizing tier, functions that got hot are lifted out of
+    their stack bytecode into SSA form: every stack slot, locals and
+    temporaries alike, holds a value and merge points get phis.
+
+    the analyses run on the SSA values (sparse conditional constant
+    propagation, type inference, value numbering, liveness) and the
+    results are lowered by editing the bytecode they were lifted
+    from, every edit keeps the stack layout intact:
+
+        - an operation with a constant result pops its operands and
+          pushes the constant, a dead one pushes nil instead
+        - an operation whose value already sits in a slot pops its
+          operands and reads that slot
+        - a test on a known condition becomes a jump or goes away
+        - an invariant operation in a loop is computed once in front
+          of it into a new slot, everything the loop does to the
+          slots above gets moved up by one
+
+    the peephole pass then folds the leftover PUSH POP pairs away and
+    drops what can't be reached anymore, the whole thing repeats
+    until nothing changes
+
+    only operations that are proven not to trap (by constant
+    propagation or by the types of their operands) are ever removed
+    or moved, so runtime errors happen where they always did
+*/
+
+#define MAX_ROUNDS 64
+
+typedef enum{
+    VALUE_ENTRY,        // whatever a slot held when the function was entered
+    VALUE_CONSTANT,
+    VALUE_PHI,
+    VALUE_OPERATION,    // arithmetic, comparisons, NOT, NEGATE
+    VALUE_UNKNOWN,      // results of calls and global reads
+} ValueKind;
+
+typedef enum{
+    LATTICE_UNDEFINED,  // not reached by executable code yet
+    LATTICE_CONSTANT,
+    LATTICE_VARYING,
+} Lattice;
+
+typedef enum{
+    INFERRED_NONE,
+    INFERRED_NIL,
+    INFERRED_BOOL,
+    INFERRED_NUMBER,
+    INFERRED_STRING,
+    INFERRED_ANY,
+} InferredType;
+
+typedef struct{
+    ValueKind kind;
+    uint8_t opcode;
+    int operands[2];
+    int operand_count;
+    int block;
+    int instruction;    // the instruction defining an operation
+    int incoming;       // a phi's values in Ssa.incoming, one per predecessor
+    int forward;        // what a redundant phi got replaced by, itself otherwise
+    Lattice lattice;
+    Value constant;
+    InferredType type;
+    int number;         // equal value numbers compute equal values
+    bool live;
+} SsaValue;
+
+typedef struct{
+    int first;          // instructions, both inclusive
+    int last;
+    int successors[2];  // falling through and jumping, -1 when there's none
+    int predecessors;   // range in Ssa.edges
+    int predecessor_count;
+    int depth;          // stack depth on entry
+    int entry;          // `depth` values in Ssa.states, what the slots hold on entry
+    int exit_depth;
+    int exit;
+    bool visited;
+    bool merge;
+    bool executable;
+} Block;
+
+typedef struct{
+    int block;
+    int result;         // the value it pushes, -1 if it pushes nothing
+    int condition;      // the value a JUMP_IF_FALSE tests
+} Step;
+
+typedef struct{
+    ObjFunction* function;
+    Chunk* chunk;
+    Listing listing;
+    Step* steps;
+    Block* blocks;
+    int block_count;
+    int* order;         // reachable blocks in reverse postorder
+    int order_count;
+    int* edges;
+    int edge_count;
+    SsaValue* values;
+    int value_count;
+    int value_capacity;
+    int* states;
+    int state_count;
+    int state_capacity;
+    int* incoming;
+    int incoming_count;
+    int incoming_capacity;
+    int* roots;         // values consumed by side effects
+    int root_count;
+    int root_capacity;
+} Ssa;
+
+static bool is_jump(uint8_t opcode){
+    return opcode == OP_JUMP || opcode == OP_JUMP_IF_FALSE || opcode == OP_LOOP;
+}
+
+static bool is_unconditional(uint8_t opcode){
+    return opcode == OP_JUMP || opcode == OP_LOOP;
+}
+
+static bool is_falsey(Value value){
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+/*numbers compare bit for bit so 0 and -0 stay apart*/
+static bool same_constant(Value a, Value b){
+    if(IS_NUMBER(a) && IS_NUMBER(b)){
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+    return values_equal(a, b);
+}
+
+static int reserve(int** array, int* count, int* capacity, int amount){
+    if(*capacity < *count + amount){
+        int old_capacity = *capacity;
+        int new_capacity = GROW_CAPACITY(old_capacity);
+        while(new_capacity < *count + amount) new_capacity *= 2;
+        *array = GROW_ARRAY(int, *array, old_capacity, new_capacity);
+        *capacity = new_capacity;
+    }
+
+    int start = *count;
+    *count += amount;
+    return start;
+}
+
+static int new_value(Ssa* ssa, ValueKind kind, int block){
+    if(ssa->value_capacity < ssa->value_count + 1){
+        int old_capacity = ssa->value_capacity;
+        ssa->value_capacity = GROW_CAPACITY(old_capacity);
+        ssa->values = GROW_ARRAY(SsaValue, ssa->values, old_capacity, ssa->value_capacity);
+    }
+
+    int index = ssa->value_count++;
+    SsaValue* value = &ssa->values[index];
+    value->kind = kind;
+    value->opcode = 0;
+    value->operand_count = 0;
+    value->block = block;
+    value->instruction = -1;
+    value->incoming = -1;
+    value->forward = index;
+    value->lattice = kind == VALUE_ENTRY || kind == VALUE_UNKNOWN ?
+        LATTICE_VARYING : LATTICE_UNDEFINED;
+    value->constant = NIL_VAL;
+    value->type = INFERRED_NONE;
+    value->number = index;
+    value->live = false;
+    return index;
+}
+
+static int new_constant(Ssa* ssa, int block, Value constant){
+    int index = new_value(ssa, VALUE_CONSTANT, block);
+    ssa->values[index].lattice = LATTICE_CONSTANT;
+    ssa->values[index].constant = constant;
+    return index;
+}
+
+static int new_operation(Ssa* ssa, int block, int instruction, uint8_t opcode,
+                        int* operands, int operand_count){
+    int index = new_value(ssa, VALUE_OPERATION, block);
+    SsaValue* value = &ssa->values[index];
+    value->opcode = opcode;
+    value->instruction = instruction;
+    value->operand_count = operand_count;
+    for (int i = 0; i < operand_count; i++) value->operands[i] = operands[i];
+    return index;
+}
+
+static void add_root(Ssa* ssa, int value){
+    int index = reserve(&ssa->roots, &ssa->root_count, &ssa->root_capacity, 1);
+    ssa->roots[index] = value;
+}
+
+static int find(Ssa* ssa, int value){
+    while(ssa->values[value].forward != value) value = ssa->values[value].forward;
+    return value;
+}
+
+static bool build_blocks(Ssa* ssa){
+    Listing* listing = &ssa->listing;
+    int count = listing->count;
+    bool* leader = ALLOCATE(bool, count + 1);
+    bool ok = true;
+
+    for (int i = 0; i <= count; i++) leader[i] = i == 0;
+    for (int i = 0; i < count; i++){
+        Instruction* instruction = &listing->code[i];
+        if(instruction->target >= count) ok = false;
+        if(instruction->target != -1 && instruction->target < count){
+            leader[instruction->target] = true;
+        }
+        if(is_jump(instruction->opcode) || instruction->opcode == OP_RETURN){
+            leader[i + 1] = true;
+        }
+    }
+
+    ssa->block_count = 0;
+    for (int i = 0; i < count; i++) if(leader[i]) ssa->block_count++;
+    ssa->blocks = ALLOCATE(Block, ssa->block_count);
+
+    int b = -1;
+    for (int i = 0; i < count; i++){
+        if(leader[i]){
+            Block* block = &ssa->blocks[++b];
+            block->first = i;
+            block->depth = -1;
+            block->exit_depth = -1;
+            block->visited = false;
+            block->merge = false;
+            block->executable = false;
+            block->predecessor_count = 0;
+        }
+        ssa->blocks[b].last = i;
+        ssa->steps[i].block = b;
+        ssa->steps[i].result = -1;
+        ssa->steps[i].condition = -1;
+    }
+
+    for (b = 0; b < ssa->block_count && ok; b++){
+        Block* block = &ssa->blocks[b];
+        Instruction* last = &listing->code[block->last];
+        block->successors[0] = -1;
+        block->successors[1] = -1;
+
+        if(last->target != -1) block->successors[1] = ssa->steps[last->target].block;
+        if(last->opcode != OP_RETURN && !is_unconditional(last->opcode)){
+            /*running off the end of the code, nothing we understand*/
+            if(block->last + 1 >= count){
+                ok = false;
+                break;
+            }
+            block->successors[0] = ssa->steps[block->last + 1].block;
+        }
+    }
+
+    FREE_ARRAY(bool, leader, count + 1);
+    return ok;
+}
+
+/*depth first from the entry, the reverse postorder puts every block after its dominators*/
+static void order_blocks(Ssa* ssa){
+    int* stack = ALLOCATE(int, ssa->block_count);
+    int* next = ALLOCATE(int, ssa->block_count);
+    int* postorder = ALLOCATE(int, ssa->block_count);
+    int top = 0;
+    int post_count = 0;
+
+    stack[top++] = 0;
+    next[0] = 0;
+    ssa->blocks[0].visited = true;
+
+    while(top > 0){
+        int b = stack[top - 1];
+        if(next[b] < 2){
+            int successor = ssa->blocks[b].successors[next[b]++];
+            if(successor != -1 && !ssa->blocks[successor].visited){
+                ssa->blocks[successor].visited = true;
+                next[successor] = 0;
+                stack[top++] = successor;
+            }
+            continue;
+        }
+        postorder[post_count++] = b;
+        top--;
+    }
+
+    ssa->order = ALLOCATE(int, ssa->block_count);
+    ssa->order_count = post_count;
+    for (int i = 0; i < post_count; i++) ssa->order[i] = postorder[post_count - 1 - i];
+
+    /*predecessor lists, only edges between reachable blocks count*/
+    ssa->edge_count = 0;
+    for (int i = 0; i < post_count; i++){
+        Block* block = &ssa->blocks[postorder[i]];
+        for (int k = 0; k < 2; k++){
+            if(block->successors[k] == -1) continue;
+            ssa->blocks[block->successors[k]].predecessor_count++;
+            ssa->edge_count++;
+        }
+    }
+
+    ssa->edges = ALLOCATE(int, ssa->edge_count);
+    int start = 0;
+    for (int b = 0; b < ssa->block_count; b++){
+        ssa->blocks[b].predecessors = start;
+        start += ssa->blocks[b].predecessor_count;
+        ssa->blocks[b].predecessor_count = 0;
+    }
+    for (int i = 0; i < post_count; i++){
+        int b = ssa->order[i];
+        Block* block = &ssa->blocks[b];
+        for (int k = 0; k < 2; k++){
+            if(block->successors[k] == -1) continue;
+            Block* successor = &ssa->blocks[block->successors[k]];
+            ssa->edges[successor->predecessors + successor->predecessor_count++] = b;
+        }
+    }
+
+    FREE_ARRAY(int, stack, ssa->block_count);
+    FREE_ARRAY(int, next, ssa->block_count);
+    FREE_ARRAY(int, postorder, ssa->block_count);
+}
+
+/*the entry block has the function's own entry as an extra predecessor*/
+static int source_count(Ssa* ssa, int b){
+    return ssa->blocks[b].predecessor_count + (b == 0 ? 1 : 0);
+}
+
+static int stack_pops(Chunk* chunk, Instruction* instruction){
+    switch (instruction->opcode){
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+            return 2;
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_PRINT:
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_RETURN:
+        case OP_ADD_LOCAL:
+        case OP_SUBTRACT_LOCAL:
+        case OP_MULTIPLY_LOCAL:
+        case OP_DIVIDE_LOCAL:
+        case OP_ADD_GLOBAL:
+        case OP_SUBTRACT_GLOBAL:
+        case OP_MULTIPLY_GLOBAL:
+        case OP_DIVIDE_GLOBAL:
+            return 1;
+        case OP_CALL:
+        case OP_CALL_GLOBAL:
+            return chunk->code[instruction->offset + 1] + 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+    runs one block over the stack of SSA values, anything the tier
+    doesn't know about makes it give up on the function
+*/
+static bool simulate(Ssa* ssa, int b, int* stack, int* depth_out){
+    Block* block = &ssa->blocks[b];
+    Chunk* chunk = ssa->chunk;
+    int depth = block->depth;
+
+    for (int s = 0; s < depth; s++) stack[s] = ssa->states[block->entry + s];
+
+    for (int i = block->first; i <= block->last; i++){
+        Instruction* instruction = &ssa->listing.code[i];
+        /*a RETURN can be the chunk's last byte, it has nothing after it*/
+        uint8_t operand = instruction->length > 1 ? chunk->code[instruction->offset + 1] : 0;
+        Step* step = &ssa->steps[i];
+        int pops = stack_pops(chunk, instruction);
+        if(pops > depth) return false;
+
+        switch (instruction->opcode){
+            case OP_CONSTANT:
+                step->result = new_constant(ssa, b, chunk->constants.values[operand]);
+                break;
+            case OP_NIL:    step->result = new_constant(ssa, b, NIL_VAL); break;
+            case OP_TRUE:   step->result = new_constant(ssa, b, BOOL_VAL(true)); break;
+            case OP_FALSE:  step->result = new_constant(ssa, b, BOOL_VAL(false)); break;
+            case OP_GET_LOCAL:
+                if(operand >= depth) return false;
+                step->result = stack[operand];
+                break;
+            case OP_SET_LOCAL:
+                if(operand >= depth || depth == 0) return false;
+                stack[operand] = stack[depth - 1];
+                break;
+            case OP_EQUAL:
+            case OP_NOT_EQUAL:
+            case OP_GREATER:
+            case OP_GREATER_EQUAL:
+            case OP_LESS:
+            case OP_LESS_EQUAL:
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+            case OP_NOT:
+            case OP_NEGATE:
+                step->result = new_operation(ssa, b, i, instruction->opcode,
+                                            &stack[depth - pops], pops);
+                break;
+            case OP_GET_GLOBAL:
+                step->result = new_value(ssa, VALUE_UNKNOWN, b);
+                break;
+            /*the updated local holds a value nothing is known about*/
+            case OP_ADD_LOCAL:
+            case OP_SUBTRACT_LOCAL:
+            case OP_MULTIPLY_LOCAL:
+            case OP_DIVIDE_LOCAL:
+                if(operand >= depth - 1) return false;
+                add_root(ssa, stack[operand]);
+                add_root(ssa, stack[depth - 1]);
+                step->result = new_value(ssa, VALUE_UNKNOWN, b);
+                stack[operand] = step->result;
+                break;
+            case OP_ADD_GLOBAL:
+            case OP_SUBTRACT_GLOBAL:
+            case OP_MULTIPLY_GLOBAL:
+            case OP_DIVIDE_GLOBAL:
+                add_root(ssa, stack[depth - 1]);
+                step->result = new_value(ssa, VALUE_UNKNOWN, b);
+                break;
+            case OP_CALL:
+            case OP_CALL_GLOBAL:
+                for (int k = 1; k <= pops; k++) add_root(ssa, stack[depth - k]);
+                step->result = new_value(ssa, VALUE_UNKNOWN, b);
+                break;
+            case OP_PRINT:
+            case OP_DEFINE_GLOBAL:
+            case OP_RETURN:
+                add_root(ssa, stack[depth - 1]);
+                break;
+            case OP_SET_GLOBAL:
+                if(depth == 0) return false;
+                add_root(ssa, stack[depth - 1]);
+                break;
+            case OP_JUMP_IF_FALSE:
+                if(depth == 0) return false;
+                step->condition = stack[depth - 1];
+                add_root(ssa, step->condition);
+                break;
+            case OP_POP:
+            case OP_JUMP:
+            case OP_LOOP:
+                break;
+            default:
+                return false;
+        }
+
+        depth -= pops;
+        if(step->result != -1) stack[depth++] = step->result;
+    }
+
+    *depth_out = depth;
+    return true;
+}
+
+static bool lift(Ssa* ssa){
+    ObjFunction* function = ssa->function;
+    int* stack = ALLOCATE(int, function->arity + 1 + ssa->listing.count);
+    bool ok = true;
+
+    for (int n = 0; n < ssa->order_count && ok; n++){
+        int b = ssa->order[n];
+        Block* block = &ssa->blocks[b];
+        Block* from = NULL;
+
+        if(b == 0){
+            block->depth = function->arity + 1;
+        }else{
+            for (int k = 0; k < block->predecessor_count; k++){
+                Block* predecessor = &ssa->blocks[ssa->edges[block->predecessors + k]];
+                if(predecessor->exit_depth != -1){
+                    from = predecessor;
+                    break;
+                }
+            }
+            if(from == NULL){
+                ok = false;
+                break;
+            }
+            block->depth = from->exit_depth;
+        }
+
+        int sources = source_count(ssa, b);
+        block->merge = sources > 1;
+        block->entry = reserve(&ssa->states, &ssa->state_count,
+                                &ssa->state_capacity, block->depth);
+
+        for (int s = 0; s < block->depth; s++){
+            int value;
+            if(block->merge){
+                value = new_value(ssa, VALUE_PHI, b);
+                int incoming = reserve(&ssa->incoming, &ssa->incoming_count,
+                                        &ssa->incoming_capacity, sources);
+                ssa->values[value].incoming = incoming;
+            }else if(b == 0){
+                value = new_value(ssa, VALUE_ENTRY, b);
+            }else{
+                value = ssa->states[from->exit + s];
+            }
+            ssa->states[block->entry + s] = value;
+        }
+
+        int depth;
+        ok = simulate(ssa, b, stack, &depth);
+        if(!ok) break;
+
+        block->exit = reserve(&ssa->states, &ssa->state_count,
+                                &ssa->state_capacity, depth);
+        block->exit_depth = depth;
+        for (int s = 0; s < depth; s++) ssa->states[block->exit + s] = stack[s];
+    }
+
+    /*every predecessor is done now, the phis can be filled in*/
+    for (int n = 0; n < ssa->order_count && ok; n++){
+        int b = ssa->order[n];
+        Block* block = &ssa->blocks[b];
+        if(!block->merge) continue;
+
+        for (int s = 0; s < block->depth; s++){
+            int k = ssa->values[ssa->states[block->entry + s]].incoming;
+            if(b == 0) ssa->incoming[k++] = new_value(ssa, VALUE_ENTRY, b);
+            for (int p = 0; p < block->predecessor_count; p++){
+                Block* predecessor = &ssa->blocks[ssa->edges[block->predecessors + p]];
+                if(predecessor->exit_depth != block->depth){
+                    ok = false;
+                    break;
+                }
+                ssa->incoming[k++] = ssa->states[predecessor->exit + s];
+            }
+            if(!ok) break;
+        }
+    }
+
+    FREE_ARRAY(int, stack, function->arity + 1 + ssa->listing.count);
+    return ok;
+}
+
+/*
+    a phi whose inputs are all the same value (or itself, round a
+    loop) is just that value
+*/
+static void remove_redundant_phis(Ssa* ssa){
+    bool changed = true;
+    while(changed){
+        changed = false;
+        for (int v = 0; v < ssa->value_count; v++){
+            SsaValue* phi = &ssa->values[v];
+            if(phi->kind != VALUE_PHI || phi->forward != v) continue;
+
+            int same = -1;
+            bool redundant = true;
+            int sources = source_count(ssa, phi->block);
+            for (int k = 0; k < sources; k++){
+                int input = find(ssa, ssa->incoming[phi->incoming + k]);
+                if(input == v || input == same) continue;
+                if(same != -1){
+                    redundant = false;
+                    break;
+                }
+                same = input;
+            }
+
+            if(redundant && same != -1){
+                phi->forward = same;
+                changed = true;
+            }
+        }
+    }
+}
+
+static bool fold(uint8_t opcode, Value a, Value b, Value* result){
+    switch (opcode){
+        case OP_EQUAL:      *result = BOOL_VAL(values_equal(a, b)); return true;
+        case OP_NOT_EQUAL:  *result = BOOL_VAL(!values_equal(a, b)); return true;
+        case OP_NOT:        *result = BOOL_VAL(is_falsey(a)); return true;
+        case OP_NEGATE:
+            if(!IS_NUMBER(a)) return false;
+            *result = NUMBER_VAL(-AS_NUMBER(a));
+            return true;
+        case OP_ADD:
+            if(IS_STRING(a) && IS_STRING(b)){
+                ObjString* left = AS_STRING(a);
+                ObjString* right = AS_STRING(b);
+                int length = left->length + right->length;
+                char* chars = ALLOCATE(char, length + 1);
+                memcpy(chars, left->chars, left->length);
+                memcpy(chars + left->length, right->chars, right->length);
+                chars[length] = '\0';
+                *result = OBJ_VAL(take_string(chars, length));
+                return true;
+            }
+            break;
+        default:
+            break;
+    }
+
+    if(!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+
+    switch (opcode){
+        case OP_GREATER:        *result = BOOL_VAL(x > y); break;
+        case OP_GREATER_EQUAL:  *result = BOOL_VAL(!(x < y)); break;
+        case OP_LESS:           *result = BOOL_VAL(x < y); break;
+        case OP_LESS_EQUAL:     *result = BOOL_VAL(!(x > y)); break;
+        case OP_ADD:            *result = NUMBER_VAL(x + y); break;
+        case OP_SUBTRACT:       *result = NUMBER_VAL(x - y); break;
+        case OP_MULTIPLY:       *result = NUMBER_VAL(x * y); break;
+        case OP_DIVIDE:         *result = NUMBER_VAL(x / y); break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+static bool lower_lattice(SsaValue* value, Lattice lattice, Value constant){
+    if(value->lattice == LATTICE_VARYING || lattice == LATTICE_UNDEFINED) return false;
+
+    if(lattice == LATTICE_CONSTANT && value->lattice == LATTICE_UNDEFINED){
+        value->lattice = LATTICE_CONSTANT;
+        value->constant = constant;
+        return true;
+    }
+    if(lattice == LATTICE_CONSTANT && same_constant(value->constant, constant)) return false;
+
+    value->lattice = LATTICE_VARYING;
+    return true;
+}
+
+static bool edge_executable(Ssa* ssa, int from, int to){
+    Block* block = &ssa->blocks[from];
+    if(!block->executable) return false;
+
+    int condition = ssa->steps[block->last].condition;
+    if(condition == -1) return true;
+
+    SsaValue* value = &ssa->values[find(ssa, condition)];
+    switch (value->lattice){
+        case LATTICE_UNDEFINED: return false;
+        case LATTICE_VARYING:   return true;
+        default:
+            return block->successors[is_falsey(value->constant) ? 1 : 0] == to;
+    }
+}
+
+/*whether the k-th input of a phi in block b can actually arrive*/
+static bool incoming_executable(Ssa* ssa, int b, int k){
+    if(b == 0){
+        if(k == 0) return true;
+        k--;
+    }
+    Block* block = &ssa->blocks[b];
+    return edge_executable(ssa, ssa->edges[block->predecessors + k], b);
+}
+
+/*
+    sparse conditional constant propagation, branches on known
+    conditions only make one side executable and phis only look at
+    the edges that can run
+*/
+static void propagate_constants(Ssa* ssa){
+    ssa->blocks[0].executable = true;
+
+    bool changed = true;
+    while(changed){
+        changed = false;
+
+        for (int n = 0; n < ssa->order_count; n++){
+            int b = ssa->order[n];
+            Block* block = &ssa->blocks[b];
+            if(!block->executable) continue;
+
+            if(block->merge){
+                int sources = source_count(ssa, b);
+                for (int s = 0; s < block->depth; s++){
+                    int v = ssa->states[block->entry + s];
+                    if(ssa->values[v].forward != v) continue;
+
+                    for (int k = 0; k < sources; k++){
+                        if(!incoming_executable(ssa, b, k)) continue;
+                        SsaValue* input = &ssa->values[find(ssa, ssa->incoming[ssa->values[v].incoming + k])];
+                        changed |= lower_lattice(&ssa->values[v], input->lattice, input->constant);
+                    }
+                }
+            }
+
+            for (int i = block->first; i <= block->last; i++){
+                int v = ssa->steps[i].result;
+                if(v == -1 || ssa->values[v].instruction != i) continue;
+
+                SsaValue* value = &ssa->values[v];
+                Lattice lattice = LATTICE_CONSTANT;
+                Value operands[2] = {NIL_VAL, NIL_VAL};
+                for (int k = 0; k < value->operand_count; k++){
+                    SsaValue* operand = &ssa->values[find(ssa, value->operands[k])];
+                    if(operand->lattice == LATTICE_VARYING) lattice = LATTICE_VARYING;
+                    else if(operand->lattice == LATTICE_UNDEFINED && lattice == LATTICE_CONSTANT){
+                        lattice = LATTICE_UNDEFINED;
+                    }
+                    operands[k] = operand->constant;
+                }
+
+                Value result = NIL_VAL;
+                if(lattice == LATTICE_CONSTANT &&
+                    !fold(value->opcode, operands[0], operands[1], &result)){
+                    lattice = LATTICE_VARYING;
+                }
+                changed |= lower_lattice(value, lattice, result);
+            }
+
+            for (int k = 0; k < 2; k++){
+                int successor = block->successors[k];
+                if(successor == -1 || ssa->blocks[successor].executable) continue;
+                if(!edge_executable(ssa, b, successor)) continue;
+                ssa->blocks[successor].executable = true;
+                changed = true;
+            }
+        }
+    }
+}
+
+static InferredType type_of_constant(Value value){
+    switch (value.type){
+        case VAL_NIL:       return INFERRED_NIL;
+        case VAL_BOOL:      return INFERRED_BOOL;
+        case VAL_NUMBER:    return INFERRED_NUMBER;
+        default:
+            return IS_STRING(value) ? INFERRED_STRING : INFERRED_ANY;
+    }
+}
+
+static InferredType join_types(InferredType a, InferredType b){
+    if(a == INFERRED_NONE) return b;
+    if(b == INFERRED_NONE || a == b) return a;
+    return INFERRED_ANY;
+}
+
+static InferredType operand_type(Ssa* ssa, SsaValue* value, int k){
+    return ssa->values[find(ssa, value->operands[k])].type;
+}
+
+/*what an operation leaves behind, provided it didn't trap*/
+static InferredType operation_type(Ssa* ssa, SsaValue* value){
+    switch (value->opcode){
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NEGATE:
+            return INFERRED_NUMBER;
+        case OP_ADD:{
+            InferredType a = operand_type(ssa, value, 0);
+            InferredType b = operand_type(ssa, value, 1);
+            if(a == INFERRED_NONE || b == INFERRED_NONE) return INFERRED_NONE;
+            if(a == b && (a == INFERRED_NUMBER || a == INFERRED_STRING)) return a;
+            return INFERRED_ANY;
+        }
+        default:
+            return INFERRED_BOOL;
+    }
+}
+
+static void infer_types(Ssa* ssa){
+    /*nothing is known about arguments, calls and globals*/
+    for (int v = 0; v < ssa->value_count; v++){
+        SsaValue* value = &ssa->values[v];
+        if(value->kind == VALUE_ENTRY || value->kind == VALUE_UNKNOWN) value->type = INFERRED_ANY;
+    }
+
+    bool changed = true;
+    while(changed){
+        changed = false;
+
+        for (int n = 0; n < ssa->order_count; n++){
+            int b = ssa->order[n];
+            Block* block = &ssa->blocks[b];
+            if(!block->executable) continue;
+
+            int sources = source_count(ssa, b);
+            for (int s = 0; s < block->depth && block->merge; s++){
+                int v = ssa->states[block->entry + s];
+                SsaValue* value = &ssa->values[v];
+                if(value->forward != v) continue;
+
+                InferredType type = value->type;
+                if(value->lattice == LATTICE_CONSTANT){
+                    type = type_of_constant(value->constant);
+                }else{
+                    for (int k = 0; k < sources; k++){
+                        if(!incoming_executable(ssa, b, k)) continue;
+                        int input = find(ssa, ssa->incoming[value->incoming + k]);
+                        type = join_types(type, ssa->values[input].type);
+                    }
+                }
+                if(type != value->type){
+                    value->type = type;
+                    changed = true;
+                }
+            }
+
+            for (int i = block->first; i <= block->last; i++){
+                int v = ssa->steps[i].result;
+                if(v == -1) continue;
+                SsaValue* value = &ssa->values[v];
+
+                InferredType type;
+                if(value->lattice == LATTICE_CONSTANT){
+                    type = type_of_constant(value->constant);
+                }else if(value->kind == VALUE_OPERATION){
+                    type = join_types(value->type, operation_type(ssa, value));
+                }else{
+                    continue;
+                }
+                if(type != value->type){
+                    value->type = type;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+/*an operation that can't raise a runtime error with these operand types*/
+static bool cannot_trap(Ssa* ssa, SsaValue* value){
+    if(value->lattice == LATTICE_CONSTANT) return true;
+
+    switch (value->opcode){
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_NOT:
+            return true;
+        case OP_NEGATE:
+            return operand_type(ssa, value, 0) == INFERRED_NUMBER;
+        case OP_ADD:{
+            InferredType a = operand_type(ssa, value, 0);
+            InferredType b = operand_type(ssa, value, 1);
+            return a == b && (a == INFERRED_NUMBER || a == INFERRED_STRING);
+        }
+        default:
+            return operand_type(ssa, value, 0) == INFERRED_NUMBER &&
+                operand_type(ssa, value, 1) == INFERRED_NUMBER;
+    }
+}
+
+static int number_of(Ssa* ssa, int value){
+    return ssa->values[find(ssa, value)].number;
+}
+
+/*
+    operations with the same opcode over the same numbered operands
+    get the same number, a hash table keyed on those finds the first
+*/
+static void number_values(Ssa* ssa){
+    int capacity = 16;
+    while(capacity < ssa->value_count * 2) capacity *= 2;
+    int* table = ALLOCATE(int, capacity);
+    for (int i = 0; i < capacity; i++) table[i] = -1;
+
+    for (int v = 0; v < ssa->value_count; v++){
+        SsaValue* value = &ssa->values[v];
+        value->number = v;
+        if(value->kind != VALUE_OPERATION) continue;
+
+        int a = number_of(ssa, value->operands[0]);
+        int b = value->operand_count > 1 ? number_of(ssa, value->operands[1]) : -1;
+        uint32_t hash = (uint32_t)value->opcode * 31u + (uint32_t)a * 16777619u + (uint32_t)b;
+        uint32_t index = hash & (capacity - 1);
+
+        for (;;){
+            int other = table[index];
+            if(other == -1){
+                table[index] = v;
+                break;
+            }
+            SsaValue* candidate = &ssa->values[other];
+            if(candidate->opcode == value->opcode &&
+                number_of(ssa, candidate->operands[0]) == a &&
+                (candidate->operand_count > 1 ? number_of(ssa, candidate->operands[1]) : -1) == b){
+                value->number = candidate->number;
+                break;
+            }
+            index = (index + 1) & (capacity - 1);
+        }
+    }
+
+    FREE_ARRAY(int, table, capacity);
+}
+
+static void mark_live(Ssa* ssa, int* work, int* work_count, int v){
+    v = find(ssa, v);
+    if(ssa->values[v].live) return;
+    ssa->values[v].live = true;
+    work[(*work_count)++] = v;
+}
+
+/*
+    a value is live when a side effect consumes it, or an operation
+    that has to stay (because it might trap) or a live phi does
+*/
+static void find_live(Ssa* ssa){
+    int* work = ALLOCATE(int, ssa->value_count);
+    int work_count = 0;
+
+    for (int i = 0; i < ssa->root_count; i++) mark_live(ssa, work, &work_count, ssa->roots[i]);
+    for (int v = 0; v < ssa->value_count; v++){
+        SsaValue* value = &ssa->values[v];
+        if(value->kind == VALUE_OPERATION && ssa->blocks[value->block].executable &&
+            !cannot_trap(ssa, value)){
+            mark_live(ssa, work, &work_count, v);
+        }
+    }
+
+    while(work_count > 0){
+        SsaValue* value = &ssa->values[work[--work_count]];
+        if(value->kind == VALUE_OPERATION && value->lattice != LATTICE_CONSTANT){
+            for (int k = 0; k < value->operand_count; k++){
+                mark_live(ssa, work, &work_count, value->operands[k]);
+            }
+        }else if(value->kind == VALUE_PHI){
+            int sources = source_count(ssa, value->block);
+            for (int k = 0; k < sources; k++){
+                mark_live(ssa, work, &work_count, ssa->incoming[value->incoming + k]);
+            }
+        }
+    }
+
+    FREE_ARRAY(int, work, ssa->value_count);
+}
+
+static bool analyze(Ssa* ssa, ObjFunction* function, Chunk* chunk){
+    memset(ssa, 0, sizeof(Ssa));
+    ssa->function = function;
+    ssa->chunk = chunk;
+    init_listing(&ssa->listing, chunk);
+    ssa->steps = ALLOCATE(Step, ssa->listing.count);
+
+    if(ssa->listing.count == 0 || !build_blocks(ssa)) return false;
+    order_blocks(ssa);
+    if(!lift(ssa)) return false;
+
+    remove_redundant_phis(ssa);
+    propagate_constants(ssa);
+    infer_types(ssa);
+    number_values(ssa);
+    find_live(ssa);
+    return true;
+}
+
+static void free_ssa(Ssa* ssa){
+    FREE_ARRAY(Step, ssa->steps, ssa->listing.count);
+    FREE_ARRAY(Block, ssa->blocks, ssa->block_count);
+    FREE_ARRAY(int, ssa->order, ssa->block_count);
+    FREE_ARRAY(int, ssa->edges, ssa->edge_count);
+    FREE_ARRAY(SsaValue, ssa->values, ssa->value_capacity);
+    FREE_ARRAY(int, ssa->states, ssa->state_capacity);
+    FREE_ARRAY(int, ssa->incoming, ssa->incoming_capacity);
+    FREE_ARRAY(int, ssa->roots, ssa->root_capacity);
+    free_listing(&ssa->listing);
+}
+
+/*the code pushing a constant, 0 once the constant table is full*/
+static int push_constant(Chunk* chunk, Value value, uint8_t* bytes){
+    if(IS_NIL(value)){
+        bytes[0] = OP_NIL;
+        return 1;
+    }
+    if(IS_BOOL(value)){
+        bytes[0] = AS_BOOL(value) ? OP_TRUE : OP_FALSE;
+        return 1;
+    }
+
+    int index = 0;
+    while(index < chunk->constants.count &&
+        !same_constant(chunk->constants.values[index], value)) index++;
+    if(index == chunk->constants.count){
+        if(index >= UINT8_COUNT) return 0;
+        add_constant(chunk, value);
+    }
+
+    bytes[0] = OP_CONSTANT;
+    bytes[1] = (uint8_t)index;
+    return 2;
+}
+
+/*swaps an instruction for code popping its operands and pushing something else*/
+static void replace(Ssa* ssa, int i, int pops, uint8_t* bytes, int count){
+    uint8_t code[8];
+    int length = 0;
+    while(length < pops) code[length++] = OP_POP;
+    memcpy(&code[length], bytes, count);
+
+    ssa->listing.code[i].removed = true;
+    splice_before(&ssa->listing, i, code, length + count);
+}
+
+static int replay(Ssa* ssa, int i, int* stack, int depth){
+    Instruction* instruction = &ssa->listing.code[i];
+    if(instruction->opcode == OP_SET_LOCAL){
+        stack[ssa->chunk->code[instruction->offset + 1]] = stack[depth - 1];
+    }else if(updates_local(instruction->opcode)){
+        stack[ssa->chunk->code[instruction->offset + 1]] = ssa->steps[i].result;
+    }
+    depth -= stack_pops(ssa->chunk, instruction);
+    if(ssa->steps[i].result != -1) stack[depth++] = ssa->steps[i].result;
+    return depth;
+}
+
+/*
+    plain backwards liveness over the slots, a slot is read by
+    GET_LOCAL, the in-place updates and whatever pops it (other than
+    POP itself), a SET_LOCAL into a slot nothing reads afterwards is
+    a dead store
+*/
+static bool* find_dead_stores(Ssa* ssa){
+    Chunk* chunk = ssa->chunk;
+    int count = ssa->listing.count;
+    int size = ssa->function->arity + 1 + count;
+    bool* dead = ALLOCATE(bool, count);
+    int* depth_before = ALLOCATE(int, count);
+    bool** live_in = ALLOCATE(bool*, ssa->block_count);
+    bool* live = ALLOCATE(bool, size);
+
+    for (int i = 0; i < count; i++) dead[i] = false;
+    for (int b = 0; b < ssa->block_count; b++){
+        Block* block = &ssa->blocks[b];
+        live_in[b] = NULL;
+        if(!block->visited) continue;
+
+        live_in[b] = ALLOCATE(bool, block->depth + 1);
+        for (int s = 0; s < block->depth; s++) live_in[b][s] = false;
+
+        int depth = block->depth;
+        for (int i = block->first; i <= block->last; i++){
+            depth_before[i] = depth;
+            depth -= stack_pops(chunk, &ssa->listing.code[i]);
+            if(ssa->steps[i].result != -1) depth++;
+        }
+    }
+
+    bool changed = true;
+    bool final = false;
+    while(changed || !final){
+        final = !changed;
+        changed = false;
+
+        for (int n = ssa->order_count - 1; n >= 0; n--){
+            int b = ssa->order[n];
+            Block* block = &ssa->blocks[b];
+
+            for (int s = 0; s < size; s++) live[s] = false;
+            for (int k = 0; k < 2; k++){
+                int successor = block->successors[k];
+                if(successor == -1) continue;
+                for (int s = 0; s < ssa->blocks[successor].depth; s++){
+                    live[s] |= live_in[successor][s];
+                }
+            }
+
+            for (int i = block->last; i >= block->first; i--){
+                Instruction* instruction = &ssa->listing.code[i];
+                uint8_t operand = instruction->length > 1 ? chunk->code[instruction->offset + 1] : 0;
+                int depth = depth_before[i];
+                int pops = stack_pops(chunk, instruction);
+
+                if(ssa->steps[i].result != -1) live[depth - pops] = false;
+
+                switch (instruction->opcode){
+                    case OP_POP:
+                        live[depth - 1] = false;
+                        break;
+                    case OP_GET_LOCAL:
+                        live[operand] = true;
+                        break;
+                    case OP_SET_LOCAL:
+                        if(final) dead[i] = !live[operand];
+                        live[operand] = false;
+                        live[depth - 1] = true;
+                        break;
+                    case OP_JUMP_IF_FALSE:
+                    case OP_SET_GLOBAL:
+                        live[depth - 1] = true;
+                        break;
+                    case OP_ADD_LOCAL:
+                    case OP_SUBTRACT_LOCAL:
+                    case OP_MULTIPLY_LOCAL:
+                    case OP_DIVIDE_LOCAL:
+                        live[operand] = true;
+                        live[depth - 1] = true;
+                        break;
+                    default:
+                        for (int k = 1; k <= pops; k++) live[depth - k] = true;
+                        break;
+                }
+            }
+
+            for (int s = 0; s < block->depth; s++){
+                if(live[s] && !live_in[b][s]){
+                    live_in[b][s] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (int b = 0; b < ssa->block_count; b++){
+        if(live_in[b] != NULL) FREE_ARRAY(bool, live_in[b], ssa->blocks[b].depth + 1);
+    }
+    FREE_ARRAY(bool*, live_in, ssa->block_count);
+    FREE_ARRAY(bool, live, size);
+    FREE_ARRAY(int, depth_before, count);
+    return dead;
+}
+
+/*constants, dead values, dead stores, redundant computations and known branches*/
+static bool simplify(Ssa* ssa){
+    Chunk* chunk = ssa->chunk;
+    int* stack = ALLOCATE(int, ssa->function->arity + 1 + ssa->listing.count);
+    bool* dead = find_dead_stores(ssa);
+    bool changed = false;
+
+    for (int n = 0; n < ssa->order_count; n++){
+        Block* block = &ssa->blocks[ssa->order[n]];
+        if(!block->executable) continue;
+
+        int depth = block->depth;
+        for (int s = 0; s < depth; s++) stack[s] = ssa->states[block->entry + s];
+
+        for (int i = block->first; i <= block->last; i++){
+            Instruction* instruction = &ssa->listing.code[i];
+            int v = ssa->steps[i].result;
+            uint8_t bytes[2];
+
+            if(v != -1 && ssa->values[v].instruction == i){
+                SsaValue* value = &ssa->values[v];
+                int pops = value->operand_count;
+
+                if(value->lattice == LATTICE_CONSTANT){
+                    int count = push_constant(chunk, value->constant, bytes);
+                    if(count > 0){
+                        replace(ssa, i, pops, bytes, count);
+                        changed = true;
+                    }
+                }else if(!value->live && cannot_trap(ssa, value)){
+                    bytes[0] = OP_NIL;
+                    replace(ssa, i, pops, bytes, 1);
+                    changed = true;
+                }else{
+                    for (int s = 0; s < depth - pops; s++){
+                        if(number_of(ssa, stack[s]) != value->number) continue;
+                        bytes[0] = OP_GET_LOCAL;
+                        bytes[1] = (uint8_t)s;
+                        replace(ssa, i, pops, bytes, 2);
+                        changed = true;
+                        break;
+                    }
+                }
+            }else if(instruction->opcode == OP_GET_LOCAL){
+                SsaValue* value = &ssa->values[find(ssa, v)];
+                if(value->lattice == LATTICE_CONSTANT){
+                    int count = push_constant(chunk, value->constant, bytes);
+                    if(count > 0){
+                        replace(ssa, i, 0, bytes, count);
+                        changed = true;
+                    }
+                }
+            }else if(instruction->opcode == OP_SET_LOCAL && dead[i]){
+                /*the value stays on the stack either way*/
+                instruction->removed = true;
+                changed = true;
+            }else if(instruction->opcode == OP_JUMP_IF_FALSE){
+                SsaValue* condition = &ssa->values[find(ssa, ssa->steps[i].condition)];
+                if(condition->lattice == LATTICE_CONSTANT){
+                    if(is_falsey(condition->constant)){
+                        instruction->opcode = OP_JUMP;
+                    }else{
+                        instruction->removed = true;
+                    }
+                    changed = true;
+                }
+            }
+
+            depth = replay(ssa, i, stack, depth);
+        }
+    }
+
+    FREE_ARRAY(int, stack, ssa->function->arity + 1 + ssa->listing.count);
+    FREE_ARRAY(bool, dead, ssa->listing.count);
+    return changed;
+}
+
+/*
+    a loop is the code from a backwards jump's target to the last
+    backwards jump into it, it can be entered only by falling into
+    its first instruction and left only through JUMP_IF_FALSE onto
+    the POP that follows it (or by returning)
+*/
+static bool is_simple_loop(Ssa* ssa, int header, int end){
+    Listing* listing = &ssa->listing;
+    int exit = end + 1;
+    if(header == 0 || exit >= listing->count) return false;
+
+    Instruction* before = &listing->code[header - 1];
+    if(is_jump(before->opcode) || before->opcode == OP_RETURN) return false;
+    if(listing->code[exit].opcode != OP_POP) return false;
+
+    Block* loop = &ssa->blocks[ssa->steps[header].block];
+    Block* after = &ssa->blocks[ssa->steps[exit].block];
+    if(!loop->executable || !after->visited || ssa->blocks[ssa->steps[header - 1].block].depth == -1) return false;
+    if(after->first != exit || after->depth != loop->depth + 1) return false;
+
+    for (int i = 0; i < listing->count; i++){
+        int target = listing->code[i].target;
+        if(target == -1) continue;
+
+        bool inside = i >= header && i <= end;
+        bool lands_inside = target >= header && target <= end;
+        if(inside && !lands_inside &&
+            (target != exit || listing->code[i].opcode != OP_JUMP_IF_FALSE)) return false;
+        if(!inside && (lands_inside || target == exit)) return false;
+    }
+    return true;
+}
+
+/*
+    finds an operation in the loop whose operands are constants or
+    sit unchanged in slots below the loop, returns its instruction
+*/
+static int find_invariant(Ssa* ssa, int header, int end, int* max_depth){
+    int* stack = ALLOCATE(int, ssa->function->arity + 1 + ssa->listing.count);
+    Block* loop = &ssa->blocks[ssa->steps[header].block];
+    int found = -1;
+    *max_depth = 0;
+
+    for (int b = ssa->steps[header].block; b < ssa->block_count; b++){
+        Block* block = &ssa->blocks[b];
+        if(block->first > end) break;
+        if(!block->executable) continue;
+
+        int depth = block->depth;
+        for (int s = 0; s < depth; s++) stack[s] = ssa->states[block->entry + s];
+        if(depth > *max_depth) *max_depth = depth;
+
+        for (int i = block->first; i <= block->last; i++){
+            int v = ssa->steps[i].result;
+            if(found == -1 && v != -1 && ssa->values[v].instruction == i){
+                SsaValue* value = &ssa->values[v];
+                bool invariant = value->lattice != LATTICE_CONSTANT && value->live &&
+                    cannot_trap(ssa, value);
+
+                for (int k = 0; k < value->operand_count && invariant; k++){
+                    int operand = find(ssa, value->operands[k]);
+                    SsaValue* input = &ssa->values[operand];
+                    if(input->lattice == LATTICE_CONSTANT) continue;
+
+                    invariant = false;
+                    if(input->kind == VALUE_PHI && input->block == ssa->steps[header].block) break;
+                    for (int s = 0; s < loop->depth; s++){
+                        if(find(ssa, ssa->states[loop->entry + s]) == operand) invariant = true;
+                    }
+                }
+                if(invariant) found = i;
+            }
+
+            depth = replay(ssa, i, stack, depth);
+            if(depth > *max_depth) *max_depth = depth;
+        }
+    }
+
+    FREE_ARRAY(int, stack, ssa->function->arity + 1 + ssa->listing.count);
+    return found;
+}
+
+static bool hoist(Ssa* ssa, int header, int end, int invariant){
+    Chunk* chunk = ssa->chunk;
+    Listing* listing = &ssa->listing;
+    Block* loop = &ssa->blocks[ssa->steps[header].block];
+    SsaValue* value = &ssa->values[ssa->steps[invariant].result];
+    int slot = loop->depth;
+
+    /*computed once, right where the code falls into the loop*/
+    uint8_t code[8];
+    int length = 0;
+    for (int k = 0; k < value->operand_count; k++){
+        SsaValue* input = &ssa->values[find(ssa, value->operands[k])];
+        if(input->lattice == LATTICE_CONSTANT){
+            int count = push_constant(chunk, input->constant, &code[length]);
+            if(count == 0) return false;
+            length += count;
+            continue;
+        }
+        for (int s = 0; s < loop->depth; s++){
+            if(find(ssa, ssa->states[loop->entry + s]) != find(ssa, value->operands[k])) continue;
+            code[length++] = OP_GET_LOCAL;
+            code[length++] = (uint8_t)s;
+            break;
+        }
+    }
+    code[length++] = value->opcode;
+    splice_after(listing, header - 1, code, length);
+
+    /*the new slot sits under everything the loop keeps on the stack*/
+    for (int i = header; i <= end; i++){
+        Instruction* instruction = &listing->code[i];
+        if(instruction->opcode != OP_GET_LOCAL && instruction->opcode != OP_SET_LOCAL &&
+            !updates_local(instruction->opcode)) continue;
+        if(chunk->code[instruction->offset + 1] >= slot) chunk->code[instruction->offset + 1]++;
+    }
+
+    for (int i = header; i <= end; i++){
+        int v = ssa->steps[i].result;
+        if(v == -1 || ssa->values[v].instruction != i) continue;
+        if(!ssa->blocks[ssa->steps[i].block].executable) continue;
+        if(ssa->values[v].number != value->number) continue;
+
+        uint8_t bytes[2] = {OP_GET_LOCAL, (uint8_t)slot};
+        replace(ssa, i, ssa->values[v].operand_count, bytes, 2);
+    }
+
+    uint8_t pop = OP_POP;
+    splice_after(listing, end + 1, &pop, 1);
+    return true;
+}
+
+/*loop invariant code motion, one operation per round*/
+static bool hoist_invariant(Ssa* ssa){
+    Listing* listing = &ssa->listing;
+    int* end = ALLOCATE(int, listing->count);
+    bool changed = false;
+
+    for (int i = 0; i < listing->count; i++) end[i] = -1;
+    for (int i = 0; i < listing->count; i++){
+        int target = listing->code[i].target;
+        if(target != -1 && target <= i && i > end[target]) end[target] = i;
+    }
+
+    for (int header = 0; header < listing->count && !changed; header++){
+        if(end[header] == -1) continue;
+
+        /*backwards jumps into the middle of the loop belong to it as well*/
+        int last = end[header];
+        for (int i = header; i <= last; i++){
+            if(end[i] > last) last = end[i];
+        }
+
+        if(!is_simple_loop(ssa, header, last)) continue;
+
+        int max_depth;
+        int invariant = find_invariant(ssa, header, last, &max_depth);
+        if(invariant == -1 || max_depth + 1 > UINT8_COUNT) continue;
+
+        changed = hoist(ssa, header, last, invariant);
+    }
+
+    FREE_ARRAY(int, end, listing->count);
+    return changed;
+}
+
+static void copy_chunk(Chunk* from, Chunk* to){
+    init_chunk(to);
+    for (int i = 0; i < from->count; i++){
+        write_chunk(to, from->code[i], get_line(from, i));
+    }
+    for (int i = 0; i < from->constants.count; i++){
+        write_value_array(&to->constants, from->constants.values[i]);
+    }
+}
+
+/*
+    builds the optimized chunk of a hot function, the baseline chunk
+    stays as it is since frames that are already running still use it
+*/
+bool tier_up(ObjFunction* function){
+    /*the script body runs once, there's nothing to gain*/
+    if(function->name == NULL || function->optimized != NULL) return false;
+
+    Chunk* chunk = ALLOCATE(Chunk, 1);
+    copy_chunk(&function->chunk, chunk);
+    generalize_chunk(chunk);
+
+    bool modified = false;
+    for (int round = 0; round < MAX_ROUNDS; round++){
+        Ssa ssa;
+        bool changed = false;
+
+        if(analyze(&ssa, function, chunk)){
+            changed = simplify(&ssa);
+            if(!changed) changed = hoist_invariant(&ssa);
+            if(changed) rebuild_listing(&ssa.listing);
+        }
+        free_ssa(&ssa);
+
+        if(!changed) break;
+        optimize_chunk(chunk);
+        modified = true;
+    }
+
+    if(!modified){
+        free_chunk(chunk);
+        FREE(Chunk, chunk);
+        return false;
+    }
+#ifdef FUSE_COUNTING_LOOPS
+    fuse_loops(chunk);
+#endif
+#ifdef SPECIALIZE_NUMBERS
+    specialize_chunk(chunk, function->arity + 1);
+#endif
+
+#ifdef DEBUG_PRINT_CODE
+    disassemble_chunk(chunk, function->name->chars);
+    output_format(&vm.output, "-- optimized %d bytes down to %d --\n", function->chunk.count, chunk->count);
+#endif
+    function->optimized = chunk;
+    return true;
+}
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "memory.h"
 #include "object.h"
@@ -20,18 +21,35 @@ void free_table(Table* table){
 }
 
 
-static Entry* find_entry(Entry* entries, int capacity,
-                                         ObjString* key){
+/*strings hash to their own hash, -0 to the same as 0 since they're equal*/
+uint32_t hash_value(Value value){
+    if(IS_STRING(value)) return AS_STRING(value)->hash;
+    if(IS_BOOL(value)) return AS_BOOL(value) ? 1231 : 1237;
+
+    double number = AS_NUMBER(value) + 0.0;
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return (uint32_t)(bits ^ (bits >> 32));
+}
+
+/*strings are interned, so the same string is the same object*/
+static inline bool same_key(Value a, Value b){
+    if(a.type != b.type) return false;
+    switch (a.type){
+        case VAL_NUMBER:    return AS_NUMBER(a) == AS_NUMBER(b);
+        case VAL_BOOL:      return AS_BOOL(a) == AS_BOOL(b);
+        case VAL_OBJ:       return AS_OBJ(a) == AS_OBJ(b);
+        default:            return false;
+    }
+}
+
+static Entry* find_entry(Entry* entries, int capacity, Value key){
     /*this is how a bucket is found, the modulus*/
-    uint32_t index = key->hash % capacity;
+    uint32_t index = hash_value(key) % capacity;
     Entry* tombstone = NULL;
     for(;;){
         Entry* entry = &entries[index];
-        if(entry->key == key || entry->key == NULL){
-            return entry;
-        }
-
-        if(entry->key == NULL){
+        if(IS_NIL(entry->key)){
             if(IS_NIL(entry->value)){
                 /*
                     we want to make use of the tombstone incase there's one
@@ -40,7 +58,7 @@ static Entry* find_entry(Entry* entries, int capacity,
             }else {
                 tombstone = entry;
             }
-        }else if(entry->key == key){
+        }else if(same_key(entry->key, key)){
             return entry;
         }
 
@@ -51,7 +69,7 @@ static Entry* find_entry(Entry* entries, int capacity,
 static void adjust_capacity(Table* table, int capacity){
     Entry* entries = ALLOCATE(Entry, capacity);
     for (int i = 0; i < capacity; i++){
-        entries[i].key = NULL;
+        entries[i].key = NIL_VAL;
         entries[i].value = NIL_VAL;
     }
 
@@ -63,7 +81,7 @@ static void adjust_capacity(Table* table, int capacity){
     table->count = 0;
     for (int i = 0; i < table->capacity; i++){
         Entry* entry = &table->entries[i];
-        if(entry->key == NULL) continue;
+        if(IS_NIL(entry->key)) continue;
 
         /*
             here is abit confusing but what happens is;
@@ -97,14 +115,14 @@ static void adjust_capacity(Table* table, int capacity){
 }
 
 
-bool table_set(Table* table, ObjString* key, Value value){
+bool table_set_value(Table* table, Value key, Value value){
     if(table->count + 1 > table->capacity * TABLE_MAX_LOAD){
         int capacity = GROW_CAPACITY(table->capacity);
         adjust_capacity(table,capacity);
     }
 
     Entry* entry = find_entry(table->entries, table->capacity,key);
-    bool is_new_key = entry->key == NULL;
+    bool is_new_key = IS_NIL(entry->key);
 
     /* 
         count = NUMBER_OF_ENTRIES + TOMBSTONES
@@ -119,38 +137,62 @@ bool table_set(Table* table, ObjString* key, Value value){
     return is_new_key;
 }
 
+bool table_set(Table* table, ObjString* key, Value value){
+    return table_set_value(table, OBJ_VAL(key), value);
+}
+
 
 void table_add_all(Table* from, Table* to){
     for (int i = 0; i < from->capacity; i++){
         Entry* entry = &from->entries[i];
-        if(entry->key != NULL){
-            table_set(to, entry->key, entry->value);
+        if(!IS_NIL(entry->key)){
+            table_set_value(to, entry->key, entry->value);
         }
     }
 }
 
-bool table_get(Table* table, ObjString* key, Value* value){
+bool table_get_value(Table* table, Value key, Value* value){
     if(table->count == 0) return false;
 
     Entry* entry = find_entry(table->entries,table->capacity,key);
 
-    if(entry->key == NULL) return false;
+    if(IS_NIL(entry->key)) return false;
 
     *value = entry->value;
     return true;
 }
 
-bool table_delete(Table* table, ObjString* key){
+bool table_get(Table* table, ObjString* key, Value* value){
+    return table_get_value(table, OBJ_VAL(key), value);
+}
+
+/*
+    where `key` sits in the table's entries, -1 if it isn't there. the
+    slot can end up holding another key once the table grows
+*/
+int table_index(Table* table, ObjString* key){
+    if(table->count == 0) return -1;
+
+    Entry* entry = find_entry(table->entries, table->capacity, OBJ_VAL(key));
+    if(IS_NIL(entry->key)) return -1;
+    return (int)(entry - table->entries);
+}
+
+bool table_delete_value(Table* table, Value key){
     if(table->count == 0) return false;
 
     Entry* entry = find_entry(table->entries, table->capacity, key);
-    if(entry->key == NULL) return false;
+    if(IS_NIL(entry->key)) return false;
 
-    entry->key = NULL;
+    entry->key = NIL_VAL;
     entry->value = BOOL_VAL(true);
     return true;
 }
 
+bool table_delete(Table* table, ObjString* key){
+    return table_delete_value(table, OBJ_VAL(key));
+}
+
 ObjString* table_find_string(Table* table, const char* chars, int length, uint32_t hash){
     if(table->count == 0) return NULL;
 
@@ -158,15 +200,18 @@ ObjString* table_find_string(Table* table, const char* chars, int length, uint32
     for(;;){
         Entry* entry = &table->entries[index];
 
-        if(entry->key == NULL){
+        if(IS_NIL(entry->key)){
             /*
                 the entry is genuinely NULL
             */
             if(IS_NIL(entry->value)) return NULL;
-        }else if (entry->key->length == length 
-                    && entry->key->hash == hash
-                    && memcmp(entry->key->chars, chars, length) == 0){
-            return entry->key;
+        }else{
+            ObjString* key = AS_STRING(entry->key);
+            if(key->length == length
+                    && key->hash == hash
+                    && memcmp(key->chars, chars, length) == 0){
+                return key;
+            }
         }
 
         index = (index + 1) % table->capacity;
@@ -4,6 +4,7 @@
 #include "memory.h"
 #include "value.h"
 #include "object.h"
+#include "vm.h"
 
 void init_value_array(ValueArray* array){
     array->capacity = 0;
@@ -31,10 +32,10 @@ void free_value_array(ValueArray* array){
 void print_value(Value value){
     switch (value.type) {
         case VAL_BOOL:
-            printf(AS_BOOL(value) ? "true" : "false");
+            output_string(&vm.output, AS_BOOL(value) ? "true" : "false");
             break;
-        case VAL_NIL: printf("nil"); break;
-        case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
+        case VAL_NIL: output_chars(&vm.output, "nil", 3); break;
+        case VAL_NUMBER: output_number(&vm.output, AS_NUMBER(value)); break;
         case VAL_OBJ: print_object(value); break;
     }
 }
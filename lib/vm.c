@@ -1,13 +1,19 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 
 #include "common.h"
 #include "vm.h"
 #include "debug.h"
 #include "object.h"
+#include "array.h"
+#include "map.h"
 #include "memory.h"
 #include "compiler.h"
+#include "arena.h"
+#include "ssa.h"
+#include "registers.h"
 #include "time.h"
 
 VM vm;
@@ -15,44 +21,122 @@ VM vm;
 static void reset_stack();
 static InterpretResult run();
 static void runtime_error(const char* format, ...);
+static void report_error(const char* format, va_list args);
 static void concatenate();
+static bool concatenate_n(int count);
+static ObjString* join_strings(ObjString* a, ObjString* b);
 static bool is_falsey(Value value);
+static bool get_global(Chunk* chunk, uint8_t constant, Value* value);
+static Value* global_slot(Chunk* chunk, uint8_t constant);
+static bool update(uint8_t operation, Value* variable, Value operand);
+static bool get_element(Value target, Value index, Value* value);
+static bool set_element(Value target, Value index, Value value);
+static ObjNative* define_native(const char* name, NativeFn function, const char* params, int optional);
+static void define_intrinsic(uint8_t opcode, const char* name, NativeFn function, const char* params, int optional);
 
-static Value clock_native(int arg_count, Value* args){
-    return NUMBER_VAL((double)clock() /CLOCKS_PER_SEC);
+static bool clock_native(int arg_count, Value* args, Value* result){
+    (void)arg_count; (void)args;
+    *result = NUMBER_VAL((double)clock() /CLOCKS_PER_SEC);
+    return true;
+}
+
+/*flush(), writes out whatever print has buffered*/
+static bool flush_native(int arg_count, Value* args, Value* result){
+    (void)arg_count; (void)args;
+    flush_output(&vm.output);
+    *result = NIL_VAL;
+    return true;
+}
+
+static bool sqrt_native(int arg_count, Value* args, Value* result){
+    (void)arg_count;
+    *result = NUMBER_VAL(sqrt(AS_NUMBER(args[0])));
+    return true;
+}
+
+static bool floor_native(int arg_count, Value* args, Value* result){
+    (void)arg_count;
+    *result = NUMBER_VAL(floor(AS_NUMBER(args[0])));
+    return true;
+}
+
+static bool abs_native(int arg_count, Value* args, Value* result){
+    (void)arg_count;
+    *result = NUMBER_VAL(fabs(AS_NUMBER(args[0])));
+    return true;
 }
 
 void init_vm(){
     reset_stack();
     vm.objects = NULL;
+    vm.arenas = NULL;
+    init_output(&vm.output);
     init_table(&vm.strings);
     init_table(&vm.globals);
-    define_native("clock", clock_native);
+    vm.init_string = NULL;
+    vm.init_string = copy_string("init", 4);
+    define_native("clock", clock_native, "", 0);
+    define_native("flush", flush_native, "", 0);
+    define_native("array", array_native, "n.", 1);
+    define_native("push", push_native, "a.", 0);
+    define_native("sum", sum_native, "a", 0);
+    define_native("dot", dot_native, "aa", 0);
+    define_native("scale", scale_native, "an", 0);
+    define_native("add", add_native, "a.", 0);
+    define_intrinsic(OP_SQRT, "sqrt", sqrt_native, "n", 0);
+    define_intrinsic(OP_FLOOR, "floor", floor_native, "n", 0);
+    define_intrinsic(OP_ABS, "abs", abs_native, "n", 0);
+    define_intrinsic(OP_MIN, "min", min_native, "..", 1);
+    define_intrinsic(OP_MAX, "max", max_native, "..", 1);
+    define_intrinsic(OP_LEN, "len", len_native, ".", 0);
+    define_native("has", has_native, "m.", 0);
+    define_native("remove", remove_native, "m.", 0);
+    define_native("keys", keys_native, "m", 0);
+    define_native("values", values_native, "m", 0);
 }
 
 void free_vm(){
     free_table(&vm.strings);
     free_table(&vm.globals);
     free_objects();
+    free_arenas();
+    free_output(&vm.output);
 }
 
-static bool call(ObjFunction* function, int argument_count){
-    //check if arity is fine
-    if(argument_count > function->arity){
-        runtime_error("Too many arguments passed to %s, expected %s but got %s", 
-            function->name, function->arity, argument_count);
-        return false;
+/*counts calls and loop iterations, tiers the function up once it's hot*/
+static void heat(ObjFunction* function){
+#ifdef OPTIMIZING_TIER
+    if(function->hotness < HOT_THRESHOLD && ++function->hotness == HOT_THRESHOLD){
+        tier_up(function);
     }
+#else
+    (void)function;
+#endif
+}
 
+/*the part of a call that's left once the callee has been checked*/
+static bool push_frame(ObjFunction* function, ObjClosure* closure, int argument_count){
     //at the moment we only support upto 64 frames
     if(vm.frame_count >= FRAMES_MAX){
         runtime_error("Stack overflow, too many calls.");
         return false;
     }
 
-    CallFrame* callframe = new_function(function);
+    heat(function);
+
+    CallFrame* callframe = &vm.frames[vm.frame_count++];
     callframe->function = function;
-    callframe->ip = function->chunk.code;
+    callframe->closure = closure;
+    callframe->chunk = function->optimized != NULL ? function->optimized : &function->chunk;
+    callframe->registers = false;
+#ifdef REGISTER_VM
+    Chunk* registers = register_code(function, callframe->chunk);
+    if(registers != NULL){
+        callframe->chunk = registers;
+        callframe->registers = true;
+    }
+#endif
+    callframe->ip = callframe->chunk->code;
 
     //the callframe is at the top of the VM's stack, 
     //it's so the callee is the in the slot zero of this callframe
@@ -64,14 +148,40 @@ static bool call(ObjFunction* function, int argument_count){
     return true;
 }
 
+static bool call(ObjFunction* function, ObjClosure* closure, int argument_count){
+    //check if arity is fine
+    if(argument_count != function->arity){
+        runtime_error("Expected %d arguments but got %d.", 
+            function->arity, argument_count);
+        return false;
+    }
 
+    //bodies deferred by LAZY_COMPILE get compiled on their first call
+    if(function->source != NULL && !compile_function_body(function)){
+        runtime_error("Could not compile the body of %s().", function->name->chars);
+        return false;
+    }
+
+    return push_frame(function, closure, argument_count);
+}
+
+
+/*a line of the REPL, there can be more source after it*/
 InterpretResult interpret(const char* source){
-    ObjFunction* function = compile(source);
+    ObjFunction* function = compile(source, false);
     if(function == NULL) return INTERPRET_COMPILE_ERROR;
 
+    return interpret_function(function);
+}
+
+/*
+    runs an already compiled script, either fresh out of compile()
+    or relinked from a .loxc cache
+*/
+InterpretResult interpret_function(ObjFunction* function){
     push(OBJ_VAL(function));
 
-    call(function,0);
+    call(function, NULL, 0);
 
     return run();
 }
@@ -103,8 +213,56 @@ static Value peek(int distance){
 static void reset_stack(){
     vm.stack_top = vm.stack;
     vm.frame_count = 0;
+    vm.open_upvalues = NULL;
+}
+
+
+static bool check_arguments(ObjNative* native, int arg_count, Value* args){
+    for (int i = 0; i < arg_count; i++){
+        const char* expected;
+        switch (native->params[i]){
+            case 'n': if(IS_NUMBER(args[i])) continue; expected = "a number"; break;
+            case 's': if(IS_STRING(args[i])) continue; expected = "a string"; break;
+            case 'a': if(IS_ARRAY(args[i])) continue; expected = "an array"; break;
+            case 'm': if(IS_MAP(args[i])) continue; expected = "a map"; break;
+            default: continue;
+        }
+        runtime_error("Argument %d of %s() must be %s.", i + 1, native->name, expected);
+        return false;
+    }
+    return true;
+}
+
+/*the result lands in the native's own slot, the arguments above it are dropped*/
+static inline bool run_native(ObjNative* native, int arg_count){
+    Value* args = vm.stack_top - arg_count;
+    if(!native->function(arg_count, args, &args[-1])) return false;
+    vm.stack_top = args;
+    return true;
+}
+
+static bool call_native(ObjNative* native, int arg_count){
+    if(arg_count > native->arity || arg_count < native->arity - native->optional){
+        if(native->optional == 0){
+            runtime_error("Expected %d arguments but got %d.", native->arity, arg_count);
+        }else{
+            runtime_error("Expected %d to %d arguments but got %d.",
+                native->arity - native->optional, native->arity, arg_count);
+        }
+        return false;
+    }
+    if(native->typed && !check_arguments(native, arg_count, vm.stack_top - arg_count)) return false;
+    return run_native(native, arg_count);
 }
 
+/*`method` is the ObjFunction or ObjClosure a class holds*/
+static bool call_method(Obj* method, int arg_count){
+    if(method->type == OBJ_CLOSURE){
+        ObjClosure* closure = (ObjClosure*)method;
+        return call(closure->function, closure, arg_count);
+    }
+    return call((ObjFunction*)method, NULL, arg_count);
+}
 
 static bool call_value(Value callee, int arg_count){
     if(!IS_OBJ(callee)){
@@ -114,19 +272,472 @@ static bool call_value(Value callee, int arg_count){
 
     switch (OBJ_TYPE(callee)){
         case OBJ_FUNCTION:
-            return call(AS_FUNCTION(callee), arg_count);
+            return call(AS_FUNCTION(callee), NULL, arg_count);
             break;
-        case OBJ_NATIVE:{
-            NativeFn native = AS_NATIVE(callee);
-            Value result = native(arg_count, vm.stack_top - arg_count);
-            vm.stack_top -= arg_count + 1;
-            push(result);
+        case OBJ_CLOSURE:
+            return call(AS_CLOSURE(callee)->function, AS_CLOSURE(callee), arg_count);
+        case OBJ_NATIVE:
+            return call_native(AS_NATIVE(callee), arg_count);
+        /*the new instance takes the class's slot, it's `this` in init()*/
+        case OBJ_CLASS:{
+            ObjClass* klass = AS_CLASS(callee);
+            vm.stack_top[-arg_count - 1] = OBJ_VAL(new_instance(klass));
+            Value initializer;
+            if(table_get(&klass->methods, vm.init_string, &initializer)){
+                return call_method(AS_OBJ(initializer), arg_count);
+            }
+            if(arg_count != 0){
+                runtime_error("Expected 0 arguments but got %d.", arg_count);
+                return false;
+            }
             return true;
         }
+        case OBJ_BOUND_METHOD:{
+            ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
+            vm.stack_top[-arg_count - 1] = bound->receiver;
+            return call_method(bound->method, arg_count);
+        }
 
         default:
             break;
     }
+
+    runtime_error("Only callables can actually be called i.e functions and classes can be called");
+    return false;
+}
+
+/*
+    every name constant in a chunk gets a cache, they're all made the
+    first time the chunk needs one
+*/
+static GlobalCache* global_cache(Chunk* chunk, uint8_t constant){
+    if(chunk->caches == NULL){
+        chunk->cache_count = chunk->constants.count;
+        chunk->caches = ALLOCATE(GlobalCache, chunk->cache_count);
+        for (int i = 0; i < chunk->cache_count; i++){
+            chunk->caches[i].index = -1;
+            chunk->caches[i].callee = NULL;
+            chunk->caches[i].arity = -1;
+        }
+    }
+    return &chunk->caches[constant];
+}
+
+/*
+    only hashes the name when the cached slot doesn't hold it anymore,
+    the value itself is read from the table every time so assignments
+    are always seen
+*/
+static bool get_global(Chunk* chunk, uint8_t constant, Value* value){
+    Value* slot = global_slot(chunk, constant);
+    if(slot == NULL) return false;
+    *value = *slot;
+    return true;
+}
+
+/*where the global's value lives in vm.globals, NULL if it isn't defined*/
+static Value* global_slot(Chunk* chunk, uint8_t constant){
+    ObjString* name = AS_STRING(chunk->constants.values[constant]);
+#ifdef INLINE_CACHES
+    GlobalCache* cache = global_cache(chunk, constant);
+    Entry* entry = cache->index == -1 || cache->index >= vm.globals.capacity ?
+        NULL : &vm.globals.entries[cache->index];
+    if(entry == NULL || !IS_OBJ(entry->key) || AS_OBJ(entry->key) != (Obj*)name){
+        cache->index = table_index(&vm.globals, name);
+        if(cache->index == -1) return NULL;
+    }
+    return &vm.globals.entries[cache->index].value;
+#else
+    int index = table_index(&vm.globals, name);
+    return index == -1 ? NULL : &vm.globals.entries[index].value;
+#endif
+}
+
+/*
+    `variable op= operand` for the in-place updates, `operation` is
+    the ADD, SUBTRACT, MULTIPLY or DIVIDE it stands for and fails the
+    same way
+*/
+static bool update(uint8_t operation, Value* variable, Value operand){
+    if(operation == OP_ADD && IS_STRING(*variable) && IS_STRING(operand)){
+        *variable = OBJ_VAL(join_strings(AS_STRING(*variable), AS_STRING(operand)));
+        return true;
+    }
+    if(!IS_NUMBER(*variable) || !IS_NUMBER(operand)){
+        runtime_error(operation == OP_ADD ?
+            "Operands must be two numbers or two strings" : "Operands must be numbers");
+        return false;
+    }
+
+    double a = AS_NUMBER(*variable);
+    double b = AS_NUMBER(operand);
+    switch (operation){
+        case OP_ADD:        *variable = NUMBER_VAL(a + b); break;
+        case OP_SUBTRACT:   *variable = NUMBER_VAL(a - b); break;
+        case OP_MULTIPLY:   *variable = NUMBER_VAL(a * b); break;
+        default:            *variable = NUMBER_VAL(a / b); break;
+    }
+    return true;
+}
+
+/*the element `index` picks out of `array`, -1 once it's reported why there's none*/
+static int element_index(Value array, Value index){
+    if(!IS_NUMBER(index)){
+        runtime_error("Array index must be a number.");
+        return -1;
+    }
+
+    double number = AS_NUMBER(index);
+    if(!(number >= 0 && number < AS_ARRAY(array)->count)){
+        runtime_error("Array index out of bounds.");
+        return -1;
+    }
+    if(number != (int)number){
+        runtime_error("Array index must be a whole number.");
+        return -1;
+    }
+    return (int)number;
+}
+
+static bool check_key(Value key){
+    if(is_map_key(key)) return true;
+    runtime_error("Map keys must be numbers, bools or strings.");
+    return false;
+}
+
+/*`target[index]`, a key a map doesn't have reads as nil*/
+static bool get_element(Value target, Value index, Value* value){
+    if(IS_ARRAY(target)){
+        int element = element_index(target, index);
+        if(element == -1) return false;
+        *value = array_get(AS_ARRAY(target), element);
+        return true;
+    }
+    if(IS_MAP(target)){
+        if(!check_key(index)) return false;
+        if(!map_get(AS_MAP(target), index, value)) *value = NIL_VAL;
+        return true;
+    }
+
+    runtime_error("Only arrays and maps can be indexed.");
+    return false;
+}
+
+static bool set_element(Value target, Value index, Value value){
+    if(IS_ARRAY(target)){
+        int element = element_index(target, index);
+        if(element == -1) return false;
+        array_set(AS_ARRAY(target), element, value);
+        return true;
+    }
+    if(IS_MAP(target)){
+        if(!check_key(index)) return false;
+        map_set(AS_MAP(target), index, value);
+        return true;
+    }
+
+    runtime_error("Only arrays and maps can be indexed.");
+    return false;
+}
+
+/*
+    the hash index for the `count` cases in the constants from
+    `first` on, it's built the first time the switch runs
+*/
+static CaseTable* case_table(Chunk* chunk, uint8_t first, int count){
+    if(chunk->case_tables == NULL){
+        chunk->case_table_count = chunk->constants.count;
+        chunk->case_tables = ALLOCATE(CaseTable, chunk->case_table_count);
+        for (int i = 0; i < chunk->case_table_count; i++){
+            chunk->case_tables[i].capacity = 0;
+            chunk->case_tables[i].slots = NULL;
+        }
+    }
+
+    CaseTable* table = &chunk->case_tables[first];
+    if(table->slots != NULL) return table;
+
+    table->capacity = 8;
+    while(table->capacity < count * 2) table->capacity *= 2;
+    table->slots = ALLOCATE(int, table->capacity);
+    for (int i = 0; i < table->capacity; i++) table->slots[i] = -1;
+
+    int mask = table->capacity - 1;
+    for (int i = 0; i < count; i++){
+        uint32_t index = hash_value(chunk->constants.values[first + i]) & mask;
+        while(table->slots[index] != -1) index = (index + 1) & mask;
+        table->slots[index] = i;
+    }
+    return table;
+}
+
+/*which of the JUMPs after an OP_SWITCH_HASH `value` takes, `count` when no case matches*/
+static int find_case(Chunk* chunk, uint8_t first, int count, Value value){
+    if(!IS_NUMBER(value) && !IS_STRING(value)) return count;
+
+    CaseTable* table = case_table(chunk, first, count);
+    Value* cases = &chunk->constants.values[first];
+    int mask = table->capacity - 1;
+    for (uint32_t index = hash_value(value) & mask;; index = (index + 1) & mask){
+        int entry = table->slots[index];
+        if(entry == -1) return count;
+        if(values_equal(cases[entry], value)) return entry;
+    }
+}
+
+/*
+    a callee that's been through call_value() here before with the
+    same argument count doesn't need checking again, natives only
+    have their argument types left to check if they have any.
+    reassigning the global hands us a different callee, which misses
+    and takes its place in the cache
+*/
+static bool call_cached(Chunk* chunk, uint8_t constant, Value callee, int arg_count){
+    GlobalCache* cache = global_cache(chunk, constant);
+    if(IS_OBJ(callee) && AS_OBJ(callee) == cache->callee && arg_count == cache->arity){
+        if(cache->callee->type == OBJ_NATIVE){
+            ObjNative* native = AS_NATIVE(callee);
+            if(native->typed && !check_arguments(native, arg_count, vm.stack_top - arg_count)){
+                return false;
+            }
+            return run_native(native, arg_count);
+        }
+        if(cache->callee->type == OBJ_CLOSURE){
+            return push_frame(AS_CLOSURE(callee)->function, AS_CLOSURE(callee), arg_count);
+        }
+        return push_frame(AS_FUNCTION(callee), NULL, arg_count);
+    }
+
+    if(!call_value(callee, arg_count)) return false;
+    /*classes and bound methods go through call_value() every time*/
+    ObjType type = OBJ_TYPE(callee);
+    if(type == OBJ_FUNCTION || type == OBJ_CLOSURE || type == OBJ_NATIVE){
+        cache->callee = AS_OBJ(callee);
+        cache->arity = arg_count;
+    }
+    return true;
+}
+
+/*
+    where `name` is for instances of `shape`, a field's slot or -1
+    and the method in `method`. false if it's neither
+*/
+static bool lookup_property(ObjShape* shape, ObjClass* klass, ObjString* name,
+                            int* slot, Obj** method){
+    *slot = shape_slot(shape, name);
+    *method = NULL;
+    if(*slot != -1) return true;
+
+    Value found;
+    if(!table_get(&klass->methods, name, &found)) return false;
+    *method = AS_OBJ(found);
+    return true;
+}
+
+#ifdef INLINE_CACHES
+/*like global_cache(), every constant gets one the first time any of them is needed*/
+static PropertyCache* property_cache(Chunk* chunk, uint8_t constant){
+    if(chunk->property_caches == NULL){
+        chunk->property_cache_count = chunk->constants.count;
+        chunk->property_caches = ALLOCATE(PropertyCache, chunk->property_cache_count);
+        for (int i = 0; i < chunk->property_cache_count; i++){
+            PropertyCache* cache = &chunk->property_caches[i];
+            for (int j = 0; j < PROPERTY_CACHE_SIZE; j++) cache->cases[j].shape = NULL;
+            cache->replace = 0;
+        }
+    }
+    return &chunk->property_caches[constant];
+}
+
+/*a full cache loses the case that went in longest ago*/
+static void cache_shape(PropertyCache* cache, ObjShape* shape, ObjShape* next, int slot, Obj* method){
+    ShapeCase* entry = &cache->cases[cache->replace];
+    cache->replace = (cache->replace + 1) % PROPERTY_CACHE_SIZE;
+    entry->shape = shape;
+    entry->next = next;
+    entry->slot = slot;
+    entry->method = method;
+}
+#endif
+
+/*
+    reads the property named by `constant` off `instance`, a field's
+    slot or -1 and the method in `method`. shapes never change once
+    they're made, so whatever was found for one holds for good
+*/
+static bool find_property(Chunk* chunk, uint8_t constant, ObjInstance* instance,
+                        int* slot, Obj** method){
+    ObjString* name = AS_STRING(chunk->constants.values[constant]);
+#ifdef INLINE_CACHES
+    PropertyCache* cache = property_cache(chunk, constant);
+    for (int i = 0; i < PROPERTY_CACHE_SIZE; i++){
+        ShapeCase* entry = &cache->cases[i];
+        if(entry->shape == instance->shape && entry->next == instance->shape){
+            *slot = entry->slot;
+            *method = entry->method;
+            return true;
+        }
+    }
+
+    if(!lookup_property(instance->shape, instance->klass, name, slot, method)) return false;
+    cache_shape(cache, instance->shape, instance->shape, *slot, *method);
+    return true;
+#else
+    return lookup_property(instance->shape, instance->klass, name, slot, method);
+#endif
+}
+
+/*
+    the method named by `constant` in `klass` itself, for super. it's
+    cached under the class's empty shape, where a read would find the
+    same method
+*/
+static bool find_method(Chunk* chunk, uint8_t constant, ObjClass* klass, Obj** method){
+    ObjString* name = AS_STRING(chunk->constants.values[constant]);
+    int slot;
+#ifdef INLINE_CACHES
+    PropertyCache* cache = property_cache(chunk, constant);
+    for (int i = 0; i < PROPERTY_CACHE_SIZE; i++){
+        ShapeCase* entry = &cache->cases[i];
+        if(entry->shape == klass->shape && entry->next == klass->shape){
+            *method = entry->method;
+            return true;
+        }
+    }
+#endif
+
+    if(!lookup_property(klass->shape, klass, name, &slot, method)){
+        runtime_error("Undefined property '%s'.", name->chars);
+        return false;
+    }
+#ifdef INLINE_CACHES
+    cache_shape(cache, klass->shape, klass->shape, -1, *method);
+#endif
+    return true;
+}
+
+/*
+    writes `value` to the field named by `constant`, an instance that
+    doesn't have it yet moves on to the shape that does
+*/
+static void set_field(Chunk* chunk, uint8_t constant, ObjInstance* instance, Value value){
+    ObjString* name = AS_STRING(chunk->constants.values[constant]);
+    ObjShape* shape = instance->shape;
+    ObjShape* next = NULL;
+    int slot = -1;
+#ifdef INLINE_CACHES
+    PropertyCache* cache = property_cache(chunk, constant);
+    for (int i = 0; i < PROPERTY_CACHE_SIZE; i++){
+        ShapeCase* entry = &cache->cases[i];
+        if(entry->shape == shape && entry->slot != -1){
+            next = entry->next;
+            slot = entry->slot;
+            break;
+        }
+    }
+#endif
+
+    if(next == NULL){
+        slot = shape_slot(shape, name);
+        next = shape;
+        if(slot == -1){
+            next = shape_with(shape, name);
+            slot = shape->slot_count;
+        }
+#ifdef INLINE_CACHES
+        cache_shape(cache, shape, next, slot, NULL);
+#endif
+    }
+
+    if(instance->capacity < next->slot_count){
+        int old_capacity = instance->capacity;
+        while(instance->capacity < next->slot_count){
+            instance->capacity = GROW_CAPACITY(instance->capacity);
+        }
+        instance->fields = GROW_ARRAY(Value, instance->fields, old_capacity, instance->capacity);
+    }
+    instance->fields[slot] = value;
+    instance->shape = next;
+}
+
+/*
+    a method call without the bound method in between, a field that
+    holds something callable is called like any other value
+*/
+static bool invoke(Chunk* chunk, uint8_t constant, int arg_count){
+    Value receiver = peek(arg_count);
+    if(!IS_INSTANCE(receiver)){
+        runtime_error("Only instances have methods.");
+        return false;
+    }
+
+    ObjInstance* instance = AS_INSTANCE(receiver);
+    int slot;
+    Obj* method;
+    if(!find_property(chunk, constant, instance, &slot, &method)){
+        runtime_error("Undefined property '%s'.", AS_CSTRING(chunk->constants.values[constant]));
+        return false;
+    }
+
+    if(slot != -1){
+        vm.stack_top[-arg_count - 1] = instance->fields[slot];
+        return call_value(instance->fields[slot], arg_count);
+    }
+    return call_method(method, arg_count);
+}
+
+/*
+    the open upvalue for `slot`, closures capturing the same local
+    share one so they all see its assignments
+*/
+static ObjUpvalue* capture_upvalue(Value* slot){
+    ObjUpvalue* previous = NULL;
+    ObjUpvalue* upvalue = vm.open_upvalues;
+    while(upvalue != NULL && upvalue->location > slot){
+        previous = upvalue;
+        upvalue = upvalue->next;
+    }
+    if(upvalue != NULL && upvalue->location == slot) return upvalue;
+
+    ObjUpvalue* created = new_upvalue(slot);
+    created->next = upvalue;
+    if(previous == NULL){
+        vm.open_upvalues = created;
+    }else{
+        previous->next = created;
+    }
+    return created;
+}
+
+/*moves every local from `last` up off the stack and into its upvalue*/
+static void close_upvalues(Value* last){
+    while(vm.open_upvalues != NULL && vm.open_upvalues->location >= last){
+        ObjUpvalue* upvalue = vm.open_upvalues;
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        vm.open_upvalues = upvalue->next;
+    }
+}
+
+static void make_closure(CallFrame* frame, ObjClosure* closure, uint8_t* captures){
+    for (int i = 0; i < closure->upvalue_count; i++){
+        uint8_t index = captures[2 * i + 1];
+        switch (captures[2 * i]){
+            case CAPTURE_COPY:{
+                ObjUpvalue* copy = &closure->copies[i];
+                copy->closed = frame->slots[index];
+                copy->location = &copy->closed;
+                closure->upvalues[i] = copy;
+                break;
+            }
+            case CAPTURE_LOCAL:
+                closure->upvalues[i] = capture_upvalue(&frame->slots[index]);
+                break;
+            default:
+                closure->upvalues[i] = frame->closure->upvalues[index];
+                break;
+        }
+    }
 }
 
 static InterpretResult run(){
@@ -134,7 +745,7 @@ static InterpretResult run(){
 #define READ_BYTE() (*frame->ip++)
 #define READ_SHORT() \
         (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8 | frame->ip[-1])))
-#define READ_CONSTANT() (frame->function->chunk.constants.values[READ_BYTE()])
+#define READ_CONSTANT() (frame->chunk->constants.values[READ_BYTE()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
 /*
     adventurous use of the C-Preprocessor, but pay attention here
@@ -144,6 +755,7 @@ static InterpretResult run(){
     3 - the while loop enables the macro substitution to work without syntax errors regarding
         ';'. it enables containing multiple statements in a block and also permits a ';'
 */
+#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
 #define BINARY_OP(value_type, op) \
     do { \
         if(!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
@@ -154,20 +766,143 @@ static InterpretResult run(){
         double a = AS_NUMBER(pop()); \
         push(value_type(a op b)); \
     } while (false)
-    
+/*operands already proven to be numbers, works on the stack in place*/
+#define NUMBER_OP(value_type, op) \
+    do { \
+        vm.stack_top[-2] = value_type(AS_NUMBER(vm.stack_top[-2]) op AS_NUMBER(vm.stack_top[-1])); \
+        vm.stack_top--; \
+    } while (false)
+
+/*
+    steps the counter of a fused loop and branches on `bound`, which
+    is read after the step in case it's the counter itself. anything
+    that isn't a number fails the way the ADD and LESS this replaces
+    would have
+*/
+#define FOR_LOOP(bound) \
+    do { \
+        uint16_t offset = READ_SHORT(); \
+        uint8_t* done = frame->ip + offset; \
+        Value* counter = &frame->slots[READ_BYTE()]; \
+        uint8_t bound_operand = READ_BYTE(); \
+        Value step = READ_CONSTANT(); \
+        if(!IS_NUMBER(*counter)){ \
+            runtime_error("Operands must be two numbers or two strings"); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        *counter = NUMBER_VAL(AS_NUMBER(*counter) + AS_NUMBER(step)); \
+        Value limit = bound; \
+        if(!IS_NUMBER(limit)){ \
+            runtime_error("Operands must be numbers"); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        if(!(AS_NUMBER(*counter) < AS_NUMBER(limit))){ \
+            push(BOOL_VAL(false)); \
+            frame->ip = done; \
+        } \
+    } while (false)
+/*the updated value replaces the operand on top of the stack*/
+#define UPDATE_LOCAL(operation) \
+    do { \
+        Value* variable = &frame->slots[READ_BYTE()]; \
+        if(!update(operation, variable, peek(0))) return INTERPRET_RUNTIME_ERROR; \
+        vm.stack_top[-1] = *variable; \
+    } while (false)
+#define UPDATE_UPVALUE(operation) \
+    do { \
+        Value* variable = frame->closure->upvalues[READ_BYTE()]->location; \
+        if(!update(operation, variable, peek(0))) return INTERPRET_RUNTIME_ERROR; \
+        vm.stack_top[-1] = *variable; \
+    } while (false)
+/*the instance is below the operand, the updated field replaces both*/
+#define UPDATE_PROPERTY(operation) \
+    do { \
+        uint8_t constant = READ_BYTE(); \
+        if(!IS_INSTANCE(peek(1))){ \
+            runtime_error("Only instances have fields."); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        ObjInstance* instance = AS_INSTANCE(peek(1)); \
+        int slot; \
+        Obj* method; \
+        if(!find_property(frame->chunk, constant, instance, &slot, &method) || slot == -1){ \
+            runtime_error("Undefined field '%s'.", \
+                AS_CSTRING(frame->chunk->constants.values[constant])); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        Value* variable = &instance->fields[slot]; \
+        if(!update(operation, variable, peek(0))) return INTERPRET_RUNTIME_ERROR; \
+        vm.stack_top[-2] = *variable; \
+        vm.stack_top--; \
+    } while (false)
+/*the array or map and index are below the operand, the updated element replaces all three*/
+#define UPDATE_INDEX(operation) \
+    do { \
+        Value element; \
+        if(!get_element(peek(2), peek(1), &element) || \
+            !update(operation, &element, peek(0)) || \
+            !set_element(peek(2), peek(1), element)){ \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        vm.stack_top[-3] = element; \
+        vm.stack_top -= 2; \
+    } while (false)
+/*the number on top of the stack and its callee are replaced by `function` of it*/
+#define MATH_INTRINSIC(name, function) \
+    do { \
+        if(!IS_NUMBER(peek(0))){ \
+            runtime_error("Argument 1 of " name "() must be a number."); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        vm.stack_top[-2] = NUMBER_VAL(function(AS_NUMBER(peek(0)))); \
+        vm.stack_top--; \
+    } while (false)
+/*
+    the two numbers on top of the stack and their callee are replaced
+    by the one that `compare`s true against the other, or isn't NaN.
+    anything else goes to the native for its error
+*/
+#define PICK_INTRINSIC(compare, native) \
+    do { \
+        Value* args = vm.stack_top - 2; \
+        if(IS_NUMBER(args[0]) && IS_NUMBER(args[1])){ \
+            double b = AS_NUMBER(args[1]); \
+            args[-1] = b != b || AS_NUMBER(args[0]) compare b ? args[0] : args[1]; \
+        }else if(!native(2, args, args - 1)){ \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        vm.stack_top -= 2; \
+    } while (false)
+#define UPDATE_GLOBAL(operation) \
+    do { \
+        uint8_t constant = READ_BYTE(); \
+        Value* variable = global_slot(frame->chunk, constant); \
+        if(variable == NULL){ \
+            runtime_error("Undefined variable '%s'.", \
+                AS_CSTRING(frame->chunk->constants.values[constant])); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        if(!update(operation, variable, peek(0))) return INTERPRET_RUNTIME_ERROR; \
+        vm.stack_top[-1] = *variable; \
+    } while (false)
+
+#ifdef REGISTER_VM
+    if(frame->registers) goto registers;
+stack:
+#endif
     for (;;)
     {
 
 #ifdef DEBUG_TRACE_EXECUTION
-        printf("        ");
+        output_format(&vm.output, "        ");
         for (Value* slot = vm.stack; slot < vm.stack_top; slot++)
         {
-            printf("[ ");
+            output_format(&vm.output, "[ ");
             print_value(*slot);
-            printf(" ]");
+            output_format(&vm.output, " ]");
         }
-        printf("\n");
-        disassemble_instruction(&frame->function->chunk,(int)(frame->ip - frame->function->chunk.code));
+        output_format(&vm.output, "\n");
+        disassemble_instruction(frame->chunk,(int)(frame->ip - frame->chunk->code));
 #endif
 
         uint8_t instruction;
@@ -187,8 +922,20 @@ static InterpretResult run(){
             }
             case OP_GREATER: BINARY_OP(BOOL_VAL, >); break;
             case OP_LESS: BINARY_OP(BOOL_VAL,<); break;
+            /*
+                the peephole optimizer's fused forms of EQUAL NOT,
+                LESS NOT and GREATER NOT, so NaN compares the same way
+            */
+            case OP_NOT_EQUAL: {
+                Value b = pop();
+                Value a = pop();
+                push(BOOL_VAL(!values_equal(a, b)));
+                break;
+            }
+            case OP_GREATER_EQUAL: BINARY_OP(NOT_BOOL_VAL, <); break;
+            case OP_LESS_EQUAL: BINARY_OP(NOT_BOOL_VAL, >); break;
             case OP_ADD: {
-                if(IS_STRING(peek(0)) && IS_NUMBER(peek(1))){
+                if(IS_STRING(peek(0)) && IS_STRING(peek(1))){
                     concatenate();
                 }else if(IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))){
                     double b = AS_NUMBER(pop());
@@ -213,13 +960,15 @@ static InterpretResult run(){
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 push(NUMBER_VAL(-AS_NUMBER(pop())));
+                break;
             case OP_PRINT:{
                 print_value(pop());
-                printf("\n");
+                output_chars(&vm.output, "\n", 1);
                 break;
             }
             case OP_RETURN:
                 Value result = pop();
+                close_upvalues(frame->slots);
                 vm.frame_count--;
                 if(vm.frame_count == 0){
                     pop();
@@ -228,6 +977,9 @@ static InterpretResult run(){
                 vm.stack_top = frame->slots;
                 push(result);
                 frame = &vm.frames[vm.frame_count - 1];
+#ifdef REGISTER_VM
+                if(frame->registers) goto registers;
+#endif
                 break;
 
             case OP_POP: pop(); break;
@@ -241,6 +993,7 @@ static InterpretResult run(){
                 ObjString* name = READ_STRING();
                 table_set(&vm.globals, name, peek(0));
                 pop();
+                break;
             }
 
             case OP_SET_LOCAL:{
@@ -250,10 +1003,11 @@ static InterpretResult run(){
             }
 
             case OP_GET_GLOBAL:{
-                ObjString* name = READ_STRING();
+                uint8_t constant = READ_BYTE();
                 Value value;
-                if(!table_get(&vm.globals,name,&value)){
-                    runtime_error("Undefined variable '%s'.", name->chars);
+                if(!get_global(frame->chunk, constant, &value)){
+                    runtime_error("Undefined variable '%s'.",
+                        AS_CSTRING(frame->chunk->constants.values[constant]));
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 push(value);
@@ -286,6 +1040,28 @@ static InterpretResult run(){
             case OP_LOOP:{
                 uint16_t offset = READ_SHORT();
                 frame->ip -= offset;
+                /*this frame keeps its chunk, the next call gets the optimized one*/
+                heat(frame->function);
+                break;
+            }
+
+            case OP_ADD_NUMBER: NUMBER_OP(NUMBER_VAL, +); break;
+            case OP_SUBTRACT_NUMBER: NUMBER_OP(NUMBER_VAL, -); break;
+            case OP_MULTIPLY_NUMBER: NUMBER_OP(NUMBER_VAL, *); break;
+            case OP_DIVIDE_NUMBER: NUMBER_OP(NUMBER_VAL, /); break;
+            case OP_GREATER_NUMBER: NUMBER_OP(BOOL_VAL, >); break;
+            case OP_GREATER_EQUAL_NUMBER: NUMBER_OP(NOT_BOOL_VAL, <); break;
+            case OP_LESS_NUMBER: NUMBER_OP(BOOL_VAL, <); break;
+            case OP_LESS_EQUAL_NUMBER: NUMBER_OP(NOT_BOOL_VAL, >); break;
+
+            case OP_JUMP_IF_NOT_LESS:{
+                uint16_t offset = READ_SHORT();
+                double b = AS_NUMBER(pop());
+                double a = AS_NUMBER(pop());
+                if(!(a < b)){
+                    push(BOOL_VAL(false));
+                    frame->ip += offset;
+                }
                 break;
             }
 
@@ -296,6 +1072,249 @@ static InterpretResult run(){
                 }
 
                 frame = &vm.frames[vm.frame_count - 1];
+#ifdef REGISTER_VM
+                if(frame->registers) goto registers;
+#endif
+                break;
+            }
+
+            case OP_FOR_LOOP: FOR_LOOP(frame->slots[bound_operand]); break;
+            case OP_FOR_LOOP_K: FOR_LOOP(frame->chunk->constants.values[bound_operand]); break;
+
+            case OP_ADD_LOCAL: UPDATE_LOCAL(OP_ADD); break;
+            case OP_SUBTRACT_LOCAL: UPDATE_LOCAL(OP_SUBTRACT); break;
+            case OP_MULTIPLY_LOCAL: UPDATE_LOCAL(OP_MULTIPLY); break;
+            case OP_DIVIDE_LOCAL: UPDATE_LOCAL(OP_DIVIDE); break;
+            case OP_ADD_GLOBAL: UPDATE_GLOBAL(OP_ADD); break;
+            case OP_SUBTRACT_GLOBAL: UPDATE_GLOBAL(OP_SUBTRACT); break;
+            case OP_MULTIPLY_GLOBAL: UPDATE_GLOBAL(OP_MULTIPLY); break;
+            case OP_DIVIDE_GLOBAL: UPDATE_GLOBAL(OP_DIVIDE); break;
+
+            /*every JUMP in the table is 3 bytes long*/
+            case OP_SWITCH:{
+                double low = AS_NUMBER(READ_CONSTANT());
+                uint8_t count = READ_BYTE();
+                Value value = pop();
+                int entry = count;
+                if(IS_NUMBER(value)){
+                    double index = AS_NUMBER(value) - low;
+                    if(index >= 0 && index < count && index == (int)index) entry = (int)index;
+                }
+                frame->ip += 3 * entry;
+                break;
+            }
+            case OP_SWITCH_HASH:{
+                uint8_t first = READ_BYTE();
+                uint8_t count = READ_BYTE();
+                frame->ip += 3 * find_case(frame->chunk, first, count, pop());
+                break;
+            }
+
+            case OP_CALL_GLOBAL:{
+                uint8_t arg_count = READ_BYTE();
+                uint8_t constant = READ_BYTE();
+                if(!call_cached(frame->chunk, constant, peek(arg_count), arg_count)){
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                frame = &vm.frames[vm.frame_count - 1];
+#ifdef REGISTER_VM
+                if(frame->registers) goto registers;
+#endif
+                break;
+            }
+
+            case OP_CLOSURE:{
+                ObjClosure* closure = new_closure(AS_FUNCTION(READ_CONSTANT()));
+                push(OBJ_VAL(closure));
+                make_closure(frame, closure, frame->ip);
+                frame->ip += 2 * closure->upvalue_count;
+                break;
+            }
+            case OP_GET_UPVALUE:
+                push(*frame->closure->upvalues[READ_BYTE()]->location);
+                break;
+            case OP_SET_UPVALUE:
+                *frame->closure->upvalues[READ_BYTE()]->location = peek(0);
+                break;
+            case OP_CLOSE_UPVALUE:
+                close_upvalues(vm.stack_top - 1);
+                pop();
+                break;
+            case OP_ADD_UPVALUE: UPDATE_UPVALUE(OP_ADD); break;
+            case OP_SUBTRACT_UPVALUE: UPDATE_UPVALUE(OP_SUBTRACT); break;
+            case OP_MULTIPLY_UPVALUE: UPDATE_UPVALUE(OP_MULTIPLY); break;
+            case OP_DIVIDE_UPVALUE: UPDATE_UPVALUE(OP_DIVIDE); break;
+
+            case OP_CLASS:
+                push(OBJ_VAL(new_class(READ_STRING())));
+                break;
+            case OP_INHERIT:{
+                Value superclass = peek(1);
+                if(!IS_CLASS(superclass)){
+                    runtime_error("Superclass must be a class.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                table_add_all(&AS_CLASS(superclass)->methods, &AS_CLASS(peek(0))->methods);
+                pop();
+                break;
+            }
+            case OP_METHOD:{
+                ObjString* name = READ_STRING();
+                table_set(&AS_CLASS(peek(1))->methods, name, peek(0));
+                pop();
+                break;
+            }
+            case OP_GET_PROPERTY:{
+                uint8_t constant = READ_BYTE();
+                if(!IS_INSTANCE(peek(0))){
+                    runtime_error("Only instances have properties.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                ObjInstance* instance = AS_INSTANCE(peek(0));
+                int slot;
+                Obj* method;
+                if(!find_property(frame->chunk, constant, instance, &slot, &method)){
+                    runtime_error("Undefined property '%s'.",
+                        AS_CSTRING(frame->chunk->constants.values[constant]));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                vm.stack_top[-1] = slot != -1 ? instance->fields[slot] :
+                    OBJ_VAL(new_bound_method(peek(0), method));
+                break;
+            }
+            case OP_SET_PROPERTY:{
+                uint8_t constant = READ_BYTE();
+                if(!IS_INSTANCE(peek(1))){
+                    runtime_error("Only instances have fields.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                set_field(frame->chunk, constant, AS_INSTANCE(peek(1)), peek(0));
+                Value value = pop();
+                vm.stack_top[-1] = value;
+                break;
+            }
+            case OP_INVOKE:{
+                uint8_t constant = READ_BYTE();
+                uint8_t arg_count = READ_BYTE();
+                if(!invoke(frame->chunk, constant, arg_count)){
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                frame = &vm.frames[vm.frame_count - 1];
+#ifdef REGISTER_VM
+                if(frame->registers) goto registers;
+#endif
+                break;
+            }
+            case OP_GET_SUPER:{
+                uint8_t constant = READ_BYTE();
+                ObjClass* superclass = AS_CLASS(pop());
+                Obj* method;
+                if(!find_method(frame->chunk, constant, superclass, &method)){
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                vm.stack_top[-1] = OBJ_VAL(new_bound_method(peek(0), method));
+                break;
+            }
+            case OP_SUPER_INVOKE:{
+                uint8_t constant = READ_BYTE();
+                uint8_t arg_count = READ_BYTE();
+                ObjClass* superclass = AS_CLASS(pop());
+                Obj* method;
+                if(!find_method(frame->chunk, constant, superclass, &method) ||
+                    !call_method(method, arg_count)){
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                frame = &vm.frames[vm.frame_count - 1];
+#ifdef REGISTER_VM
+                if(frame->registers) goto registers;
+#endif
+                break;
+            }
+            case OP_ADD_PROPERTY: UPDATE_PROPERTY(OP_ADD); break;
+            case OP_SUBTRACT_PROPERTY: UPDATE_PROPERTY(OP_SUBTRACT); break;
+            case OP_MULTIPLY_PROPERTY: UPDATE_PROPERTY(OP_MULTIPLY); break;
+            case OP_DIVIDE_PROPERTY: UPDATE_PROPERTY(OP_DIVIDE); break;
+            case OP_ARRAY:{
+                uint8_t count = READ_BYTE();
+                ObjArray* array = new_array();
+                for (int i = count; i > 0; i--) array_append(array, peek(i - 1));
+                vm.stack_top -= count;
+                push(OBJ_VAL(array));
+                break;
+            }
+            case OP_MAP:{
+                uint8_t count = READ_BYTE();
+                ObjMap* map = new_map();
+                for (int i = count * 2; i > 0; i -= 2){
+                    if(!check_key(peek(i - 1))) return INTERPRET_RUNTIME_ERROR;
+                    map_set(map, peek(i - 1), peek(i - 2));
+                }
+                vm.stack_top -= count * 2;
+                push(OBJ_VAL(map));
+                break;
+            }
+            case OP_GET_INDEX:{
+                Value element;
+                if(!get_element(peek(1), peek(0), &element)) return INTERPRET_RUNTIME_ERROR;
+                vm.stack_top--;
+                vm.stack_top[-1] = element;
+                break;
+            }
+            case OP_SET_INDEX:{
+                Value value = peek(0);
+                if(!set_element(peek(2), peek(1), value)) return INTERPRET_RUNTIME_ERROR;
+                vm.stack_top -= 2;
+                vm.stack_top[-1] = value;
+                break;
+            }
+            case OP_ADD_INDEX: UPDATE_INDEX(OP_ADD); break;
+            case OP_SUBTRACT_INDEX: UPDATE_INDEX(OP_SUBTRACT); break;
+            case OP_MULTIPLY_INDEX: UPDATE_INDEX(OP_MULTIPLY); break;
+            case OP_DIVIDE_INDEX: UPDATE_INDEX(OP_DIVIDE); break;
+
+            case OP_CONCAT_N:
+                if(!concatenate_n(READ_BYTE())) return INTERPRET_RUNTIME_ERROR;
+                break;
+
+            case OP_SQRT:
+            case OP_FLOOR:
+            case OP_ABS:
+            case OP_MIN:
+            case OP_MAX:
+            case OP_LEN:{
+                int arg_count = instruction == OP_MIN || instruction == OP_MAX ? 2 : 1;
+                Value callee = peek(arg_count);
+                /*the global was given something else after this was compiled*/
+                if(!IS_NATIVE(callee) || AS_NATIVE(callee)->intrinsic != instruction){
+                    if(!call_value(callee, arg_count)) return INTERPRET_RUNTIME_ERROR;
+
+                    frame = &vm.frames[vm.frame_count - 1];
+#ifdef REGISTER_VM
+                    if(frame->registers) goto registers;
+#endif
+                    break;
+                }
+
+                switch (instruction){
+                    case OP_SQRT: MATH_INTRINSIC("sqrt", sqrt); break;
+                    case OP_FLOOR: MATH_INTRINSIC("floor", floor); break;
+                    case OP_ABS: MATH_INTRINSIC("abs", fabs); break;
+                    case OP_MIN: PICK_INTRINSIC(<, min_native); break;
+                    case OP_MAX: PICK_INTRINSIC(>, max_native); break;
+                    case OP_LEN:
+                        if(IS_STRING(peek(0))){
+                            vm.stack_top[-2] = NUMBER_VAL(AS_STRING(peek(0))->length);
+                        }else if(!len_native(1, vm.stack_top - 1, vm.stack_top - 2)){
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+                        vm.stack_top--;
+                        break;
+                }
                 break;
             }
 
@@ -304,7 +1323,240 @@ static InterpretResult run(){
         }
     }
 
+#ifdef REGISTER_VM
+/*
+    the register loop, same instructions as above but the operands
+    are slots of the frame, B and C are read before A gets written
+    so an instruction can write one of its own operands
+*/
+#define READ_SLOT() (frame->slots[READ_BYTE()])
+#define REGISTER_BINARY_OP(value_type, op, right) \
+    do { \
+        Value* a = &READ_SLOT(); \
+        Value b = READ_SLOT(); \
+        Value c = right; \
+        if(!IS_NUMBER(b) || !IS_NUMBER(c)) { \
+            runtime_error("Operands must be numbers"); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        *a = value_type(AS_NUMBER(b) op AS_NUMBER(c)); \
+    } while (false)
+#define REGISTER_ADD(right) \
+    do { \
+        Value* a = &READ_SLOT(); \
+        Value b = READ_SLOT(); \
+        Value c = right; \
+        if(IS_STRING(b) && IS_STRING(c)){ \
+            *a = OBJ_VAL(join_strings(AS_STRING(b), AS_STRING(c))); \
+        }else if(IS_NUMBER(b) && IS_NUMBER(c)){ \
+            *a = NUMBER_VAL(AS_NUMBER(b) + AS_NUMBER(c)); \
+        }else{ \
+            runtime_error("Operands must be two numbers or two strings"); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+    } while (false)
+
+registers:
+    for (;;)
+    {
+
+#ifdef DEBUG_TRACE_EXECUTION
+        output_format(&vm.output, "        ");
+        for (Value* slot = vm.stack; slot < vm.stack_top; slot++)
+        {
+            output_format(&vm.output, "[ ");
+            print_value(*slot);
+            output_format(&vm.output, " ]");
+        }
+        output_format(&vm.output, "\n");
+        disassemble_register_instruction(frame->chunk,(int)(frame->ip - frame->chunk->code));
+#endif
+
+        uint8_t instruction;
+        switch (instruction = READ_BYTE()){
+            case REG_MOVE:{
+                Value* a = &READ_SLOT();
+                *a = READ_SLOT();
+                break;
+            }
+            case REG_CONSTANT:{
+                Value* a = &READ_SLOT();
+                *a = READ_CONSTANT();
+                break;
+            }
+            case REG_NIL: READ_SLOT() = NIL_VAL; break;
+            case REG_TRUE: READ_SLOT() = BOOL_VAL(true); break;
+            case REG_FALSE: READ_SLOT() = BOOL_VAL(false); break;
+            case REG_EQUAL:
+            case REG_NOT_EQUAL:{
+                Value* a = &READ_SLOT();
+                Value b = READ_SLOT();
+                Value c = READ_SLOT();
+                *a = BOOL_VAL(values_equal(b, c) == (instruction == REG_EQUAL));
+                break;
+            }
+            case REG_EQUAL_K:
+            case REG_NOT_EQUAL_K:{
+                Value* a = &READ_SLOT();
+                Value b = READ_SLOT();
+                Value c = READ_CONSTANT();
+                *a = BOOL_VAL(values_equal(b, c) == (instruction == REG_EQUAL_K));
+                break;
+            }
+            case REG_GREATER: REGISTER_BINARY_OP(BOOL_VAL, >, READ_SLOT()); break;
+            case REG_GREATER_EQUAL: REGISTER_BINARY_OP(NOT_BOOL_VAL, <, READ_SLOT()); break;
+            case REG_LESS: REGISTER_BINARY_OP(BOOL_VAL, <, READ_SLOT()); break;
+            case REG_LESS_EQUAL: REGISTER_BINARY_OP(NOT_BOOL_VAL, >, READ_SLOT()); break;
+            case REG_ADD: REGISTER_ADD(READ_SLOT()); break;
+            case REG_SUBTRACT: REGISTER_BINARY_OP(NUMBER_VAL, -, READ_SLOT()); break;
+            case REG_MULTIPLY: REGISTER_BINARY_OP(NUMBER_VAL, *, READ_SLOT()); break;
+            case REG_DIVIDE: REGISTER_BINARY_OP(NUMBER_VAL, /, READ_SLOT()); break;
+            case REG_GREATER_K: REGISTER_BINARY_OP(BOOL_VAL, >, READ_CONSTANT()); break;
+            case REG_GREATER_EQUAL_K: REGISTER_BINARY_OP(NOT_BOOL_VAL, <, READ_CONSTANT()); break;
+            case REG_LESS_K: REGISTER_BINARY_OP(BOOL_VAL, <, READ_CONSTANT()); break;
+            case REG_LESS_EQUAL_K: REGISTER_BINARY_OP(NOT_BOOL_VAL, >, READ_CONSTANT()); break;
+            case REG_ADD_K: REGISTER_ADD(READ_CONSTANT()); break;
+            case REG_SUBTRACT_K: REGISTER_BINARY_OP(NUMBER_VAL, -, READ_CONSTANT()); break;
+            case REG_MULTIPLY_K: REGISTER_BINARY_OP(NUMBER_VAL, *, READ_CONSTANT()); break;
+            case REG_DIVIDE_K: REGISTER_BINARY_OP(NUMBER_VAL, /, READ_CONSTANT()); break;
+            case REG_NOT:{
+                Value* a = &READ_SLOT();
+                *a = BOOL_VAL(is_falsey(READ_SLOT()));
+                break;
+            }
+            case REG_NEGATE:{
+                Value* a = &READ_SLOT();
+                Value b = READ_SLOT();
+                if(!IS_NUMBER(b)){
+                    runtime_error("Operand must be a number.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                *a = NUMBER_VAL(-AS_NUMBER(b));
+                break;
+            }
+            case REG_PRINT:
+                print_value(READ_SLOT());
+                output_chars(&vm.output, "\n", 1);
+                break;
+            case REG_GET_GLOBAL:{
+                Value* a = &READ_SLOT();
+                uint8_t constant = READ_BYTE();
+                if(!get_global(frame->chunk, constant, a)){
+                    runtime_error("Undefined variable '%s'.",
+                        AS_CSTRING(frame->chunk->constants.values[constant]));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case REG_SET_GLOBAL:{
+                Value a = READ_SLOT();
+                ObjString* name = READ_STRING();
+                if(table_set(&vm.globals, name, a)){
+                    table_delete(&vm.globals, name);
+                    runtime_error("Setting Undefined variable '%s'", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case REG_ADD_GLOBAL:
+            case REG_SUBTRACT_GLOBAL:
+            case REG_MULTIPLY_GLOBAL:
+            case REG_DIVIDE_GLOBAL:{
+                Value* a = &READ_SLOT();
+                uint8_t constant = READ_BYTE();
+                Value* variable = global_slot(frame->chunk, constant);
+                if(variable == NULL){
+                    runtime_error("Undefined variable '%s'.",
+                        AS_CSTRING(frame->chunk->constants.values[constant]));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if(!update(OP_ADD + (instruction - REG_ADD_GLOBAL), variable, *a)){
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                *a = *variable;
+                break;
+            }
+            case REG_DEFINE_GLOBAL:{
+                Value a = READ_SLOT();
+                table_set(&vm.globals, READ_STRING(), a);
+                break;
+            }
+            case REG_JUMP:{
+                uint16_t offset = READ_SHORT();
+                frame->ip += offset;
+                break;
+            }
+            case REG_JUMP_IF_FALSE:{
+                Value a = READ_SLOT();
+                uint16_t offset = READ_SHORT();
+                if(is_falsey(a)) frame->ip += offset;
+                break;
+            }
+            case REG_LOOP:{
+                uint16_t offset = READ_SHORT();
+                frame->ip -= offset;
+                heat(frame->function);
+                break;
+            }
+            case REG_CALL:{
+                uint8_t a = READ_BYTE();
+                uint8_t arg_count = READ_BYTE();
+                /*the callee's frame goes right on top of the arguments*/
+                vm.stack_top = frame->slots + a + arg_count + 1;
+                if(!call_value(frame->slots[a], arg_count)){
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                frame = &vm.frames[vm.frame_count - 1];
+                if(!frame->registers) goto stack;
+                break;
+            }
+            case REG_CALL_GLOBAL:{
+                uint8_t a = READ_BYTE();
+                uint8_t arg_count = READ_BYTE();
+                uint8_t constant = READ_BYTE();
+                vm.stack_top = frame->slots + a + arg_count + 1;
+                if(!call_cached(frame->chunk, constant, frame->slots[a], arg_count)){
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                frame = &vm.frames[vm.frame_count - 1];
+                if(!frame->registers) goto stack;
+                break;
+            }
+            case REG_RETURN:{
+                Value result = READ_SLOT();
+                vm.frame_count--;
+                vm.stack_top = frame->slots;
+                if(vm.frame_count == 0) return INTERPRET_OK;
+
+                push(result);
+                frame = &vm.frames[vm.frame_count - 1];
+                if(!frame->registers) goto stack;
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+
+#undef REGISTER_ADD
+#undef REGISTER_BINARY_OP
+#undef READ_SLOT
+#endif
+
 #undef BINARY_OP
+#undef NUMBER_OP
+#undef FOR_LOOP
+#undef UPDATE_LOCAL
+#undef UPDATE_GLOBAL
+#undef UPDATE_UPVALUE
+#undef UPDATE_PROPERTY
+#undef UPDATE_INDEX
+#undef MATH_INTRINSIC
+#undef PICK_INTRINSIC
+#undef NOT_BOOL_VAL
 #undef READ_CONSTANT
 #undef READ_BYTE
 #undef READ_SHORT
@@ -319,45 +1571,105 @@ static bool is_falsey(Value value){
 static void concatenate(){
     ObjString* b = AS_STRING(pop());
     ObjString* a = AS_STRING(pop());
+    push(OBJ_VAL(join_strings(a, b)));
+}
 
+/*
+    the `count` strings on top of the stack go into one, only that
+    one is allocated and interned
+*/
+static bool concatenate_n(int count){
+    Value* strings = vm.stack_top - count;
+    int length = 0;
+    for (int i = 0; i < count; i++){
+        if(!IS_STRING(strings[i])){
+            runtime_error("Operands must be two numbers or two strings");
+            return false;
+        }
+        length += AS_STRING(strings[i])->length;
+    }
+
+    char* chars = ALLOCATE(char, length + 1);
+    char* next = chars;
+    for (int i = 0; i < count; i++){
+        ObjString* string = AS_STRING(strings[i]);
+        memcpy(next, string->chars, string->length);
+        next += string->length;
+    }
+    chars[length] = '\0';
+
+    strings[0] = OBJ_VAL(take_string(chars, length));
+    vm.stack_top = strings + 1;
+    return true;
+}
+
+static ObjString* join_strings(ObjString* a, ObjString* b){
     int length = a->length + b->length;
     char* chars = ALLOCATE(char, length + 1);
     memcpy(chars, a->chars, a->length);
     memcpy(chars + a->length, b->chars, b->length);
     chars[length] = '\0';
 
-    ObjString* result = take_string(chars, length);
-    push(OBJ_VAL(result));
+    return take_string(chars, length);
 }
 
 static void runtime_error(const char* format, ...){
     va_list args;
     va_start(args,format);
-    vfprintf(stderr, format, args);
+    report_error(format, args);
+    va_end(args);
+}
+
+/*for natives, they return false straight after*/
+void native_error(const char* format, ...){
+    va_list args;
+    va_start(args,format);
+    report_error(format, args);
     va_end(args);
+}
+
+static void report_error(const char* format, va_list args){
+    /*what was printed before the error shows up before it*/
+    flush_output(&vm.output);
+    vfprintf(stderr, format, args);
     fputs("\n", stderr);
 
-    for (int i = vm.frame_count - 1; i > 0; i--){
+    for (int i = vm.frame_count - 1; i >= 0; i--){
         CallFrame* frame = &vm.frames[i];
         ObjFunction* function = frame->function;
 
-        size_t instruction = frame->ip - function->chunk.code -1;
-        fprintf(stderr,"[line %d]", function->chunk.lines[instruction]);
+        size_t instruction = frame->ip - frame->chunk->code -1;
+        int line = get_line(frame->chunk, (int)instruction);
+
+        /*inlined calls get the frames they'd have had*/
+        while(LINE_FRAME(line) > 0 && LINE_FRAME(line) <= function->inline_frame_count){
+            InlineFrame* inlined = &function->inline_frames[LINE_FRAME(line) - 1];
+            fprintf(stderr,"[line %d] %s()\n", LINE_NUMBER(line), inlined->name->chars);
+            line = inlined->line;
+        }
+        fprintf(stderr,"[line %d]", LINE_NUMBER(line));
 
         if(function->name == NULL){
             fprintf(stderr," script\n");
         }else{
-            fprintf(stderr," %s()", function->name->chars);
+            fprintf(stderr," %s()\n", function->name->chars);
         }
     }
     
     reset_stack();
 }
 
-static void define_native(const char* name, NativeFn function){
+static ObjNative* define_native(const char* name, NativeFn function, const char* params, int optional){
+    ObjNative* native = new_native(function, name, params, optional);
     push(OBJ_VAL(copy_string(name,(int)strlen(name))));
-    push(OBJ_VAL(new_native(function)));
+    push(OBJ_VAL(native));
     table_set(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
     pop();
     pop();
+    return native;
+}
+
+/*a native the compiler turns calls into `opcode` for, see intrinsic_call() in lib/compiler.c*/
+static void define_intrinsic(uint8_t opcode, const char* name, NativeFn function, const char* params, int optional){
+    define_native(name, function, params, optional)->intrinsic = opcode;
 }
\ No newline at end of file
@@ -3,7 +3,9 @@
 #include <string.h>
 
 #include "common.h"
+#include "cache.h"
 #include "chunk.h"
+#include "compiler.h"
 #include "debug.h"
 #include "vm.h"
 
@@ -33,13 +35,14 @@ int main(int argc, const char * argv[]){
 static void repl(){
     char line[1024];
     for(;;){
-        printf("> ");
+        output_string(&vm.output, "> ");
+        flush_output(&vm.output);
         /*
             fgets stops reading from the source
             [stdio] when it encounters a \n
         */
         if(!fgets(line,sizeof(line),stdin)){
-            printf("\n");
+            output_string(&vm.output, "\n");
             break;
         }
 
@@ -49,8 +52,29 @@ static void repl(){
 
 static void run_file(const char* path){
     char* source  = read_file(path);
-    InterpretResult result = interpret(source);
+    /*
+        a warm start picks the bytecode up from the .loxc cache
+        and never touches the compiler, otherwise we compile and
+        leave a cache behind for the next run
+    */
+    char* cached_path = cache_path(path);
+    ObjFunction* function = cached_path != NULL ? load_cache(cached_path, source) : NULL;
+
+    if(function == NULL){
+        function = compile(source, true);
+        if(function == NULL){
+            free(cached_path);
+            free(source);
+            flush_output(&vm.output);
+            exit(65);
+        }
+        if(cached_path != NULL) write_cache(cached_path, source, function);
+    }
+
+    InterpretResult result = interpret_function(function);
+    free(cached_path);
     free(source);
+    flush_output(&vm.output);
 
     if(result == INTERPRET_COMPILE_ERROR) exit(65);
     if(result == INTERPRET_RUNTIME_ERROR) exit(70);
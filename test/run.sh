@@ -0,0 +1,74 @@
+#!/bin/sh
+# Builds clox with debug output off as configured in include/common.h,
+# with every optimization toggle commented out, on the register VM, with
+# LAZY_COMPILE and with a HOT_THRESHOLD of 1 so every function that gets
+# called goes through the optimizing tier, then runs each test/*.lox on all of them and diffs
+# what it prints against the .out file next to it. Every script runs
+# twice per build, cold and then warm from its .loxc cache. A build that
+# is meant to print something else reads name.<build>.out instead.
+#
+#   sh test/run.sh [test.lox ...]
+#
+# CC and CFLAGS can be set in the environment, CFLAGS=-mavx runs the
+# AVX kernels.
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${TMPDIR:-/tmp}/clox-test.$$
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+OPTIMIZATIONS="PEEPHOLE_OPTIMIZE OPTIMIZING_TIER INLINE_CALLS SPECIALIZE_NUMBERS
+    REGISTER_VM FUSE_COUNTING_LOOPS INLINE_CACHES JUMP_TABLES SIMD_KERNELS"
+
+trap 'rm -rf "$WORK"' EXIT
+
+# build <name> <toggles to comment out> [<toggles to turn on or NAME=VALUE>]
+build(){
+    mkdir -p "$WORK/$1/include" "$WORK/$1/obj" "$WORK/$1/cache"
+    cp "$ROOT"/include/*.h "$WORK/$1/include/"
+    for toggle in DEBUG_PRINT_CODE DEBUG_TRACE_EXECUTION $2; do
+        sed -i "s|^#define $toggle\$|// #define $toggle|" "$WORK/$1/include/common.h"
+    done
+    for toggle in $3; do
+        case $toggle in
+            *=*) sed -i "s|^#define ${toggle%%=*} .*|#define ${toggle%%=*} ${toggle#*=}|" "$WORK/$1/include/common.h" ;;
+            *) sed -i "s|^//#define $toggle\$|#define $toggle|" "$WORK/$1/include/common.h" ;;
+        esac
+    done
+    for source in "$ROOT"/lib/*.c "$ROOT"/main.c; do
+        $CC -std=c99 $CFLAGS -I"$WORK/$1/include" -c "$source" \
+            -o "$WORK/$1/obj/$(basename "$source" .c).o"
+    done
+    $CC $CFLAGS -o "$WORK/$1/clox" "$WORK/$1"/obj/*.o -lm
+}
+
+BUILDS="baseline optimized registers lazy tiered"
+build baseline "$OPTIMIZATIONS"
+build optimized ""
+build registers "" REGISTER_VM
+build lazy "" LAZY_COMPILE
+build tiered "" HOT_THRESHOLD=1
+
+if [ $# -eq 0 ]; then set -- "$ROOT"/test/*.lox; fi
+
+failed=0
+for script in "$@"; do
+    for name in $BUILDS; do
+        expected="${script%.lox}.$name.out"
+        if [ ! -f "$expected" ]; then expected="${script%.lox}.out"; fi
+        for run in cold warm; do
+            CLOX_CACHE_DIR="$WORK/$name/cache" "$WORK/$name/clox" "$script" > "$WORK/actual" 2>&1 || true
+            if ! diff "$expected" "$WORK/actual" > "$WORK/diff"; then
+                echo "FAIL $(basename "$script") ($name, $run)"
+                cat "$WORK/diff"
+                failed=$((failed + 1))
+            fi
+        done
+    done
+done
+
+if [ $failed -gt 0 ]; then
+    echo "$failed failed"
+    exit 1
+fi
+echo "all $# passed"